@@ -9,7 +9,11 @@
 
 #ifdef __linux__
 #include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
 #endif
+#include <thread>
+#include <vector>
 
 #define STATUS int
 
@@ -28,7 +32,8 @@ enum STATUS_NUM{
     STATUS_INVALID_VALUE,
     STATUS_INVALID_SIZE,
     STATUS_INVALID_ALIGNMENT,
-    STATUS_INVALID_HANDLE
+    STATUS_INVALID_HANDLE,
+    STATUS_WOULD_BLOCK
 };
 
 inline bool FAILED(STATUS status) {
@@ -90,6 +95,13 @@ inline void set_log_level(LogLevel level) {
     g_log_level = level;
 }
 
+// Data-path (post/poll/arm) logging is resolved at compile time so that
+// production builds carry no formatting cost on the hot path.
+#ifndef DATAPATH_LOG_LEVEL
+#define DATAPATH_LOG_LEVEL LOG_LEVEL_ERROR
+#endif
+static constexpr LogLevel k_datapath_log_level = static_cast<LogLevel>(DATAPATH_LOG_LEVEL);
+
 // Corrected log_error
 inline void log_error(const char* format, ...) {
     va_list args;
@@ -122,6 +134,12 @@ inline void log_info(const char* format, ...) {
     }
 }
 
+#define log_dp_debug(...) \
+    do { \
+        if constexpr (k_datapath_log_level >= LOG_LEVEL_DEBUG) { \
+            log_debug(__VA_ARGS__); \
+        } \
+    } while (0)
 
 #define RETURN_IF_FAILED(expr) \
     do { \
@@ -239,6 +257,7 @@ static unsigned tlx_ffs64(uint64_t n)
 /* The i-th bit */
 #define TLX_BIT_GET(_value, _i)  (!!((_value) & TLX_BIT(_i)))
 
+#define likely(x)        __builtin_expect(!!(x), 1)
 #define unlikely(x)      __builtin_expect(!!(x), 0)
 
 /* Align helpers --------------------------------------------------------- */
@@ -269,6 +288,213 @@ T* aligned_alloc(size_t size, size_t* allocated_size = nullptr) {
     return static_cast<T*>(ptr);
 }
 
+//==============================================================================
+// page size policy for registered buffers
+//==============================================================================
+#define HUGE_PAGE_2M_LOG 21
+#define HUGE_PAGE_1G_LOG 30
+
+enum mem_page_policy {
+    MEM_PAGE_DEFAULT = 0,   /* base pages, aligned_alloc() */
+    MEM_PAGE_THP,           /* 2MB aligned + MADV_HUGEPAGE, THP if the kernel has one */
+    MEM_PAGE_HUGE_2M,       /* MAP_HUGETLB 2MB pages, falls back to THP */
+    MEM_PAGE_HUGE_1G        /* MAP_HUGETLB 1GB pages, falls back to 2MB */
+};
+
+enum mem_alloc_flags {
+    MEM_ALLOC_LAZY_ZERO = 1 << 0,   /* fresh anonymous mapping: the kernel zeroes
+                                       each page on first touch, no memset */
+    MEM_ALLOC_PREFAULT  = 1 << 1    /* fault every page in before returning,
+                                       in parallel for large buffers */
+};
+
+/* Smallest share of a buffer worth a prefault thread of its own */
+#define MEM_PREFAULT_CHUNK (64UL << 20)
+
+struct page_buffer {
+    void*    addr     = nullptr;
+    size_t   size     = 0;      /* bytes backed, a multiple of the page size */
+    unsigned page_log = 0;      /* log2 of the page size actually used */
+    bool     mapped   = false;  /* mmap()ed: release with munmap() */
+};
+
+inline bool page_buffer_map(size_t size, unsigned page_log, page_buffer* buf) {
+#if defined(__linux__) && defined(MAP_HUGETLB) && defined(MAP_HUGE_SHIFT)
+    size_t bytes = tlx_align_up_pow2(size, 1UL << page_log);
+    void* ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (page_log << MAP_HUGE_SHIFT),
+                     -1, 0);
+    if (ptr == MAP_FAILED) {
+        log_info("No free 2^%u hugepages for %zu bytes, falling back", page_log, bytes);
+        return false;
+    }
+
+    log_debug("Mapped %zu bytes at %p on 2^%u pages", bytes, ptr, page_log);
+    buf->addr     = ptr;
+    buf->size     = bytes;
+    buf->page_log = page_log;
+    buf->mapped   = true;
+    return true;
+#else
+    (void)size; (void)page_log; (void)buf;
+    return false;
+#endif
+}
+
+/* Anonymous mapping of size bytes aligned to 2^align_log; the unaligned
+   head and tail of the reservation are given back */
+inline void* page_buffer_map_aligned(size_t size, unsigned align_log) {
+    const size_t align = 1UL << align_log;
+    const size_t extra = align > get_page_size() ? align : 0;
+
+    char* ptr = (char*)mmap(nullptr, size + extra, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) {
+        return nullptr;
+    }
+
+    char* start = tlx_align_up_pow2_ptr(ptr, align);
+    if (start != ptr) {
+        munmap(ptr, start - ptr);
+    }
+    if (ptr + size + extra != start + size) {
+        munmap(start + size, ptr + extra - start);
+    }
+    return start;
+}
+
+/*
+ * Store a zero into every page so the faults (and the kernel's zeroing) are
+ * paid now rather than by the first DMA or the pinning in registration.
+ * Meant for fresh zero-filled mappings: a plain store takes one fault per
+ * page where a read first would map the zero page and then copy it.
+ * Buffers above MEM_PREFAULT_CHUNK are split across threads, at most
+ * max_threads (0: one per CPU the caller may run on). Each thread is pinned
+ * to one of the caller's CPUs, so first-touch places the pages on the NUMA
+ * nodes the caller is bound to.
+ */
+inline void page_buffer_prefault(void* addr, size_t size, unsigned page_log,
+                                 unsigned max_threads = 0) {
+    const size_t page = 1UL << page_log;
+    auto touch = [page](char* p, char* end) {
+        for (; p < end; p += page) {
+            *(volatile char*)p = 0;
+        }
+    };
+
+    std::vector<int> cpus;
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &allowed)) {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+
+    size_t threads = size / MEM_PREFAULT_CHUNK;
+    if (threads > cpus.size()) {
+        threads = cpus.size();
+    }
+    if (max_threads && threads > max_threads) {
+        threads = max_threads;
+    }
+    if (threads <= 1) {
+        touch((char*)addr, (char*)addr + size);
+        return;
+    }
+
+    // Page-aligned shares; the caller takes the first one
+    const size_t share = tlx_align_up_pow2((size + threads - 1) / threads, page);
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < threads && i * share < size; ++i) {
+        char* begin = (char*)addr + i * share;
+        char* end   = (char*)addr + (((i + 1) * share < size) ? (i + 1) * share : size);
+        int   cpu   = cpus[i];
+        workers.emplace_back([=]() {
+            cpu_set_t one;
+            CPU_ZERO(&one);
+            CPU_SET(cpu, &one);
+            sched_setaffinity(0, sizeof(one), &one);
+            touch(begin, end);
+        });
+    }
+    touch((char*)addr, (char*)addr + (share < size ? share : size));
+
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    log_debug("Prefaulted %zu bytes at %p with %zu threads", size, addr, workers.size() + 1);
+}
+
+/*
+ * Allocate a zeroed buffer of at least size bytes under the given policy.
+ * Each hugepage policy falls back to the next smaller one when the pool is
+ * empty, and buf->page_log reports what was actually obtained. THP is only
+ * advice, so it reports the base page size. Hugepages always come from a
+ * fresh mapping; flags (mem_alloc_flags) pick that for base pages and THP
+ * too, and prefaulting.
+ */
+inline bool page_buffer_alloc(size_t size, mem_page_policy policy, page_buffer* buf,
+                              uint32_t flags = 0) {
+    *buf = page_buffer();
+
+    bool mapped = (policy == MEM_PAGE_HUGE_1G && page_buffer_map(size, HUGE_PAGE_1G_LOG, buf)) ||
+                  ((policy == MEM_PAGE_HUGE_1G || policy == MEM_PAGE_HUGE_2M) &&
+                   page_buffer_map(size, HUGE_PAGE_2M_LOG, buf));
+
+    if (!mapped) {
+        const unsigned align_log = (policy != MEM_PAGE_DEFAULT) ? HUGE_PAGE_2M_LOG
+                                                                : get_page_size_log();
+        const size_t bytes = tlx_align_up_pow2(size, 1UL << align_log);
+        void* ptr = nullptr;
+
+        if (flags & MEM_ALLOC_LAZY_ZERO) {
+            ptr = page_buffer_map_aligned(bytes, align_log);
+            if (!ptr) {
+                return false;
+            }
+        } else if (posix_memalign(&ptr, 1UL << align_log, bytes) != 0) {
+            return false;
+        }
+#ifdef MADV_HUGEPAGE
+        if (policy != MEM_PAGE_DEFAULT) {
+            madvise(ptr, bytes, MADV_HUGEPAGE);
+        }
+#endif
+
+        buf->addr     = ptr;
+        buf->size     = bytes;
+        buf->page_log = get_page_size_log();
+        buf->mapped   = (flags & MEM_ALLOC_LAZY_ZERO) != 0;
+
+        // Recycled heap memory is not zero; the memset also faults it in
+        if (!buf->mapped) {
+            memset(ptr, 0, bytes);
+            return true;
+        }
+        log_debug("Mapped %zu bytes at %p, zero-filled on first touch", bytes, ptr);
+    }
+
+    if (flags & MEM_ALLOC_PREFAULT) {
+        page_buffer_prefault(buf->addr, buf->size, buf->page_log);
+    }
+    return true;
+}
+
+inline void page_buffer_free(page_buffer* buf) {
+    if (!buf->addr) {
+        return;
+    }
+    if (buf->mapped) {
+        munmap(buf->addr, buf->size);
+    } else {
+        free(buf->addr);
+    }
+    *buf = page_buffer();
+}
+
 #define MLX5_ALWAYS_INLINE      inline __attribute__ ((always_inline))
 
 static MLX5_ALWAYS_INLINE
@@ -23,9 +23,12 @@ rdma_ep::destroy() {
         _resources._pd = nullptr;
     }
     if (_resources._cq) {
-        _resources._cq->destroy();
+        if (_resources._owns_cq) {
+            _resources._cq->destroy();
+        }
         _resources._cq = nullptr;
     }
+    _resources._srq = nullptr;
     if (_resources._uar_obj) {
         _resources._uar_obj->destroy();
         _resources._uar_obj = nullptr;
@@ -39,9 +42,10 @@ rdma_ep::destroy() {
 STATUS
 rdma_ep::initialize(rdma_device* rdevice,
                     qp_init_connection_params& con_params,
-                    qp_init_creation_params& qp_params,
+                    const qp_init_creation_params& qp_params,
                     cq_hw_params& cq_hw_params,
-                    mr_creation_params& mr_params)
+                    mr_creation_params& mr_params,
+                    shared_receive_queue* srq)
 {
 
 
@@ -51,7 +55,8 @@ rdma_ep::initialize(rdma_device* rdevice,
                                       con_params,
                                       qp_params,
                                       cq_hw_params,
-                                      mr_params);
+                                      mr_params,
+                                      srq);
     RETURN_IF_FAILED_MSG(res, "Failed to create resources");
 
     _status = CONNECTION_STATUS_INITIALIZING;
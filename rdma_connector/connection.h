@@ -17,6 +17,8 @@ struct connection_resources {
     queue_pair* _qp;
     protection_domain* _pd;
     completion_queue_devx* _cq;
+    bool _owns_cq;
+    shared_receive_queue* _srq;     // caller's, never destroyed here
     rdma_device* _rdevice;
     uar* _uar_obj;
     memory_region* _mr;
@@ -25,9 +27,10 @@ struct connection_resources {
     create_resources(
         rdma_device* rdevice,
         qp_init_connection_params& con_params,
-        qp_init_creation_params& qp_params,
+        const qp_init_creation_params& qp_params,
         cq_hw_params& cq_hw_params,
-        mr_creation_params& mr_params
+        mr_creation_params& mr_params,
+        shared_receive_queue* srq = nullptr
     )
     {
         STATUS res = STATUS_OK;
@@ -48,14 +51,24 @@ struct connection_resources {
         auto hca_cap = rdevice->get_hca_cap();
         auto dev_attr = rdevice->get_device_attr();
         uint32_t max_inline = max_inline_from_wqesz(hca_cap.max_wqe_sz_sq, dev_attr->max_sge);
-        qp_umem_layout layout = calc_qp_umem_layout(qp_params.max_recv_wr,
+        // Receives from a shared SRQ leave the QP without an RQ of its own
+        qp_umem_layout layout = calc_qp_umem_layout(srq ? 0 : qp_params.max_recv_wr,
                                                     MLX5_RQ_STRIDE,
                                                     qp_params.max_send_wr,
                                                     dev_attr->max_sge,
                                                     max_inline);
 
+        // The QP is created from a copy: per-endpoint objects never leak into
+        // a qp_params the caller reuses for its next endpoint
+        qp_init_creation_params params = qp_params;
+        if (params.max_inline_data == 0 || params.max_inline_data > max_inline) {
+            params.max_inline_data = max_inline;
+        }
+
         auto_ref<user_memory> umem_sq;
-        res = umem_sq->initialize(rdevice->get_context(), layout.total_bytes);
+        res = umem_sq->initialize(rdevice->get_context(), layout.total_bytes,
+                                  (mem_page_policy)params.page_policy,
+                                  params.alloc_flags);
         RETURN_IF_FAILED_MSG(res, "Failed to initialize user memory for SQ");
 
         auto_ref<user_memory> umem_db;
@@ -63,40 +76,49 @@ struct connection_resources {
         RETURN_IF_FAILED_MSG(res, "Failed to initialize user memory for DB");
 
         auto_ref<uar> uar_obj;
-        res = uar_obj->initialize(rdevice->get_context());
+        res = uar_obj->initialize(rdevice->get_context(),
+                                  params.use_bf ? MLX5DV_UAR_ALLOC_TYPE_BF
+                                                   : MLX5DV_UAR_ALLOC_TYPE_NC);
         RETURN_IF_FAILED_MSG(res, "Failed to initialize UAR");
 
-
-        cq_hw_params.log_page_size = get_page_size_log();
-        cq_hw_params.cqe_sz = 0;
-        cq_hw_params.cqe_comp_en = 0;
-        cq_hw_params.cqe_comp_layout = 0;
-        cq_hw_params.mini_cqe_res_format = 0;
-
+        // cq_hw_params is taken as given: cqe_sz = 1 gives 128-byte CQEs,
+        // which QP_SCATTER_TO_CQE_64 needs.
+        // A send_cq set by the caller is shared with other connections and
+        // stays the caller's; otherwise the endpoint creates and owns one.
         auto_ref<completion_queue_devx> cq;
-        res = cq->initialize(rdevice, cq_hw_params);
-        RETURN_IF_FAILED_MSG(res, "Failed to initialize completion queue");
-
-        qp_params.rdevice = rdevice;
-        qp_params.context = rdevice->get_context();
-        qp_params.pdn = pd->get_pdn();
-        qp_params.cqn = cq->get_cqn();
-        qp_params.uar_obj = uar_obj;
-        qp_params.umem_sq = umem_sq;
-        qp_params.umem_db = umem_db;
+        if (qp_params.send_cq) {
+            cq = auto_ref<completion_queue_devx>(*qp_params.send_cq);
+        } else {
+            res = cq->initialize(rdevice, cq_hw_params);
+            RETURN_IF_FAILED_MSG(res, "Failed to initialize completion queue");
+        }
+        _owns_cq = !qp_params.send_cq;
+
+        params.rdevice = rdevice;
+        params.context = rdevice->get_context();
+        params.pdn = pd->get_pdn();
+        params.cqn = cq->get_cqn();
+        params.send_cq = cq;
+        params.uar_obj = uar_obj;
+        params.umem_sq = umem_sq;
+        params.umem_db = umem_db;
+        params.srq = srq;
 
         auto_ref<queue_pair> qp;
-        res = qp->initialize(qp_params);
+        res = qp->initialize(params);
         RETURN_IF_FAILED_MSG(res, "Failed to initialize queue pair");
 
         auto_ref<memory_region> mr;
-        res = mr->initialize(rdevice, qp, pd, mr_params.length);
+        res = mr->initialize(rdevice, qp, pd, mr_params.length,
+                             (mem_page_policy)mr_params.page_policy,
+                             mr_params.alloc_flags);
         RETURN_IF_FAILED_MSG(res, "Failed to initialize memory region");
 
         _rdevice = rdevice;
         _qp      = qp.get();
         _pd      = pd.get();
         _cq      = cq.get();
+        _srq     = srq;
         _uar_obj = uar_obj.get();
         _mr      = mr.get();
 
@@ -113,11 +135,18 @@ public:
 
     void destroy();
 
+    /* qp_params is only read. Its send_cq, when set, is a CQ shared by every
+       endpoint given it; otherwise each endpoint creates and destroys its
+       own. srq, when given, is shared the same way and the QP gets no RQ of
+       its own; receive buffers posted to it are checked against the PD it
+       was created on. Shared CQs and SRQs stay the caller's: destroy() leaves
+       them alone and they must outlive every endpoint using them. */
     STATUS initialize(rdma_device* rdevice,
                       qp_init_connection_params& con_parmas,
-                      qp_init_creation_params& qp_params,
+                      const qp_init_creation_params& qp_params,
                       cq_hw_params& cq_hw_params,
-                      mr_creation_params& mr_params);
+                      mr_creation_params& mr_params,
+                      shared_receive_queue* srq = nullptr);
     
 
 
@@ -169,6 +198,10 @@ public:
         return _resources._cq->get_cqn();
     }
 
+    shared_receive_queue* get_srq() const {
+        return _resources._srq;
+    }
+
     uint32_t get_pd() const {
         return _resources._pd->get_pdn();
     }
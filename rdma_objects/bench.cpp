@@ -0,0 +1,545 @@
+// Host-only microbenchmarks for the data path. The rings, doorbell records and
+// UAR pages are plain memory, so these measure the CPU cost of building and
+// publishing work, not the HCA. Loops retire each WQE with sq_complete() as
+// soon as it is posted, standing in for the requester CQE.
+//
+//   rdma_objects_bench            run everything
+//   rdma_objects_bench <name>...  run the named benchmarks
+#include "rdma_objects.h"
+#include "auto_ref.h"
+#include "../common/mmio.h"
+#include <algorithm>
+#include <chrono>
+#include <sys/mman.h>
+
+using bench_clock = std::chrono::steady_clock;
+
+static double
+ns_per_op(bench_clock::time_point start, bench_clock::time_point end, uint64_t ops)
+{
+    return std::chrono::duration<double, std::nano>(end - start).count() / ops;
+}
+
+//==============================================================================
+// Host-memory stand-ins for the QP resources
+//==============================================================================
+
+struct host_qp_buffers {
+    qp_init_creation_params params = {};
+    char*     wq_buf   = nullptr;
+    uint32_t* dbrec    = nullptr;
+    char*     uar_page = nullptr;
+
+    host_qp_buffers(uint32_t sq_size, uint32_t rq_size) {
+        params.sq_size = sq_size;
+        params.rq_size = rq_size;
+        qp_umem_layout layout = calc_qp_umem_layout(rq_size, MLX5_RQ_STRIDE, sq_size, 1, 0);
+        wq_buf   = aligned_alloc<char>(layout.total_bytes);
+        dbrec    = aligned_alloc<uint32_t>(2);
+        uar_page = aligned_alloc<char>(2 * get_page_size());
+    }
+
+    ~host_qp_buffers() {
+        free(wq_buf);
+        free(dbrec);
+        free(uar_page);
+    }
+};
+
+//==============================================================================
+// Benchmarks
+//==============================================================================
+
+static void
+bench_post_wqe()
+{
+    const uint64_t iters = 10000000;
+    host_qp_buffers bufs(256, 1);
+
+    auto_ref<queue_pair> qp;
+    if (FAILED(qp->attach_wq_buffers(bufs.wq_buf, bufs.dbrec, bufs.uar_page, bufs.params))) {
+        log_error("Failed to attach host WQ buffers");
+        return;
+    }
+
+    static char payload[64];
+    auto start = bench_clock::now();
+    for (uint64_t i = 0; i < iters; ++i) {
+        uint16_t idx = qp->get_sq_pi();
+        qp->post_rdma_write(payload, 0x1000, (void*)0x10000, 0x2000, sizeof(payload));
+        qp->sq_complete(idx);
+    }
+    auto end = bench_clock::now();
+
+    printf("post_wqe      : %8.2f ns/post (RDMA write, doorbell per post, %lu posts)\n",
+           ns_per_op(start, end, iters), (unsigned long)iters);
+}
+
+static void
+bench_post_wqe_batched()
+{
+    const uint64_t iters = 10000000;
+    const uint32_t batch = 16;
+    host_qp_buffers bufs(256, 1);
+
+    auto_ref<queue_pair> qp;
+    if (FAILED(qp->attach_wq_buffers(bufs.wq_buf, bufs.dbrec, bufs.uar_page, bufs.params))) {
+        log_error("Failed to attach host WQ buffers");
+        return;
+    }
+
+    static char payload[64];
+    auto start = bench_clock::now();
+    for (uint64_t i = 0; i < iters; ++i) {
+        uint16_t idx = qp->get_sq_pi();
+        qp->post_rdma_write(payload, 0x1000, (void*)0x10000, 0x2000, sizeof(payload),
+                            QP_POST_NO_DOORBELL);
+        if ((i % batch) == batch - 1) {
+            qp->ring_doorbell();
+            qp->sq_complete(idx);
+        }
+    }
+    qp->ring_doorbell();
+    auto end = bench_clock::now();
+
+    printf("post_batched  : %8.2f ns/post (RDMA write, doorbell per %u posts)\n",
+           ns_per_op(start, end, iters), batch);
+}
+
+// Offset of the doorbell/BlueFlame register within a UAR page
+static const size_t k_uar_reg_offset = 0x800;
+
+// Report which 8-byte words of the register window were stored to since it
+// was poisoned, then poison it again for the next post
+static void
+print_uar_stores(char* uar_reg, size_t window, uint32_t post)
+{
+    const uint64_t poison = ~0ULL;
+    uint64_t* words = (uint64_t*)uar_reg;
+    size_t first = window, last = 0;
+    for (size_t i = 0; i < window / sizeof(uint64_t); ++i) {
+        if (words[i] != poison) {
+            first = std::min(first, i * sizeof(uint64_t));
+            last = (i + 1) * sizeof(uint64_t);
+        }
+    }
+    if (first == window) {
+        printf("    post %u: no register store\n", post);
+    } else {
+        printf("    post %u: stores at reg+0x%03zx..0x%03zx (%zu bytes)\n",
+               post, first, last, last - first);
+    }
+    memset(uar_reg, 0xff, window);
+}
+
+static void
+bench_bf_mode(bool use_bf, const char* label)
+{
+    const uint64_t iters = 10000000;
+    const uint32_t bf_half = MLX5_DEFAULT_BF_BUF_SIZE;
+    host_qp_buffers bufs(256, 1);
+    bufs.params.use_bf = use_bf;
+    bufs.params.bf_buf_size = bf_half;
+    bufs.params.max_inline_data = 128;
+
+    // An anonymous page stands in for the UAR; its stores are cached, so this
+    // measures the store sequence and fences rather than PCIe write latency.
+    char* uar_page = (char*)mmap(nullptr, get_page_size(), PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (uar_page == MAP_FAILED) {
+        log_error("Failed to map UAR stand-in page");
+        return;
+    }
+    char* uar_reg = uar_page + k_uar_reg_offset;
+
+    auto_ref<queue_pair> qp;
+    if (FAILED(qp->attach_wq_buffers(bufs.wq_buf, bufs.dbrec, uar_reg, bufs.params))) {
+        log_error("Failed to attach host WQ buffers");
+        munmap(uar_page, get_page_size());
+        return;
+    }
+
+    static char payload[96];
+    const size_t window = 2 * bf_half;
+    printf("%s store sequence (inline send of %zu bytes, 2 WQEBBs):\n",
+           label, sizeof(payload));
+    memset(uar_reg, 0xff, window);
+    for (uint32_t i = 0; i < 3; ++i) {
+        uint16_t idx = qp->get_sq_pi();
+        qp->post_send_inline(payload, sizeof(payload));
+        qp->sq_complete(idx);
+        print_uar_stores(uar_reg, window, i);
+    }
+
+    auto start = bench_clock::now();
+    for (uint64_t i = 0; i < iters; ++i) {
+        uint16_t idx = qp->get_sq_pi();
+        qp->post_send_inline(payload, sizeof(payload));
+        qp->sq_complete(idx);
+    }
+    auto end = bench_clock::now();
+
+    printf("%-14s: %8.2f ns/post (%lu posts)\n", label,
+           ns_per_op(start, end, iters), (unsigned long)iters);
+    munmap(uar_page, get_page_size());
+}
+
+static void
+bench_bf_latency()
+{
+    bench_bf_mode(false, "doorbell_8b");
+    bench_bf_mode(true, "blueflame");
+}
+
+// Copy one 4-WQEBB WQE per iteration followed by the WC fence a BlueFlame
+// post issues. "hot" reuses the two halves of a BF-sized window, which stays
+// in L1 on a cacheable mapping. "cold" walks a buffer much larger than the
+// LLC, so every line is a miss as every UAR write is a device write; a real
+// WC mapping cannot be had without an HCA.
+typedef void (*x64_copy_fn)(void*, const void*, size_t);
+
+static void
+bench_x64_copy(const char* label, x64_copy_fn copy, char* dst, size_t dst_bytes,
+               const char* src)
+{
+    const size_t wqe_bytes = 4 * MLX5_SEND_WQE_BB;
+    const uint64_t iters = 20000000;
+    size_t off = 0;
+
+    auto start = bench_clock::now();
+    for (uint64_t i = 0; i < iters; ++i) {
+        copy(dst + off, src, wqe_bytes);
+        wc_store_fence();
+        off += wqe_bytes;
+        if (off == dst_bytes) {
+            off = 0;
+        }
+    }
+    auto end = bench_clock::now();
+
+    double ns = ns_per_op(start, end, iters);
+    printf("%-24s: %8.2f ns/WQE %8.2f GB/s\n", label, ns, wqe_bytes / ns);
+}
+
+static void
+bench_wc_copy()
+{
+    const size_t hot_bytes  = 2 * MLX5_DEFAULT_BF_BUF_SIZE;
+    const size_t cold_bytes = 256UL << 20;
+
+    char* src  = aligned_alloc<char>(4 * MLX5_SEND_WQE_BB);
+    char* hot  = aligned_alloc<char>(hot_bytes);
+    char* cold = (char*)mmap(nullptr, cold_bytes, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (!src || !hot || cold == MAP_FAILED) {
+        log_error("Failed to allocate copy buffers");
+        free(src);
+        free(hot);
+        return;
+    }
+
+    printf("mmio_memcpy_x64 variant: %s\n", MMIO_MEMCPY_X64_IMPL);
+    bench_x64_copy("wc_copy hot  scalar", mmio_memcpy_x64_scalar, hot, hot_bytes, src);
+    bench_x64_copy("wc_copy hot  " MMIO_MEMCPY_X64_IMPL, mmio_memcpy_x64, hot, hot_bytes, src);
+    bench_x64_copy("wc_copy cold scalar", mmio_memcpy_x64_scalar, cold, cold_bytes, src);
+    bench_x64_copy("wc_copy cold " MMIO_MEMCPY_X64_IMPL, mmio_memcpy_x64, cold, cold_bytes, src);
+
+    munmap(cold, cold_bytes);
+    free(hot);
+    free(src);
+}
+
+// Build cost of a single-SGE RDMA write through the generic path and through
+// a pre-encoded template; doorbells are batched so the build dominates.
+static void
+bench_wqe_build()
+{
+    const uint64_t iters = 20000000;
+    const uint32_t batch = 32;
+    host_qp_buffers ref_bufs(256, 1), tmpl_bufs(256, 1);
+
+    auto_ref<queue_pair> ref, qp;
+    if (FAILED(ref->attach_wq_buffers(ref_bufs.wq_buf, ref_bufs.dbrec, ref_bufs.uar_page, ref_bufs.params)) ||
+        FAILED(qp->attach_wq_buffers(tmpl_bufs.wq_buf, tmpl_bufs.dbrec, tmpl_bufs.uar_page, tmpl_bufs.params))) {
+        log_error("Failed to attach host WQ buffers");
+        return;
+    }
+
+    wqe_template tmpl;
+    qp->make_wqe_template(tmpl, MLX5_OPCODE_RDMA_WRITE, 0x2000, 0x1000, QP_POST_NO_DOORBELL);
+
+    static char payload[4096];
+    auto start = bench_clock::now();
+    for (uint64_t i = 0; i < iters; ++i) {
+        uint32_t off = (i * 64) & (sizeof(payload) - 1);
+        uint16_t idx = ref->get_sq_pi();
+        ref->post_rdma_write(payload + off, 0x1000, (void*)(uintptr_t)(0x10000 + off), 0x2000, 64,
+                             QP_POST_NO_DOORBELL);
+        if ((i % batch) == batch - 1) {
+            ref->ring_doorbell();
+            ref->sq_complete(idx);
+        }
+    }
+    auto end = bench_clock::now();
+    printf("wqe_build post_wqe : %8.2f ns/post\n", ns_per_op(start, end, iters));
+
+    start = bench_clock::now();
+    for (uint64_t i = 0; i < iters; ++i) {
+        uint32_t off = (i * 64) & (sizeof(payload) - 1);
+        uint16_t idx = qp->get_sq_pi();
+        qp->post_template(tmpl, payload + off, (void*)(uintptr_t)(0x10000 + off), 64);
+        if ((i % batch) == batch - 1) {
+            qp->ring_doorbell();
+            qp->sq_complete(idx);
+        }
+    }
+    end = bench_clock::now();
+    printf("wqe_build template : %8.2f ns/post\n", ns_per_op(start, end, iters));
+}
+
+// Hand a full lap of CQEs to SW, as the HCA would after cnt completions
+static void
+fill_cq_lap(char* cqe_buf, uint32_t cnt, uint32_t lap)
+{
+    for (uint32_t i = 0; i < cnt; ++i) {
+        mlx5_cqe64* cqe = (mlx5_cqe64*)(cqe_buf + i * 64);
+        cqe->sop_drop_qpn = htobe32(0x1234);
+        cqe->wqe_counter  = htobe16(lap * cnt + i);
+        cqe->byte_cnt     = htobe32(64);
+        cqe->op_own       = (MLX5_CQE_REQ << 4) | (lap & 1);
+    }
+}
+
+// Cost of polling an empty CQ (the idle spin) and of draining a full one
+// in batches; only the poll calls are timed, not the refills.
+static void
+bench_cq_poll()
+{
+    cq_hw_params params;
+    params.log_cq_size = 10;
+    const uint32_t cnt = 1U << params.log_cq_size;
+    char* cqe_buf = aligned_alloc<char>(cnt * 64);
+    uint32_t* dbrec = aligned_alloc<uint32_t>(2);
+    char* uar_page = aligned_alloc<char>(get_page_size());
+
+    auto_ref<completion_queue_devx> cq;
+    if (FAILED(cq->attach_cq_buffers(cqe_buf, dbrec, uar_page, params))) {
+        log_error("Failed to attach host CQ buffers");
+        return;
+    }
+
+    cqe_out out[64];
+    const uint64_t empty_iters = 50000000;
+    auto start = bench_clock::now();
+    for (uint64_t i = 0; i < empty_iters; ++i) {
+        if (cq->poll_cq(out, 16)) {
+            log_error("Empty CQ returned a completion");
+            break;
+        }
+    }
+    auto end = bench_clock::now();
+    printf("cq_poll empty      : %8.2f ns/poll\n", ns_per_op(start, end, empty_iters));
+
+    const int batches[] = { 1, 16, 64 };
+    uint32_t lap = 0;
+    for (int batch : batches) {
+        const uint32_t laps = 20000;
+        bench_clock::duration polled{};
+        for (uint32_t l = 0; l < laps; ++l, ++lap) {
+            fill_cq_lap(cqe_buf, cnt, lap);
+            auto t0 = bench_clock::now();
+            uint32_t got = 0;
+            while (got < cnt) {
+                got += cq->poll_cq(out, batch);
+            }
+            polled += bench_clock::now() - t0;
+        }
+        printf("cq_poll full b=%-3d : %8.2f ns/CQE\n", batch,
+               std::chrono::duration<double, std::nano>(polled).count() / ((uint64_t)laps * cnt));
+    }
+
+    free(cqe_buf);
+    free(dbrec);
+    free(uar_page);
+}
+
+// Registered-buffer allocation in bursts of alloc then free, as an RPC path
+// holding a window of messages would: malloc() per message against the
+// locked pool and its per-thread cache. A window within the cache stays
+// lock free; a larger one moves half a cache per pool trip. The arena is
+// host memory with fake keys, so registration is not part of the loop.
+static void
+bench_mr_pool()
+{
+    const size_t arena = 64UL << 20;
+    char* base = aligned_alloc<char>(arena);
+
+    auto_ref<mr_pool> pool;
+    if (FAILED(pool->attach(base, arena, 0x1234, 0x1234))) {
+        log_error("Failed to attach pool arena");
+        free(base);
+        return;
+    }
+    mr_pool_cache cache(pool.get());
+
+    const uint32_t max_burst = 256;
+    const uint64_t blocks = 5000000;
+    void* ptrs[max_burst];
+    const uint32_t bursts[] = { 32, max_burst };
+    const size_t sizes[] = { 64, 4096, 65536 };
+
+    for (uint32_t burst : bursts) {
+        for (size_t size : sizes) {
+            const uint64_t rounds = blocks / burst;
+            double ns[3];
+            for (int mode = 0; mode < 3; ++mode) {
+                auto start = bench_clock::now();
+                for (uint64_t r = 0; r < rounds; ++r) {
+                    for (uint32_t i = 0; i < burst; ++i) {
+                        mr_pool_buf buf;
+                        if (mode == 0) {
+                            buf.addr = malloc(size);
+                        } else if (mode == 1) {
+                            pool->alloc(size, &buf);
+                        } else {
+                            cache.alloc(size, &buf);
+                        }
+                        ptrs[i] = buf.addr;
+                        *(volatile char*)ptrs[i] = 0;
+                    }
+                    for (uint32_t i = 0; i < burst; ++i) {
+                        if (mode == 0) {
+                            free(ptrs[i]);
+                        } else if (mode == 1) {
+                            pool->free(ptrs[i]);
+                        } else {
+                            cache.free(ptrs[i]);
+                        }
+                    }
+                }
+                ns[mode] = ns_per_op(start, bench_clock::now(), rounds * burst);
+            }
+            printf("mr_pool %6zuB x%-3u : malloc %8.2f  pool %8.2f  cache %8.2f ns/alloc+free\n",
+                   size, burst, ns[0], ns[1], ns[2]);
+        }
+    }
+
+    cache.flush();
+    pool->destroy();
+    free(base);
+}
+
+//==============================================================================
+// Registration startup: getting a large buffer zeroed, faulted in and pinned
+//==============================================================================
+
+static double
+ms_per_gb(bench_clock::time_point start, bench_clock::time_point end, size_t bytes)
+{
+    return std::chrono::duration<double, std::milli>(end - start).count() *
+           (double)(1UL << 30) / bytes;
+}
+
+static void
+bench_reg_startup()
+{
+    const size_t bytes = 1UL << 30;
+    struct {
+        const char*     name;
+        mem_page_policy policy;
+        uint32_t        flags;
+        unsigned        prefault_threads;   // 0: all allowed CPUs
+    } modes[] = {
+        { "memset",           MEM_PAGE_DEFAULT, 0,                   0 },
+        { "lazy+prefault x1", MEM_PAGE_DEFAULT, MEM_ALLOC_LAZY_ZERO, 1 },
+        { "lazy+prefault",    MEM_PAGE_DEFAULT, MEM_ALLOC_LAZY_ZERO, 0 },
+        { "hugetlb 2M",       MEM_PAGE_HUGE_2M, MEM_ALLOC_LAZY_ZERO, 0 },
+    };
+
+    // Host side: allocation plus first touch of every page, which is what the
+    // pinning in umem registration would otherwise pay for
+    for (const auto& m : modes) {
+        page_buffer buf;
+        auto start = bench_clock::now();
+        if (!page_buffer_alloc(bytes, m.policy, &buf, m.flags)) {
+            printf("reg_startup %-18s : allocation failed\n", m.name);
+            continue;
+        }
+        auto allocated = bench_clock::now();
+        if (m.flags & MEM_ALLOC_LAZY_ZERO) {
+            page_buffer_prefault(buf.addr, buf.size, buf.page_log, m.prefault_threads);
+        }
+        auto end = bench_clock::now();
+        printf("reg_startup %-18s : alloc %8.2f  total %8.2f ms/GB (page 2^%u)\n",
+               m.name, ms_per_gb(start, allocated, bytes), ms_per_gb(start, end, bytes),
+               buf.page_log);
+        page_buffer_free(&buf);
+    }
+
+    // With an HCA: the whole user_memory::initialize(), pinning included
+    int num_devices = 0;
+    ibv_device** devices = ibv_get_device_list(&num_devices);
+    if (!devices || num_devices == 0) {
+        printf("reg_startup : no RDMA device, skipping registration timing\n");
+        if (devices) {
+            ibv_free_device_list(devices);
+        }
+        return;
+    }
+    std::string dev_name = ibv_get_device_name(devices[0]);
+    ibv_free_device_list(devices);
+
+    auto_ref<rdma_device> rdevice;
+    if (FAILED(rdevice->initialize(dev_name))) {
+        log_error("Failed to open %s", dev_name.c_str());
+        return;
+    }
+
+    const uint32_t reg_flags[] = { 0, MEM_ALLOC_LAZY_ZERO,
+                                   MEM_ALLOC_LAZY_ZERO | MEM_ALLOC_PREFAULT };
+    const char* reg_names[] = { "memset", "lazy", "lazy+prefault" };
+    for (int i = 0; i < 3; ++i) {
+        auto_ref<user_memory> umem;
+        auto start = bench_clock::now();
+        STATUS res = umem->initialize(rdevice->get_context(), bytes, MEM_PAGE_DEFAULT,
+                                      reg_flags[i]);
+        auto end = bench_clock::now();
+        if (FAILED(res)) {
+            printf("reg_startup umem %-13s : registration failed\n", reg_names[i]);
+            continue;
+        }
+        printf("reg_startup umem %-13s : %8.2f ms/GB on %s\n",
+               reg_names[i], ms_per_gb(start, end, bytes), dev_name.c_str());
+    }
+}
+
+struct bench_entry {
+    const char* name;
+    void (*fn)();
+};
+
+static const bench_entry g_benches[] = {
+    { "post_wqe", bench_post_wqe },
+    { "post_batched", bench_post_wqe_batched },
+    { "bf_latency", bench_bf_latency },
+    { "wc_copy", bench_wc_copy },
+    { "wqe_build", bench_wqe_build },
+    { "cq_poll", bench_cq_poll },
+    { "mr_pool", bench_mr_pool },
+    { "reg_startup", bench_reg_startup },
+};
+
+int main(int argc, char** argv)
+{
+    for (const bench_entry& b : g_benches) {
+        bool selected = (argc < 2);
+        for (int i = 1; i < argc; ++i) {
+            selected |= (strcmp(argv[i], b.name) == 0);
+        }
+        if (selected) {
+            b.fn();
+        }
+    }
+
+    return STATUS_OK;
+}
@@ -0,0 +1,1831 @@
+// Host-only tests: exercise the data-path logic against rings built in plain
+// memory, no HCA required.
+#include "rdma_objects.h"
+#include "auto_ref.h"
+#include <arpa/inet.h>
+#include <linux/netlink.h>
+#include <rdma/rdma_netlink.h>
+#include <sys/eventfd.h>
+#include <thread>
+
+static int g_failures = 0;
+
+#define CHECK(expr) \
+    do { \
+        if (!(expr)) { \
+            log_error("CHECK failed: %s at %s:%d", #expr, __FILE__, __LINE__); \
+            g_failures++; \
+        } \
+    } while (0)
+
+//==============================================================================
+// Helpers emulating the HCA side
+//==============================================================================
+
+// Write a CQE the way the device does: body first, op_own (with the owner
+// bit of the producer's wrap parity) last.
+static void
+hw_write_cqe(void* cqe_buf, uint32_t log_cq_size, uint32_t pi,
+             uint8_t opcode, uint32_t qpn, uint16_t wqe_counter,
+             uint32_t byte_cnt, uint32_t imm = 0, uint64_t timestamp = 0)
+{
+    const uint32_t cqe_cnt = 1U << log_cq_size;
+    mlx5_cqe64* cqe = (mlx5_cqe64*)((char*)cqe_buf + (pi & (cqe_cnt - 1)) * 64);
+
+    memset(cqe, 0, sizeof(*cqe));
+    cqe->sop_drop_qpn   = htobe32(qpn & 0xffffff);
+    cqe->wqe_counter    = htobe16(wqe_counter);
+    cqe->byte_cnt       = htobe32(byte_cnt);
+    cqe->imm_inval_pkey = htobe32(imm);
+    cqe->timestamp      = htobe64(timestamp);
+    if (opcode == MLX5_CQE_REQ_ERR || opcode == MLX5_CQE_RESP_ERR) {
+        mlx5_err_cqe* err = (mlx5_err_cqe*)cqe;
+        err->syndrome        = 0x5;
+        err->vendor_err_synd = 0x42;
+    }
+    __sync_synchronize();
+    cqe->op_own = (opcode << 4) | (!!(pi & cqe_cnt));
+}
+
+// Host-memory stand-ins for the QP resources
+struct host_qp_buffers {
+    qp_init_creation_params params = {};
+    char*     wq_buf   = nullptr;
+    uint32_t* dbrec    = nullptr;
+    char*     uar_page = nullptr;
+
+    host_qp_buffers(uint32_t sq_size, uint32_t rq_size) {
+        params.sq_size = sq_size;
+        params.rq_size = rq_size;
+        qp_umem_layout layout = calc_qp_umem_layout(rq_size, MLX5_RQ_STRIDE, sq_size, 1, 0);
+        wq_buf   = aligned_alloc<char>(layout.total_bytes);
+        dbrec    = aligned_alloc<uint32_t>(2);
+        uar_page = aligned_alloc<char>(2 * get_page_size());
+    }
+
+    ~host_qp_buffers() {
+        free(wq_buf);
+        free(dbrec);
+        free(uar_page);
+    }
+
+    char* sq_slot(uint32_t idx) const {
+        size_t sq_off = calc_qp_umem_layout(params.rq_size, MLX5_RQ_STRIDE, 0, 1, 0).sq_offset_bytes;
+        return wq_buf + sq_off + (idx & (params.sq_size - 1)) * MLX5_SEND_WQE_BB;
+    }
+
+    mlx5_wqe_ctrl_seg* sq_wqe(uint32_t idx) const {
+        return (mlx5_wqe_ctrl_seg*)sq_slot(idx);
+    }
+};
+
+static uint8_t wqe_opcode(const mlx5_wqe_ctrl_seg* ctrl) {
+    return be32toh(ctrl->opmod_idx_opcode) & 0xff;
+}
+
+static uint16_t wqe_index(const mlx5_wqe_ctrl_seg* ctrl) {
+    return (be32toh(ctrl->opmod_idx_opcode) >> 8) & 0xffff;
+}
+
+static uint8_t wqe_ds(const mlx5_wqe_ctrl_seg* ctrl) {
+    return be32toh(ctrl->qpn_ds) & 0x3f;
+}
+
+//==============================================================================
+// Completion queue
+//==============================================================================
+
+static void
+test_cq_batch_poll()
+{
+    cq_hw_params params;
+    params.log_cq_size = 4;
+    const uint32_t cqe_cnt = 1U << params.log_cq_size;
+
+    void* cqe_buf = aligned_alloc<char>(cqe_cnt * 64);
+    uint32_t* dbrec = aligned_alloc<uint32_t>(2);
+    uint64_t* uar_page = aligned_alloc<uint64_t>(get_page_size() / sizeof(uint64_t));
+
+    auto_ref<completion_queue_devx> cq;
+    CHECK(cq->attach_cq_buffers(cqe_buf, dbrec, uar_page, params) == STATUS_OK);
+
+    // Fresh ring: every entry is invalid and SW-owned parity 0
+    for (uint32_t i = 0; i < cqe_cnt; ++i) {
+        mlx5_cqe64* cqe = (mlx5_cqe64*)((char*)cqe_buf + i * 64);
+        CHECK(cqe->op_own == (MLX5_CQE_INVALID << 4));
+    }
+
+    cqe_out out[32];
+    CHECK(cq->poll_cq(out, 32) == 0);
+    CHECK(*dbrec == 0);
+    CHECK(cq->poll_cq() == STATUS_NO_DATA);
+
+    // Five completions, drained in a batch of three then two
+    for (uint32_t i = 0; i < 5; ++i) {
+        hw_write_cqe(cqe_buf, params.log_cq_size, i, MLX5_CQE_REQ, 0x1234, i, 100 + i, 0, 1000 + i);
+    }
+
+    CHECK(cq->poll_cq(out, 3) == 3);
+    CHECK(be32toh(*dbrec) == 3);
+    for (int i = 0; i < 3; ++i) {
+        CHECK(out[i].opcode == MLX5_CQE_REQ);
+        CHECK(out[i].qpn == 0x1234);
+        CHECK(out[i].wqe_counter == i);
+        CHECK(out[i].byte_cnt == 100u + i);
+        CHECK(out[i].timestamp == 1000u + i);
+        CHECK(!cqe_is_error(out[i]));
+    }
+
+    CHECK(cq->poll_cq(out, 32) == 2);
+    CHECK(be32toh(*dbrec) == 5);
+    CHECK(out[1].wqe_counter == 4);
+    CHECK(cq->poll_cq(out, 32) == 0);
+
+    // Responder completion with immediate data and an error CQE
+    hw_write_cqe(cqe_buf, params.log_cq_size, 5, MLX5_CQE_RESP_SEND_IMM, 0x1234, 7, 64, 0xdeadbeef);
+    hw_write_cqe(cqe_buf, params.log_cq_size, 6, MLX5_CQE_REQ_ERR, 0x1234, 8, 0);
+    CHECK(cq->poll_cq(out, 32) == 2);
+    CHECK(out[0].opcode == MLX5_CQE_RESP_SEND_IMM);
+    CHECK(out[0].imm == 0xdeadbeef);
+    CHECK(out[1].opcode == MLX5_CQE_REQ_ERR);
+    CHECK(cqe_is_error(out[1]));
+    CHECK(out[1].syndrome == 0x5);
+    CHECK(out[1].vendor_err_synd == 0x42);
+
+    // Wrap the ring: stale entries from the previous pass must not be reaped
+    uint32_t pi = 7;
+    for (; pi < cqe_cnt + 3; ++pi) {
+        hw_write_cqe(cqe_buf, params.log_cq_size, pi, MLX5_CQE_REQ, 0x1234, pi, 1);
+    }
+    CHECK(cq->poll_cq(out, 32) == (int)(cqe_cnt + 3 - 7));
+    CHECK(cq->get_consumer_index() == cqe_cnt + 3);
+    CHECK(be32toh(*dbrec) == cqe_cnt + 3);
+    CHECK(out[cqe_cnt + 3 - 7 - 1].wqe_counter == cqe_cnt + 2);
+    CHECK(cq->poll_cq(out, 32) == 0);
+
+    // Single-shot legacy poll still reports a good completion
+    hw_write_cqe(cqe_buf, params.log_cq_size, pi, MLX5_CQE_REQ, 0x1234, pi, 1);
+    CHECK(cq->poll_cq() == STATUS_OK);
+
+    free(cqe_buf);
+    free(dbrec);
+    free(uar_page);
+}
+
+// Hand-built compressed session: title at @pi, @count mini CQEs after it
+static void
+hw_write_cqe_session(void* cqe_buf, uint32_t log_cq_size, uint32_t pi, uint8_t opcode,
+                     uint32_t qpn, uint16_t wqe_counter, uint32_t count,
+                     const uint16_t* mini_idx, const uint32_t* mini_len)
+{
+    const uint32_t cqe_cnt = 1U << log_cq_size;
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t slot = pi + (i < MLX5_MINI_CQE_ARRAY_SIZE ? 1 : i & ~(MLX5_MINI_CQE_ARRAY_SIZE - 1));
+        mlx5_mini_cqe8* mini = (mlx5_mini_cqe8*)((char*)cqe_buf + (slot & (cqe_cnt - 1)) * 64) +
+                               (i & (MLX5_MINI_CQE_ARRAY_SIZE - 1));
+        memset(mini, 0, sizeof(*mini));
+        if (opcode == MLX5_CQE_REQ) {
+            mini->s_wqe_info.wqe_counter = htobe16(mini_idx[i]);
+        } else {
+            mini->stride_idx = htobe16(mini_idx[i]);
+        }
+        mini->byte_cnt = htobe32(mini_len[i]);
+    }
+
+    // The title goes last: its op_own hands the whole session over
+    hw_write_cqe(cqe_buf, log_cq_size, pi, opcode, qpn, wqe_counter, count, 0, 777);
+    mlx5_cqe64* title = (mlx5_cqe64*)((char*)cqe_buf + (pi & (cqe_cnt - 1)) * 64);
+    title->op_own |= MLX5_CQE_FORMAT_COMPRESSED << 2;
+}
+
+void
+test_cq_compressed()
+{
+    cq_hw_params params;
+    params.log_cq_size = 5;
+    params.cqe_comp_en = true;
+    params.mini_cqe_res_format = MLX5_MINI_CQE_FORMAT_CSUM_STRIDX;
+    const uint32_t cqe_cnt = 1U << params.log_cq_size;
+    void* cqe_buf = aligned_alloc<char>(cqe_cnt * 64);
+    uint32_t* dbrec = aligned_alloc<uint32_t>(2);
+    uint64_t* uar_page = aligned_alloc<uint64_t>(get_page_size() / sizeof(uint64_t));
+
+    auto_ref<completion_queue_devx> cq;
+    CHECK(cq->attach_cq_buffers(cqe_buf, dbrec, uar_page, params) == STATUS_OK);
+
+    // Two full CQEs, then a ten-entry requester session spanning two mini arrays
+    hw_write_cqe(cqe_buf, params.log_cq_size, 0, MLX5_CQE_REQ, 0x1234, 0, 1);
+    hw_write_cqe(cqe_buf, params.log_cq_size, 1, MLX5_CQE_REQ, 0x1234, 1, 1);
+    uint16_t wqe_idx[10];
+    uint32_t len[10];
+    for (uint32_t i = 0; i < 10; ++i) {
+        wqe_idx[i] = 2 + i * 3;
+        len[i] = 100 + i;
+    }
+    hw_write_cqe_session(cqe_buf, params.log_cq_size, 2, MLX5_CQE_REQ, 0x1234, 0, 10, wqe_idx, len);
+    // The session takes ten slots from the title: the next CQE is in slot 12
+    hw_write_cqe(cqe_buf, params.log_cq_size, 2 + 10, MLX5_CQE_REQ, 0x1234, 40, 1);
+
+    // A batch that ends mid-session leaves the CI on the title
+    cqe_out out[32];
+    CHECK(cq->poll_cq(out, 6) == 6);
+    CHECK(be32toh(*dbrec) == 2);
+    CHECK(out[2].opcode == MLX5_CQE_REQ);
+    CHECK(out[2].qpn == 0x1234);
+    CHECK(out[2].timestamp == 777);
+    CHECK(out[2].wqe_counter == 2 && out[2].byte_cnt == 100);
+    CHECK(out[5].wqe_counter == 11 && out[5].byte_cnt == 103);
+
+    CHECK(cq->poll_cq(out, 32) == 7);
+    for (uint32_t i = 4; i < 10; ++i) {
+        CHECK(out[i - 4].wqe_counter == wqe_idx[i]);
+        CHECK(out[i - 4].byte_cnt == len[i]);
+    }
+    CHECK(out[6].wqe_counter == 40);
+    CHECK(cq->get_consumer_index() == 13);
+    CHECK(be32toh(*dbrec) == 13);
+
+    // Mini arrays were invalidated on the way out
+    CHECK(((mlx5_cqe64*)((char*)cqe_buf + 3 * 64))->op_own == (MLX5_CQE_INVALID << 4));
+    CHECK(((mlx5_cqe64*)((char*)cqe_buf + 10 * 64))->op_own == (MLX5_CQE_INVALID << 4));
+    CHECK(cq->poll_cq(out, 32) == 0);
+
+    // Responder session with stride indexes, wrapping the ring
+    uint32_t pi = 13;
+    for (; pi < cqe_cnt - 2; ++pi) {
+        hw_write_cqe(cqe_buf, params.log_cq_size, pi, MLX5_CQE_REQ, 0x1234, pi, 1);
+    }
+    CHECK(cq->poll_cq(out, 32) == (int)(cqe_cnt - 2 - 13));
+    uint16_t strides[3] = { 0, 4, 5 };
+    uint32_t rlen[3] = { 256, 64, 1000 };
+    hw_write_cqe_session(cqe_buf, params.log_cq_size, pi, MLX5_CQE_RESP_SEND, 0x99, 0, 3, strides, rlen);
+    CHECK(cq->poll_cq(out, 32) == 3);
+    CHECK(out[0].opcode == MLX5_CQE_RESP_SEND && out[0].qpn == 0x99);
+    CHECK(out[1].wqe_counter == 4 && out[1].byte_cnt == 64);
+    CHECK(out[2].wqe_counter == 5 && out[2].byte_cnt == 1000);
+    CHECK(cq->get_consumer_index() == pi + 3);
+
+    free(cqe_buf);
+    free(dbrec);
+    free(uar_page);
+}
+
+void
+test_cq_128b_scatter()
+{
+    cq_hw_params params;
+    params.log_cq_size = 3;
+    params.cqe_sz = 1;
+    const uint32_t cqe_cnt = 1U << params.log_cq_size;
+    char* cqe_buf = aligned_alloc<char>(cqe_cnt * 128);
+    uint32_t* dbrec = aligned_alloc<uint32_t>(2);
+    uint64_t* uar_page = aligned_alloc<uint64_t>(get_page_size() / sizeof(uint64_t));
+
+    auto_ref<completion_queue_devx> cq;
+    CHECK(cq->attach_cq_buffers(cqe_buf, dbrec, uar_page, params) == STATUS_OK);
+
+    // The owner byte lives in the second half of each 128-byte entry
+    for (uint32_t i = 0; i < cqe_cnt; ++i) {
+        CHECK(((mlx5_cqe64*)(cqe_buf + i * 128 + 64))->op_own == (MLX5_CQE_INVALID << 4));
+        CHECK(cqe_buf[i * 128 + 63] == 0);
+    }
+
+    // Receive with 48 bytes scattered into the first half, then a plain send completion
+    for (uint32_t pi = 0; pi < cqe_cnt + 2; pi += 2) {
+        char* entry = cqe_buf + (pi & (cqe_cnt - 1)) * 128;
+        memset(entry, 0xa0 + pi, 48);
+        mlx5_cqe64* cqe = (mlx5_cqe64*)(entry + 64);
+        memset(cqe, 0, sizeof(*cqe));
+        cqe->byte_cnt = htobe32(48);
+        cqe->wqe_counter = htobe16(pi);
+        __sync_synchronize();
+        cqe->op_own = (MLX5_CQE_RESP_SEND << 4) | MLX5_INLINE_SCATTER_64 | !!(pi & cqe_cnt);
+
+        entry = cqe_buf + ((pi + 1) & (cqe_cnt - 1)) * 128;
+        cqe = (mlx5_cqe64*)(entry + 64);
+        memset(cqe, 0, sizeof(*cqe));
+        cqe->wqe_counter = htobe16(pi + 1);
+        __sync_synchronize();
+        cqe->op_own = (MLX5_CQE_REQ << 4) | !!((pi + 1) & cqe_cnt);
+
+        cqe_out out[4];
+        CHECK(cq->poll_cq(out, 4) == 2);
+        CHECK(out[0].opcode == MLX5_CQE_RESP_SEND && out[0].wqe_counter == pi);
+        CHECK(out[0].inline_data == (const uint8_t*)cqe_buf + (pi & (cqe_cnt - 1)) * 128);
+        CHECK(out[0].byte_cnt == 48 && out[0].inline_data[47] == (uint8_t)(0xa0 + pi));
+        CHECK(out[1].opcode == MLX5_CQE_REQ && out[1].wqe_counter == pi + 1);
+        CHECK(out[1].inline_data == nullptr);
+    }
+    CHECK(cq->get_consumer_index() == cqe_cnt + 2);
+
+    free(cqe_buf);
+
+    // 64-byte CQEs carry up to 32 bytes at the head of the CQE
+    params.cqe_sz = 0;
+    cqe_buf = aligned_alloc<char>(cqe_cnt * 64);
+    CHECK(cq->attach_cq_buffers(cqe_buf, dbrec, uar_page, params) == STATUS_OK);
+    hw_write_cqe(cqe_buf, params.log_cq_size, 0, MLX5_CQE_RESP_SEND_IMM, 0x10, 0, 20, 0x1234);
+    memset(cqe_buf, 0x5a, 20);
+    ((mlx5_cqe64*)cqe_buf)->op_own |= MLX5_INLINE_SCATTER_32;
+    hw_write_cqe(cqe_buf, params.log_cq_size, 1, MLX5_CQE_RESP_SEND, 0x10, 1, 4096);
+
+    cqe_out out[4];
+    CHECK(cq->poll_cq(out, 4) == 2);
+    CHECK(out[0].inline_data == (const uint8_t*)cqe_buf);
+    CHECK(out[0].inline_data[19] == 0x5a && out[0].imm == 0x1234);
+    CHECK(out[1].inline_data == nullptr && out[1].byte_cnt == 4096);
+
+    free(cqe_buf);
+    free(dbrec);
+    free(uar_page);
+}
+
+void
+test_cq_waiter()
+{
+    cq_hw_params params;
+    params.log_cq_size = 3;
+    void* cqe_buf = aligned_alloc<char>((1U << params.log_cq_size) * 64);
+    uint32_t* dbrec = aligned_alloc<uint32_t>(2);
+    uint64_t* uar_page = aligned_alloc<uint64_t>(get_page_size() / sizeof(uint64_t));
+    auto_ref<completion_queue_devx> cq;
+    CHECK(cq->attach_cq_buffers(cqe_buf, dbrec, uar_page, params) == STATUS_OK);
+
+    // An eventfd stands in for the DEVX event channel
+    int efd = eventfd(0, EFD_NONBLOCK);
+    CHECK(efd >= 0);
+    auto_ref<completion_channel> channel;
+    CHECK(channel->attach_fd(-1) == STATUS_INVALID_HANDLE);
+    CHECK(channel->attach_fd(efd) == STATUS_OK);
+    CHECK(channel->subscribe(cq) == STATUS_OK);
+    CHECK(channel->subscribe(cq) == STATUS_INVALID_OPERATION);
+    CHECK(channel->get_fd() == efd);
+
+    completion_queue_devx* source = nullptr;
+    CHECK(channel->get_event(&source, 0) == STATUS_NO_DATA);
+
+    cq_wait_params wp;
+    wp.spin_ns = 40000;
+    wp.min_spin_ns = 1000;
+    wp.max_spin_ns = 160000;
+    wp.timeout_ms = 5;
+    cq_waiter waiter(cq, channel, wp);
+
+    // A ready CQE is reaped while spinning
+    cqe_out out[4];
+    hw_write_cqe(cqe_buf, params.log_cq_size, 0, MLX5_CQE_REQ, 0x1, 0, 1);
+    CHECK(waiter.wait(out, 4) == 1);
+    CHECK(waiter.get_spin_hits() == 1 && waiter.get_sleeps() == 0);
+
+    // Idle: spin, arm with the current CI, sleep until the timeout
+    CHECK(waiter.wait(out, 4) == 0);
+    CHECK(waiter.get_sleeps() == 1);
+    CHECK((be32toh(dbrec[1]) & 0xffffff) == 1);
+    CHECK((be64toh(uar_page[MLX5_CQ_DOORBELL / 8]) & 0xffffffff) == cq->get_cqn());
+
+    // An event that arrives long after the spin budget shrinks it
+    std::thread hca([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        hw_write_cqe(cqe_buf, params.log_cq_size, 1, MLX5_CQE_REQ, 0x1, 1, 1);
+        uint64_t one = 1;
+        CHECK(write(efd, &one, sizeof(one)) == sizeof(one));
+    });
+    wp.timeout_ms = -1;
+    cq_waiter sleeper(cq, channel, wp);
+    CHECK(sleeper.wait(out, 4) == 1);
+    hca.join();
+    CHECK(out[0].wqe_counter == 1);
+    CHECK(sleeper.get_sleeps() == 1);
+    CHECK(sleeper.get_spin_ns() == 20000);
+
+    // An event that is already pending grows it again
+    uint64_t one = 1;
+    CHECK(write(efd, &one, sizeof(one)) == sizeof(one));
+    CHECK(sleeper.wait(out, 4) == 0);
+    CHECK(sleeper.get_spin_ns() == 40000);
+    CHECK(channel->get_event(&source, 0) == STATUS_NO_DATA);
+
+    close(efd);
+    free(cqe_buf);
+    free(dbrec);
+    free(uar_page);
+}
+
+//==============================================================================
+// Queue pair send path
+//==============================================================================
+
+static void
+test_qp_doorbell_batching()
+{
+    host_qp_buffers bufs(16, 1);
+    auto_ref<queue_pair> qp;
+    CHECK(qp->attach_wq_buffers(bufs.wq_buf, bufs.dbrec, bufs.uar_page, bufs.params) == STATUS_OK);
+
+    static char payload[8][64];
+    for (int i = 0; i < 8; ++i) {
+        CHECK(qp->post_rdma_write(payload[i], 0x1000, (void*)(uintptr_t)(0x10000 + i * 64), 0x2000,
+                                  sizeof(payload[i]), QP_POST_NO_DOORBELL) == STATUS_OK);
+    }
+
+    // Nothing published yet
+    CHECK(qp->get_pending_wqes() == 8);
+    CHECK(bufs.dbrec[MLX5_SND_DBR] == 0);
+    CHECK(*(uint64_t*)bufs.uar_page == 0);
+
+    for (uint32_t i = 0; i < 8; ++i) {
+        mlx5_wqe_ctrl_seg* ctrl = bufs.sq_wqe(i);
+        CHECK(wqe_opcode(ctrl) == MLX5_OPCODE_RDMA_WRITE);
+        CHECK(wqe_index(ctrl) == i);
+        CHECK(wqe_ds(ctrl) == 3);
+        mlx5_wqe_raddr_seg* raddr = (mlx5_wqe_raddr_seg*)(ctrl + 1);
+        CHECK(be64toh(raddr->raddr) == 0x10000 + i * 64);
+        CHECK(be32toh(raddr->rkey) == 0x2000);
+        mlx5_wqe_data_seg* dseg = (mlx5_wqe_data_seg*)(raddr + 1);
+        CHECK(be64toh(dseg->addr) == (uintptr_t)payload[i]);
+        CHECK(be32toh(dseg->lkey) == 0x1000);
+        CHECK(be32toh(dseg->byte_count) == 64);
+    }
+
+    // One doorbell publishes the chain with the last WQE's control segment
+    CHECK(qp->ring_doorbell() == STATUS_OK);
+    CHECK(qp->get_pending_wqes() == 0);
+    CHECK(be32toh(bufs.dbrec[MLX5_SND_DBR]) == 8);
+    CHECK(memcmp(bufs.uar_page, bufs.sq_wqe(7), sizeof(uint64_t)) == 0);
+
+    // Ringing with nothing pending leaves the doorbell record untouched
+    CHECK(qp->ring_doorbell() == STATUS_OK);
+    CHECK(be32toh(bufs.dbrec[MLX5_SND_DBR]) == 8);
+
+    // Immediate posts still ring on their own
+    CHECK(qp->post_send_msg(payload[0], 0x1000, 16) == STATUS_OK);
+    CHECK(qp->get_pending_wqes() == 0);
+    CHECK(be32toh(bufs.dbrec[MLX5_SND_DBR]) == 9);
+    CHECK(wqe_opcode(bufs.sq_wqe(8)) == MLX5_OPCODE_SEND);
+    CHECK(wqe_ds(bufs.sq_wqe(8)) == 2);
+}
+
+static void
+test_qp_sgl_wraparound()
+{
+    host_qp_buffers bufs(8, 1);
+    bufs.params.max_send_sge = 8;
+    auto_ref<queue_pair> qp;
+    CHECK(qp->attach_wq_buffers(bufs.wq_buf, bufs.dbrec, bufs.uar_page, bufs.params) == STATUS_OK);
+
+    static char payload[64];
+    for (int i = 0; i < 7; ++i) {
+        CHECK(qp->post_rdma_write(payload, 0x1000, (void*)0x10000, 0x2000, sizeof(payload)) == STATUS_OK);
+    }
+
+    // The HCA has finished the first WQE, freeing room for a 2-WQEBB one
+    qp->sq_complete(0);
+
+    // ctrl + raddr + 5 data segments = 112 bytes: the last WQEBB of the SQ
+    // plus the first one after wrapping
+    ibv_sge sgl[5];
+    for (uint32_t i = 0; i < 5; ++i) {
+        sgl[i].addr   = 0x100000 + i * 0x1000;
+        sgl[i].length = 16 + i;
+        sgl[i].lkey   = 0x3000 + i;
+    }
+    CHECK(qp->post_rdma_write_sgl(sgl, 5, (void*)0x20000, 0x2000) == STATUS_OK);
+    CHECK(qp->get_sq_pi() == 9);
+    CHECK(be32toh(bufs.dbrec[MLX5_SND_DBR]) == 9);
+
+    mlx5_wqe_ctrl_seg* ctrl = bufs.sq_wqe(7);
+    CHECK(wqe_opcode(ctrl) == MLX5_OPCODE_RDMA_WRITE);
+    CHECK(wqe_index(ctrl) == 7);
+    CHECK(wqe_ds(ctrl) == 7);
+
+    mlx5_wqe_data_seg* dseg[5] = {
+        (mlx5_wqe_data_seg*)(bufs.sq_slot(7) + 32),
+        (mlx5_wqe_data_seg*)(bufs.sq_slot(7) + 48),
+        (mlx5_wqe_data_seg*)(bufs.sq_slot(0)),
+        (mlx5_wqe_data_seg*)(bufs.sq_slot(0) + 16),
+        (mlx5_wqe_data_seg*)(bufs.sq_slot(0) + 32),
+    };
+    for (uint32_t i = 0; i < 5; ++i) {
+        CHECK(be64toh(dseg[i]->addr) == sgl[i].addr);
+        CHECK(be32toh(dseg[i]->byte_count) == sgl[i].length);
+        CHECK(be32toh(dseg[i]->lkey) == sgl[i].lkey);
+    }
+
+    // Send gathers without a remote address segment
+    CHECK(qp->post_send_sgl(sgl, 2) == STATUS_WOULD_BLOCK);
+    qp->sq_complete(6);
+    CHECK(qp->post_send_sgl(sgl, 2) == STATUS_OK);
+    CHECK(wqe_opcode(bufs.sq_wqe(9)) == MLX5_OPCODE_SEND);
+    CHECK(wqe_ds(bufs.sq_wqe(9)) == 3);
+    CHECK(be64toh(((mlx5_wqe_data_seg*)(bufs.sq_slot(9) + 16))->addr) == sgl[0].addr);
+
+    // SGE count is bounded by max_send_sge
+    ibv_sge big[9] = {};
+    CHECK(qp->post_rdma_read_sgl(big, 9, (void*)0x20000, 0x2000) == STATUS_INVALID_PARAM);
+    CHECK(qp->get_sq_pi() == 10);
+}
+
+static void
+test_qp_inline()
+{
+    host_qp_buffers bufs(8, 1);
+    bufs.params.max_inline_data = 128;
+    auto_ref<queue_pair> qp;
+    CHECK(qp->attach_wq_buffers(bufs.wq_buf, bufs.dbrec, bufs.uar_page, bufs.params) == STATUS_OK);
+    CHECK(qp->get_max_inline() == 128);
+
+    char msg[100];
+    for (size_t i = 0; i < sizeof(msg); ++i) {
+        msg[i] = (char)i;
+    }
+
+    // Small send: ctrl + 4B header + 12B payload in two DS
+    CHECK(qp->post_send_inline(msg, 12) == STATUS_OK);
+    CHECK(wqe_opcode(bufs.sq_wqe(0)) == MLX5_OPCODE_SEND);
+    CHECK(wqe_ds(bufs.sq_wqe(0)) == 2);
+    mlx5_wqe_inline_seg* inl = (mlx5_wqe_inline_seg*)(bufs.sq_slot(0) + 16);
+    CHECK(be32toh(inl->byte_count) == (12 | MLX5_INLINE_SEG));
+    CHECK(memcmp(bufs.sq_slot(0) + 20, msg, 12) == 0);
+    CHECK(qp->get_sq_pi() == 1);
+
+    for (int i = 1; i < 7; ++i) {
+        CHECK(qp->post_send_inline(msg, 8) == STATUS_OK);
+    }
+
+    qp->sq_complete(3);
+
+    // 100B write from the last WQEBB: 28B fit before the end of the SQ,
+    // the remaining 72B continue at its start
+    CHECK(qp->post_rdma_write_inline(msg, 100, (void*)0x20000, 0x2000) == STATUS_OK);
+    CHECK(wqe_opcode(bufs.sq_wqe(7)) == MLX5_OPCODE_RDMA_WRITE);
+    CHECK(wqe_ds(bufs.sq_wqe(7)) == 2 + (4 + 100 + 15) / 16);
+    CHECK(qp->get_sq_pi() == 10);
+    inl = (mlx5_wqe_inline_seg*)(bufs.sq_slot(7) + 32);
+    CHECK(be32toh(inl->byte_count) == (100 | MLX5_INLINE_SEG));
+    CHECK(memcmp(bufs.sq_slot(7) + 36, msg, 28) == 0);
+    CHECK(memcmp(bufs.sq_slot(0), msg + 28, 72) == 0);
+
+    // Above max inline: the explicit variant refuses, the flag falls back
+    char big[256] = {};
+    CHECK(qp->post_send_inline(big, sizeof(big)) == STATUS_INVALID_LENGTH);
+    CHECK(qp->post_send_msg(big, 0x1000, sizeof(big), IBV_SEND_INLINE) == STATUS_OK);
+    mlx5_wqe_data_seg* dseg = (mlx5_wqe_data_seg*)(bufs.sq_slot(10) + 16);
+    CHECK(be32toh(dseg->lkey) == 0x1000);
+    CHECK(be32toh(dseg->byte_count) == sizeof(big));
+
+    // ...and honours IBV_SEND_INLINE when the payload fits
+    CHECK(qp->post_rdma_write(msg, 0x1000, (void*)0x20000, 0x2000, 16, IBV_SEND_INLINE) == STATUS_OK);
+    inl = (mlx5_wqe_inline_seg*)(bufs.sq_slot(11) + 32);
+    CHECK(be32toh(inl->byte_count) == (16 | MLX5_INLINE_SEG));
+}
+
+static void
+test_qp_umr()
+{
+    host_qp_buffers bufs(8, 1);
+    auto_ref<queue_pair> qp;
+    CHECK(qp->attach_wq_buffers(bufs.wq_buf, bufs.dbrec, bufs.uar_page, bufs.params) == STATUS_OK);
+
+    const size_t page = get_page_size();
+    char* pool = aligned_alloc<char>(4 * page);
+    memory_region mr;
+    CHECK(mr.attach_mkey(pool, 4 * page, 0x300ef, 0x300ef) == STATUS_OK);
+
+    mkey_segment segs[5];
+    for (int i = 0; i < 5; ++i) {
+        segs[i] = { &mr, (size_t)i * 700, 100 + (size_t)i };
+    }
+    mkey_layout layout;
+    CHECK(indirect_mkey::build_layout(segs, 5, 8, &layout) == STATUS_OK);
+
+    // Start two WQEBBs before the end so the four-WQEBB UMR wraps
+    for (int i = 0; i < 6; ++i) {
+        CHECK(qp->post_send_msg(pool, 0x300ef, 8) == STATUS_OK);
+    }
+    qp->sq_complete(5);
+
+    CHECK(qp->post_umr(0x1234ef, layout, IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ) == STATUS_OK);
+    CHECK(qp->get_sq_pi() == 10);
+
+    mlx5_wqe_ctrl_seg* ctrl = bufs.sq_wqe(6);
+    CHECK(wqe_opcode(ctrl) == MLX5_OPCODE_UMR);
+    CHECK(wqe_ds(ctrl) == 16);
+    CHECK(be32toh(ctrl->imm) == 0x1234ef);
+    CHECK(ctrl->fm_ce_se & MLX5_WQE_CTRL_INITIATOR_SMALL_FENCE);
+
+    mlx5_wqe_umr_ctrl_seg* umr = (mlx5_wqe_umr_ctrl_seg*)(ctrl + 1);
+    CHECK(umr->flags == MLX5_WQE_UMR_CTRL_FLAG_INLINE);
+    CHECK(be16toh(umr->klm_octowords) == 8);
+    CHECK(be64toh(umr->mkey_mask) & MLX5_WQE_UMR_CTRL_MKEY_MASK_LEN);
+    CHECK(be64toh(umr->mkey_mask) & MLX5_WQE_UMR_CTRL_MKEY_MASK_FREE);
+
+    mlx5_wqe_mkey_context_seg* mk = (mlx5_wqe_mkey_context_seg*)bufs.sq_slot(7);
+    CHECK(mk->free == 0);
+    CHECK(mk->access_flags == (MLX5_WQE_MKEY_CONTEXT_ACCESS_FLAGS_LOCAL_READ |
+                               MLX5_WQE_MKEY_CONTEXT_ACCESS_FLAGS_LOCAL_WRITE |
+                               MLX5_WQE_MKEY_CONTEXT_ACCESS_FLAGS_REMOTE_READ));
+    CHECK(be64toh(mk->len) == 510);
+    CHECK(be32toh(mk->qpn_mkey) == 0xffffffef);
+    CHECK(be32toh(mk->translations_octword_size) == 8);
+    CHECK(mk->log_page_size == 0);
+
+    // The list continues at the start of the SQ, padded to whole WQEBBs
+    mlx5_wqe_umr_klm_seg* klm = (mlx5_wqe_umr_klm_seg*)bufs.sq_slot(0);
+    CHECK(be32toh(klm[0].byte_count) == 100);
+    CHECK(be64toh(klm[3].address) == (uintptr_t)pool + 2100);
+    klm = (mlx5_wqe_umr_klm_seg*)bufs.sq_slot(1);
+    CHECK(be32toh(klm[0].byte_count) == 104 && be32toh(klm[0].mkey) == 0x300ef);
+    CHECK(klm[1].byte_count == 0 && klm[3].address == 0);
+
+    // Only four WQEBBs left for an eight-WQEBB list
+    layout.entries.resize(UMR_MAX_INLINE_ENTRIES + 1);
+    CHECK(qp->post_umr(0x1234ef, layout, 0) == STATUS_INVALID_SIZE);
+    layout.entries.resize(24);
+    CHECK(qp->post_umr(0x1234ef, layout, 0) == STATUS_WOULD_BLOCK);
+
+    indirect_mkey unset;
+    CHECK(unset.update(qp.get(), segs, 5) == STATUS_INVALID_STATE);
+
+    free(pool);
+}
+
+static void
+test_qp_blueflame()
+{
+    const uint32_t bf_half = 256;
+    host_qp_buffers bufs(16, 1);
+    bufs.params.use_bf = true;
+    bufs.params.bf_buf_size = bf_half;
+    bufs.params.max_inline_data = 256;
+    auto_ref<queue_pair> qp;
+    CHECK(qp->attach_wq_buffers(bufs.wq_buf, bufs.dbrec, bufs.uar_page, bufs.params) == STATUS_OK);
+
+    // A single WQE is copied whole into the current half of the register
+    static char payload[160];
+    memset(payload, 0xab, sizeof(payload));
+    CHECK(qp->post_send_inline(payload, sizeof(payload)) == STATUS_OK);
+    CHECK(be32toh(bufs.dbrec[MLX5_SND_DBR]) == 3);
+    CHECK(memcmp(bufs.uar_page, bufs.sq_slot(0), 3 * MLX5_SEND_WQE_BB) == 0);
+
+    // The next one lands in the other half, the first half is left alone
+    CHECK(qp->post_rdma_write(payload, 0x1000, (void*)0x10000, 0x2000, 64) == STATUS_OK);
+    CHECK(memcmp(bufs.uar_page + bf_half, bufs.sq_slot(3), MLX5_SEND_WQE_BB) == 0);
+    CHECK(memcmp(bufs.uar_page, bufs.sq_slot(0), 3 * MLX5_SEND_WQE_BB) == 0);
+
+    // A chain falls back to the 8-byte doorbell of its last WQE
+    memset(bufs.uar_page, 0, 2 * bf_half);
+    CHECK(qp->post_rdma_write(payload, 0x1000, (void*)0x10000, 0x2000, 64, QP_POST_NO_DOORBELL) == STATUS_OK);
+    CHECK(qp->post_rdma_write(payload, 0x1000, (void*)0x10040, 0x2000, 64, QP_POST_NO_DOORBELL) == STATUS_OK);
+    CHECK(qp->ring_doorbell() == STATUS_OK);
+    CHECK(memcmp(bufs.uar_page, bufs.sq_slot(5), sizeof(uint64_t)) == 0);
+    CHECK(*(uint64_t*)(bufs.uar_page + sizeof(uint64_t)) == 0);
+
+    // A WQE wrapping the ring end is copied in ring order
+    memset(bufs.uar_page, 0, 2 * bf_half);
+    for (uint32_t i = 0; i < 9; ++i) {
+        CHECK(qp->post_rdma_write(payload, 0x1000, (void*)0x10000, 0x2000, 64) == STATUS_OK);
+    }
+    CHECK(qp->get_sq_pi() == 15);
+    qp->sq_complete(14);
+    memset(bufs.uar_page, 0, 2 * bf_half);
+    CHECK(qp->post_send_inline(payload, sizeof(payload)) == STATUS_OK);
+    char* half = bufs.uar_page; // 12 doorbells so far, back on the first half
+    CHECK(memcmp(half, bufs.sq_slot(15), MLX5_SEND_WQE_BB) == 0);
+    CHECK(memcmp(half + MLX5_SEND_WQE_BB, bufs.sq_slot(16), 2 * MLX5_SEND_WQE_BB) == 0);
+
+    // Misaligned BF halves are rejected
+    host_qp_buffers bad(16, 1);
+    bad.params.bf_buf_size = 100;
+    auto_ref<queue_pair> qp_bad;
+    CHECK(qp_bad->attach_wq_buffers(bad.wq_buf, bad.dbrec, bad.uar_page, bad.params) == STATUS_INVALID_SIZE);
+}
+
+static void
+test_qp_wqe_template()
+{
+    // Template posts must be byte-identical to the generic path
+    host_qp_buffers ref_bufs(16, 1), tmpl_bufs(16, 1);
+    auto_ref<queue_pair> ref, qp;
+    CHECK(ref->attach_wq_buffers(ref_bufs.wq_buf, ref_bufs.dbrec, ref_bufs.uar_page, ref_bufs.params) == STATUS_OK);
+    CHECK(qp->attach_wq_buffers(tmpl_bufs.wq_buf, tmpl_bufs.dbrec, tmpl_bufs.uar_page, tmpl_bufs.params) == STATUS_OK);
+
+    wqe_template write_t, read_t, send_t, imm_t;
+    CHECK(qp->make_wqe_template(write_t, MLX5_OPCODE_RDMA_WRITE, 0x2000, 0x1000) == STATUS_OK);
+    CHECK(qp->make_wqe_template(read_t, MLX5_OPCODE_RDMA_READ, 0x2001, 0x1001) == STATUS_OK);
+    CHECK(qp->make_wqe_template(send_t, MLX5_OPCODE_SEND, 0, 0x1002, QP_POST_NO_DOORBELL) == STATUS_OK);
+    CHECK(qp->make_wqe_template(imm_t, MLX5_OPCODE_RDMA_WRITE_IMM, 0x2003, 0x1003, 0, 0xcafe) == STATUS_OK);
+
+    static char payload[4096];
+    for (uint32_t i = 0; i < 20; ++i) {
+        char* laddr = payload + i * 64;
+        void* raddr = (void*)(uintptr_t)(0x10000 + i * 64);
+        uint32_t len = (i == 5) ? 0 : 64 + i;
+        switch (i % 4) {
+        case 0:
+            CHECK(ref->post_rdma_write(laddr, 0x1000, raddr, 0x2000, len) == STATUS_OK);
+            CHECK(qp->post_template(write_t, laddr, raddr, len) == STATUS_OK);
+            break;
+        case 1:
+            CHECK(ref->post_rdma_read(laddr, 0x1001, raddr, 0x2001, len) == STATUS_OK);
+            CHECK(qp->post_template(read_t, laddr, raddr, len) == STATUS_OK);
+            break;
+        case 2:
+            CHECK(ref->post_send_msg(laddr, 0x1002, len, QP_POST_NO_DOORBELL) == STATUS_OK);
+            CHECK(qp->post_template(send_t, laddr, nullptr, len) == STATUS_OK);
+            break;
+        case 3:
+            CHECK(ref->post_rdma_write_imm(laddr, 0x1003, raddr, 0x2003, len, 0xcafe) == STATUS_OK);
+            CHECK(qp->post_template(imm_t, laddr, raddr, len) == STATUS_OK);
+            break;
+        }
+        ref->sq_complete(i);
+        qp->sq_complete(i);
+        uint32_t ds = wqe_ds(ref_bufs.sq_wqe(i));
+        CHECK(memcmp(ref_bufs.sq_slot(i), tmpl_bufs.sq_slot(i), ds * 16) == 0);
+        CHECK(qp->get_sq_pi() == ref->get_sq_pi());
+        CHECK(qp->get_pending_wqes() == ref->get_pending_wqes());
+    }
+    CHECK(wqe_ds(tmpl_bufs.sq_wqe(5)) == 2);
+
+    wqe_template bad;
+    CHECK(qp->make_wqe_template(bad, MLX5_OPCODE_NOP, 0, 0) == STATUS_INVALID_PARAM);
+}
+
+static bool wqe_signaled(const mlx5_wqe_ctrl_seg* ctrl) {
+    return ctrl->fm_ce_se & MLX5_WQE_CTRL_CQ_UPDATE;
+}
+
+static void
+test_qp_selective_signaling()
+{
+    static char payload[64];
+
+    // Every 4th WQE requests a CQE, plus explicitly signaled ones
+    host_qp_buffers bufs(16, 1);
+    bufs.params.sq_signal_mode = QP_SIGNAL_EVERY_N;
+    bufs.params.sq_signal_period = 4;
+    bufs.params.max_inline_data = 128;
+    auto_ref<queue_pair> qp;
+    CHECK(qp->attach_wq_buffers(bufs.wq_buf, bufs.dbrec, bufs.uar_page, bufs.params) == STATUS_OK);
+
+    for (uint32_t i = 0; i < 6; ++i) {
+        uint32_t flags = (i == 1) ? IBV_SEND_SIGNALED : 0;
+        CHECK(qp->post_rdma_write(payload, 0x1000, (void*)0x10000, 0x2000, 64, flags) == STATUS_OK);
+    }
+    CHECK(!wqe_signaled(bufs.sq_wqe(0)));
+    CHECK(wqe_signaled(bufs.sq_wqe(1)));
+    CHECK(!wqe_signaled(bufs.sq_wqe(2)));
+    CHECK(!wqe_signaled(bufs.sq_wqe(4)));
+    CHECK(wqe_signaled(bufs.sq_wqe(5)));
+
+    // A 2-WQEBB inline send, then fill the ring
+    CHECK(qp->post_send_inline(payload, 64) == STATUS_OK);
+    CHECK(qp->get_sq_pi() == 8);
+    for (uint32_t i = 0; i < 8; ++i) {
+        CHECK(qp->post_rdma_write(payload, 0x1000, (void*)0x10000, 0x2000, 64) == STATUS_OK);
+    }
+    CHECK(qp->get_sq_pi() == 16);
+    CHECK(qp->post_rdma_write(payload, 0x1000, (void*)0x10000, 0x2000, 64) == STATUS_WOULD_BLOCK);
+    CHECK(qp->post_send_inline(payload, 8) == STATUS_WOULD_BLOCK);
+    CHECK(qp->get_sq_pi() == 16);
+
+    // The CQE of WQE 5 retires WQEs 0..5, unsignaled ones included
+    qp->sq_complete(5);
+    CHECK(qp->get_sq_ci() == 6);
+    // ...and the one of the inline send reclaims both of its WQEBBs
+    qp->sq_complete(6);
+    CHECK(qp->get_sq_ci() == 8);
+    CHECK(qp->post_rdma_write(payload, 0x1000, (void*)0x10000, 0x2000, 64) == STATUS_OK);
+
+    // On-request mode still signals once the unsignaled run reaches half the SQ
+    host_qp_buffers req_bufs(16, 1);
+    req_bufs.params.sq_signal_mode = QP_SIGNAL_ON_REQUEST;
+    auto_ref<queue_pair> req;
+    CHECK(req->attach_wq_buffers(req_bufs.wq_buf, req_bufs.dbrec, req_bufs.uar_page, req_bufs.params) == STATUS_OK);
+    for (uint32_t i = 0; i < 16; ++i) {
+        CHECK(req->post_send_msg(payload, 0x1000, 64) == STATUS_OK);
+    }
+    for (uint32_t i = 0; i < 16; ++i) {
+        CHECK(wqe_signaled(req_bufs.sq_wqe(i)) == (i == 7 || i == 15));
+    }
+
+    // Templates follow the same policy
+    wqe_template tmpl;
+    CHECK(req->make_wqe_template(tmpl, MLX5_OPCODE_SEND, 0, 0x1000) == STATUS_OK);
+    req->sq_complete(15);
+    CHECK(req->post_template(tmpl, payload, nullptr, 64) == STATUS_OK);
+    CHECK(req->post_template(tmpl, payload, nullptr, 64, IBV_SEND_SIGNALED) == STATUS_OK);
+    CHECK(!wqe_signaled(req_bufs.sq_wqe(16)));
+    CHECK(wqe_signaled(req_bufs.sq_wqe(17)));
+}
+
+static void
+test_qp_flow_control()
+{
+    static char payload[64];
+
+    cq_hw_params cq_params;
+    cq_params.log_cq_size = 4;
+    void* cqe_buf = aligned_alloc<char>((1U << cq_params.log_cq_size) * 64);
+    uint32_t* cq_dbrec = aligned_alloc<uint32_t>(2);
+    char* cq_uar = aligned_alloc<char>(get_page_size());
+    auto_ref<completion_queue_devx> cq;
+    CHECK(cq->attach_cq_buffers(cqe_buf, cq_dbrec, cq_uar, cq_params) == STATUS_OK);
+
+    host_qp_buffers bufs(8, 1);
+    bufs.params.sq_signal_mode = QP_SIGNAL_EVERY_N;
+    bufs.params.sq_signal_period = 2;
+    auto_ref<queue_pair> qp;
+    CHECK(qp->attach_wq_buffers(bufs.wq_buf, bufs.dbrec, bufs.uar_page, bufs.params) == STATUS_OK);
+    CHECK(qp->sq_available() == 8);
+
+    // Unbound: a full SQ refuses, with or without QP_POST_WAIT
+    for (uint32_t i = 0; i < 8; ++i) {
+        CHECK(qp->post_rdma_write(payload, 0x1000, (void*)0x10000, 0x2000, 64, QP_POST_NO_DOORBELL) == STATUS_OK);
+    }
+    CHECK(qp->sq_available() == 0);
+    CHECK(qp->post_rdma_write(payload, 0x1000, (void*)0x10000, 0x2000, 64, QP_POST_WAIT) == STATUS_WOULD_BLOCK);
+
+    qp->bind_send_cq(cq);
+    CHECK(qp->post_rdma_write(payload, 0x1000, (void*)0x10000, 0x2000, 64) == STATUS_WOULD_BLOCK);
+    CHECK(qp->get_pending_wqes() == 8);
+
+    // Completions for WQEs 1 and 3 are in the CQ: a waiting post rings the
+    // held-back chain, reaps them and goes through
+    uint32_t cq_pi = 0;
+    hw_write_cqe(cqe_buf, cq_params.log_cq_size, cq_pi++, MLX5_CQE_REQ, 0, 1, 0);
+    hw_write_cqe(cqe_buf, cq_params.log_cq_size, cq_pi++, MLX5_CQE_REQ, 0, 3, 0);
+    CHECK(qp->post_rdma_write(payload, 0x1000, (void*)0x10000, 0x2000, 64, QP_POST_WAIT) == STATUS_OK);
+    CHECK(be32toh(bufs.dbrec[MLX5_SND_DBR]) == 9);
+    CHECK(qp->get_sq_ci() == 4);
+    CHECK(qp->sq_available() == 3);
+    CHECK(be32toh(*cq_dbrec) == 2);
+
+    // poll_send_cq hands the CQEs back and retires this QP's requester ones,
+    // after the two the waiting post reaped
+    cqe_out out[8];
+    hw_write_cqe(cqe_buf, cq_params.log_cq_size, cq_pi++, MLX5_CQE_RESP_SEND, 0, 0, 64);
+    hw_write_cqe(cqe_buf, cq_params.log_cq_size, cq_pi++, MLX5_CQE_REQ, 0x77, 7, 0);
+    hw_write_cqe(cqe_buf, cq_params.log_cq_size, cq_pi++, MLX5_CQE_REQ, 0, 5, 0);
+    CHECK(qp->poll_send_cq(out, 8) == 5);
+    CHECK(out[0].wqe_counter == 1 && out[1].wqe_counter == 3);
+    CHECK(out[2].opcode == MLX5_CQE_RESP_SEND);
+    CHECK(out[3].qpn == 0x77);
+    CHECK(qp->get_sq_ci() == 6);
+    CHECK(qp->sq_available() == 5);
+
+    // An error completion ends the wait
+    for (uint32_t i = 0; i < 5; ++i) {
+        CHECK(qp->post_rdma_write(payload, 0x1000, (void*)0x10000, 0x2000, 64) == STATUS_OK);
+    }
+    hw_write_cqe(cqe_buf, cq_params.log_cq_size, cq_pi++, MLX5_CQE_REQ_ERR, 0, 6, 0);
+    CHECK(qp->post_rdma_write(payload, 0x1000, (void*)0x10000, 0x2000, 64, QP_POST_WAIT) == STATUS_ERR);
+
+    free(cqe_buf);
+    free(cq_dbrec);
+    free(cq_uar);
+}
+
+static void
+count_completion(queue_pair* qp, const cqe_out& cqe, void* arg)
+{
+    (void)qp;
+    (void)cqe;
+    (*(int*)arg)++;
+}
+
+void
+test_shared_cq()
+{
+    static char payload[64];
+
+    cq_hw_params cq_params;
+    cq_params.log_cq_size = 5;
+    void* cqe_buf = aligned_alloc<char>((1U << cq_params.log_cq_size) * 64);
+    uint32_t* cq_dbrec = aligned_alloc<uint32_t>(2);
+    char* cq_uar = aligned_alloc<char>(get_page_size());
+    auto_ref<completion_queue_devx> cq;
+    CHECK(cq->attach_cq_buffers(cqe_buf, cq_dbrec, cq_uar, cq_params) == STATUS_OK);
+
+    // Three QPs on one CQ, spread over different pages of the qpn table
+    const uint32_t qpns[3] = { 0x10, 0x1010, 0xabcdef };
+    host_qp_buffers b0(8, 8), b1(8, 8), b2(8, 8);
+    host_qp_buffers* bufs[3] = { &b0, &b1, &b2 };
+    auto_ref<queue_pair> qps[3];
+    int events[3] = { 0, 0, 0 };
+    for (int i = 0; i < 3; ++i) {
+        CHECK(qps[i]->attach_wq_buffers(bufs[i]->wq_buf, bufs[i]->dbrec, bufs[i]->uar_page,
+                                        bufs[i]->params) == STATUS_OK);
+        qps[i]->bind_send_cq(cq);
+        qps[i]->set_completion_cb(count_completion, &events[i]);
+        CHECK(cq->attach_qp(qpns[i], qps[i]) == STATUS_OK);
+    }
+    CHECK(cq->get_num_qps() == 3);
+    CHECK(cq->attach_qp(qpns[0], qps[0]) == STATUS_OK);
+    CHECK(cq->attach_qp(qpns[0], qps[1]) == STATUS_INVALID_STATE);
+    CHECK(cq->attach_qp(0x1000000, qps[1]) == STATUS_INVALID_PARAM);
+    CHECK(cq->get_num_qps() == 3);
+    CHECK(cq->lookup_qp(qpns[2]) == qps[2]);
+    CHECK(cq->lookup_qp(0x11) == nullptr);
+    CHECK(cq->lookup_qp(0xfff000) == nullptr);
+
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 4; ++j) {
+            CHECK(qps[i]->post_rdma_write(payload, 0x1000, (void*)0x10000, 0x2000, 64) == STATUS_OK);
+        }
+        CHECK(qps[i]->sq_available() == 4);
+    }
+    ibv_sge recv = { 0x800000, 256, 0x55 };
+    CHECK(qps[2]->post_recv(&recv, 1) == STATUS_OK);
+    CHECK(qps[2]->rq_available() == 7);
+
+    // Interleaved completions land in each QP's own SQ and RQ state
+    uint32_t cq_pi = 0;
+    hw_write_cqe(cqe_buf, cq_params.log_cq_size, cq_pi++, MLX5_CQE_REQ, qpns[1], 3, 0);
+    hw_write_cqe(cqe_buf, cq_params.log_cq_size, cq_pi++, MLX5_CQE_REQ, qpns[0], 1, 0);
+    hw_write_cqe(cqe_buf, cq_params.log_cq_size, cq_pi++, MLX5_CQE_RESP_SEND, qpns[2], 0, 64);
+    hw_write_cqe(cqe_buf, cq_params.log_cq_size, cq_pi++, MLX5_CQE_REQ, 0x999, 0, 0);
+    hw_write_cqe(cqe_buf, cq_params.log_cq_size, cq_pi++, MLX5_CQE_REQ, qpns[2], 0, 0);
+
+    cqe_out out[8];
+    CHECK(cq->poll_dispatch(out, 8) == 5);
+    CHECK(out[3].qpn == 0x999);
+    CHECK(qps[0]->get_sq_ci() == 2 && events[0] == 1);
+    CHECK(qps[1]->get_sq_ci() == 4 && events[1] == 1);
+    CHECK(qps[2]->get_sq_ci() == 1 && events[2] == 2);
+    CHECK(qps[2]->rq_available() == 8);
+
+    // A QP polling the shared CQ itself still routes its neighbours' CQEs
+    hw_write_cqe(cqe_buf, cq_params.log_cq_size, cq_pi++, MLX5_CQE_REQ, qpns[2], 3, 0);
+    hw_write_cqe(cqe_buf, cq_params.log_cq_size, cq_pi++, MLX5_CQE_REQ, qpns[0], 3, 0);
+    CHECK(qps[0]->poll_send_cq(out, 8) == 2);
+    CHECK(qps[0]->get_sq_ci() == 4);
+    CHECK(qps[2]->get_sq_ci() == 4 && events[2] == 3);
+    CHECK(events[0] == 1);
+
+    // Detached QPs no longer receive completions
+    cq->detach_qp(qpns[1], qps[0]);
+    CHECK(cq->lookup_qp(qpns[1]) == qps[1]);
+    cq->detach_qp(qpns[1], qps[1]);
+    CHECK(cq->lookup_qp(qpns[1]) == nullptr);
+    CHECK(cq->get_num_qps() == 2);
+    hw_write_cqe(cqe_buf, cq_params.log_cq_size, cq_pi++, MLX5_CQE_REQ, qpns[1], 0, 0);
+    CHECK(cq->poll_dispatch(out, 8) == 1);
+    CHECK(events[1] == 1);
+
+    cq->detach_qp(qpns[0], qps[0]);
+    cq->detach_qp(qpns[2], qps[2]);
+    free(cqe_buf);
+    free(cq_dbrec);
+    free(cq_uar);
+}
+
+static void
+test_shared_cq_wait()
+{
+    static char payload[64];
+
+    cq_hw_params cq_params;
+    cq_params.log_cq_size = 5;
+    void* cqe_buf = aligned_alloc<char>((1U << cq_params.log_cq_size) * 64);
+    uint32_t* cq_dbrec = aligned_alloc<uint32_t>(2);
+    char* cq_uar = aligned_alloc<char>(get_page_size());
+    auto_ref<completion_queue_devx> cq;
+    CHECK(cq->attach_cq_buffers(cqe_buf, cq_dbrec, cq_uar, cq_params) == STATUS_OK);
+
+    // Send and receive completions of two QPs share the CQ
+    const uint32_t qpn_a = 0x10, qpn_b = 0x20;
+    host_qp_buffers bufs_a(4, 4), bufs_b(4, 4);
+    auto_ref<queue_pair> a, b;
+    CHECK(a->attach_wq_buffers(bufs_a.wq_buf, bufs_a.dbrec, bufs_a.uar_page, bufs_a.params) == STATUS_OK);
+    CHECK(b->attach_wq_buffers(bufs_b.wq_buf, bufs_b.dbrec, bufs_b.uar_page, bufs_b.params) == STATUS_OK);
+    int events_a = 0, events_b = 0;
+    a->bind_send_cq(cq);
+    b->bind_send_cq(cq);
+    a->set_completion_cb(count_completion, &events_a);
+    b->set_completion_cb(count_completion, &events_b);
+    CHECK(cq->attach_qp(qpn_a, a) == STATUS_OK);
+    CHECK(cq->attach_qp(qpn_b, b) == STATUS_OK);
+
+    ibv_sge recv = { 0x800000, 256, 0x55 };
+    CHECK(a->post_recv(&recv, 1) == STATUS_OK);
+    CHECK(b->post_rdma_write(payload, 0x1000, (void*)0x10000, 0x2000, 64) == STATUS_OK);
+    for (int i = 0; i < 4; ++i) {
+        CHECK(a->post_rdma_write(payload, 0x1000, (void*)0x10000, 0x2000, 64) == STATUS_OK);
+    }
+
+    // A waiting post hands its own receive to the callback and the
+    // neighbour's error to the neighbour, without failing
+    uint32_t cq_pi = 0;
+    hw_write_cqe(cqe_buf, cq_params.log_cq_size, cq_pi++, MLX5_CQE_RESP_SEND, qpn_a, 0, 64);
+    hw_write_cqe(cqe_buf, cq_params.log_cq_size, cq_pi++, MLX5_CQE_REQ_ERR, qpn_b, 0, 0);
+    hw_write_cqe(cqe_buf, cq_params.log_cq_size, cq_pi++, MLX5_CQE_REQ, qpn_a, 1, 0);
+    CHECK(a->post_rdma_write(payload, 0x1000, (void*)0x10000, 0x2000, 64, QP_POST_WAIT) == STATUS_OK);
+    CHECK(events_a == 2 && events_b == 1);
+    CHECK(a->rq_available() == 4 && a->get_sq_ci() == 2);
+    CHECK(b->get_sq_ci() == 1);
+
+    // Without a callback they wait for the next poll_send_cq()
+    a->set_completion_cb(nullptr, nullptr);
+    CHECK(a->post_recv(&recv, 1) == STATUS_OK);
+    CHECK(a->post_rdma_write(payload, 0x1000, (void*)0x10000, 0x2000, 64) == STATUS_OK);
+    hw_write_cqe(cqe_buf, cq_params.log_cq_size, cq_pi++, MLX5_CQE_RESP_SEND, qpn_a, 1, 32);
+    hw_write_cqe(cqe_buf, cq_params.log_cq_size, cq_pi++, MLX5_CQE_REQ, qpn_a, 3, 0);
+    CHECK(a->post_rdma_write(payload, 0x1000, (void*)0x10000, 0x2000, 64, QP_POST_WAIT) == STATUS_OK);
+    cqe_out out[8];
+    CHECK(a->poll_send_cq(out, 8) == 2);
+    CHECK(out[0].opcode == MLX5_CQE_RESP_SEND && out[0].byte_cnt == 32);
+    CHECK(out[1].opcode == MLX5_CQE_REQ && out[1].wqe_counter == 3);
+    CHECK(a->poll_send_cq(out, 8) == 0);
+
+    // Only the QP's own requester error fails the wait
+    CHECK(a->post_rdma_write(payload, 0x1000, (void*)0x10000, 0x2000, 64) == STATUS_OK);
+    CHECK(a->sq_available() == 0);
+    hw_write_cqe(cqe_buf, cq_params.log_cq_size, cq_pi++, MLX5_CQE_REQ_ERR, qpn_a, 4, 0);
+    CHECK(a->post_rdma_write(payload, 0x1000, (void*)0x10000, 0x2000, 64, QP_POST_WAIT) == STATUS_ERR);
+    CHECK(events_b == 1);
+    CHECK(a->poll_send_cq(out, 8) == 1 && out[0].opcode == MLX5_CQE_REQ_ERR);
+
+    cq->detach_qp(qpn_a, a);
+    cq->detach_qp(qpn_b, b);
+    free(cqe_buf);
+    free(cq_dbrec);
+    free(cq_uar);
+}
+
+static void
+test_qp_recv()
+{
+    host_qp_buffers bufs(8, 8);
+    bufs.params.max_recv_sge = 2;
+    auto_ref<queue_pair> qp;
+    CHECK(qp->attach_wq_buffers(bufs.wq_buf, bufs.dbrec, bufs.uar_page, bufs.params) == STATUS_OK);
+    CHECK(qp->rq_available() == 8);
+
+    // One 2-SGE WQE in RQ slot 0 at the start of the WQ buffer
+    ibv_sge sgl[3] = {
+        { 0x100000, 256, 0x11 },
+        { 0x200000, 512, 0x22 },
+        { 0x300000, 64,  0x33 },
+    };
+    CHECK(qp->post_recv(sgl, 3) == STATUS_INVALID_PARAM);
+    CHECK(qp->post_recv(sgl, 2) == STATUS_OK);
+    CHECK(be32toh(bufs.dbrec[MLX5_RCV_DBR]) == 1);
+    CHECK(bufs.dbrec[MLX5_SND_DBR] == 0);
+    mlx5_wqe_data_seg* dseg = (mlx5_wqe_data_seg*)bufs.wq_buf;
+    CHECK(be64toh(dseg[0].addr) == 0x100000);
+    CHECK(be32toh(dseg[1].byte_count) == 512);
+    CHECK(be32toh(dseg[1].lkey) == 0x22);
+
+    // A batch of single-SGE WQEs: each is terminated, one dbrec update
+    ibv_sge batch[8];
+    for (uint32_t i = 0; i < 8; ++i) {
+        batch[i] = { 0x400000 + i * 0x1000, 1024, 0x44 };
+    }
+    CHECK(qp->post_recv_batch(batch, 8) == STATUS_WOULD_BLOCK);
+    CHECK(qp->post_recv_batch(batch, 7) == STATUS_OK);
+    CHECK(be32toh(bufs.dbrec[MLX5_RCV_DBR]) == 8);
+    CHECK(qp->rq_available() == 0);
+    for (uint32_t i = 1; i < 8; ++i) {
+        dseg = (mlx5_wqe_data_seg*)(bufs.wq_buf + i * 64);
+        CHECK(be64toh(dseg[0].addr) == 0x400000 + (i - 1) * 0x1000);
+        CHECK(be32toh(dseg[1].lkey) == MLX5_INVALID_LKEY);
+        CHECK(dseg[1].byte_count == 0);
+    }
+    CHECK(qp->post_recv(sgl, 1) == STATUS_WOULD_BLOCK);
+
+    // Receive completions retire RQ WQEs in order; the SQ is after the RQ
+    qp->rq_complete(2);
+    CHECK(qp->rq_available() == 3);
+    CHECK(qp->post_recv_batch(batch, 3) == STATUS_OK);
+    CHECK(be32toh(bufs.dbrec[MLX5_RCV_DBR]) == 11);
+    CHECK(qp->post_send_msg(batch, 0x1000, 8) == STATUS_OK);
+    CHECK(wqe_opcode(bufs.sq_wqe(0)) == MLX5_OPCODE_SEND);
+}
+
+static void
+test_srq()
+{
+    srq_init_params params;
+    params.log_srq_size = 3;
+    params.max_sge = 2;
+    uint32_t stride = shared_receive_queue::wqe_stride(params.max_sge);
+    CHECK(stride == 64);
+    char* wqe_buf = aligned_alloc<char>(stride << params.log_srq_size);
+    uint32_t* dbrec = aligned_alloc<uint32_t>(1);
+
+    auto_ref<shared_receive_queue> srq;
+    CHECK(srq->attach_srq_buffers(wqe_buf, dbrec, params) == STATUS_OK);
+    CHECK(srq->available() == 7);
+
+    ibv_sge batch[8];
+    for (uint32_t i = 0; i < 8; ++i) {
+        batch[i] = { 0x500000 + i * 0x1000, 2048, 0x55 };
+    }
+    CHECK(srq->post_recv_batch(batch, 8) == STATUS_WOULD_BLOCK);
+    CHECK(srq->post_recv_batch(batch, 7) == STATUS_OK);
+    CHECK(be32toh(*dbrec) == 7);
+    CHECK(srq->available() == 0);
+    for (uint32_t i = 0; i < 7; ++i) {
+        mlx5_wqe_data_seg* dseg = (mlx5_wqe_data_seg*)(wqe_buf + i * stride + 16);
+        CHECK(be64toh(dseg[0].addr) == 0x500000 + i * 0x1000);
+        CHECK(be32toh(dseg[1].lkey) == MLX5_INVALID_LKEY);
+    }
+    CHECK(srq->post_recv(batch, 1) == STATUS_WOULD_BLOCK);
+
+    // Two QPs share the SRQ; each retires its receive completions into it
+    cq_hw_params cq_params;
+    cq_params.log_cq_size = 4;
+    void* cqe_buf = aligned_alloc<char>((1U << cq_params.log_cq_size) * 64);
+    uint32_t* cq_dbrec = aligned_alloc<uint32_t>(2);
+    char* cq_uar = aligned_alloc<char>(get_page_size());
+    auto_ref<completion_queue_devx> cq;
+    CHECK(cq->attach_cq_buffers(cqe_buf, cq_dbrec, cq_uar, cq_params) == STATUS_OK);
+
+    host_qp_buffers bufs(8, 8);
+    bufs.params.srq = srq;
+    auto_ref<queue_pair> qp;
+    CHECK(qp->attach_wq_buffers(bufs.wq_buf, bufs.dbrec, bufs.uar_page, bufs.params) == STATUS_OK);
+    qp->bind_send_cq(cq);
+    CHECK(qp->post_recv(batch, 1) == STATUS_INVALID_OPERATION);
+    CHECK(qp->post_recv_batch(batch, 1) == STATUS_INVALID_OPERATION);
+
+    // No RQ: the SQ starts the WQ buffer
+    CHECK(qp->post_send_msg(batch, 0x1000, 8) == STATUS_OK);
+    CHECK(wqe_opcode((mlx5_wqe_ctrl_seg*)bufs.wq_buf) == MLX5_OPCODE_SEND);
+
+    // Out-of-order completions go back on the list behind the tail
+    hw_write_cqe(cqe_buf, cq_params.log_cq_size, 0, MLX5_CQE_RESP_SEND, 0, 4, 2048);
+    hw_write_cqe(cqe_buf, cq_params.log_cq_size, 1, MLX5_CQE_RESP_SEND, 0, 1, 2048);
+    cqe_out out[4];
+    CHECK(qp->poll_send_cq(out, 4) == 2);
+    CHECK(srq->available() == 2);
+
+    // The next posts take the old tail (7), then 4
+    CHECK(srq->post_recv(batch, 1) == STATUS_OK);
+    CHECK(be64toh(((mlx5_wqe_data_seg*)(wqe_buf + 7 * stride + 16))->addr) == batch[0].addr);
+    CHECK(srq->post_recv(&batch[1], 1) == STATUS_OK);
+    CHECK(be64toh(((mlx5_wqe_data_seg*)(wqe_buf + 4 * stride + 16))->addr) == batch[1].addr);
+    CHECK(be32toh(*dbrec) == 9);
+    CHECK(srq->available() == 0);
+
+    free(cqe_buf);
+    free(cq_dbrec);
+    free(cq_uar);
+    free(wqe_buf);
+    free(dbrec);
+}
+
+static cqe_out
+stride_cqe(uint16_t wqe_id, uint16_t stride, uint32_t strides, uint32_t len, bool filler = false)
+{
+    cqe_out c = {};
+    c.opcode = MLX5_CQE_RESP_SEND;
+    c.wqe_id = wqe_id;
+    c.wqe_counter = stride;
+    c.byte_cnt = (filler ? MLX5_MPRQ_FILLER_MASK : 0) |
+                 (strides << MLX5_MPRQ_STRIDE_NUM_SHIFT) | len;
+    return c;
+}
+
+void
+test_srq_striding()
+{
+    srq_init_params params;
+    params.log_srq_size = 2;
+    params.log_num_strides = 9;
+    params.log_stride_size = 6;
+    uint32_t stride = shared_receive_queue::wqe_stride(1);
+    char* wqe_buf = aligned_alloc<char>(stride << params.log_srq_size);
+    uint32_t* dbrec = aligned_alloc<uint32_t>(1);
+
+    auto_ref<shared_receive_queue> srq;
+    CHECK(srq->attach_srq_buffers(wqe_buf, dbrec, params) == STATUS_OK);
+    CHECK(srq->is_striding());
+    CHECK(srq->get_buffer_size() == 512 * 64);
+
+    uint32_t buf_size = srq->get_buffer_size();
+    char* data = aligned_alloc<char>(3 * buf_size);
+    CHECK(srq->post_stride_buffers(data, 0x77, 4) == STATUS_WOULD_BLOCK);
+    CHECK(srq->post_stride_buffers(data, 0x77, 3) == STATUS_OK);
+    CHECK(be32toh(*dbrec) == 3);
+    for (uint32_t i = 0; i < 3; ++i) {
+        mlx5_wqe_data_seg* dseg = (mlx5_wqe_data_seg*)(wqe_buf + i * stride + 16);
+        CHECK(be64toh(dseg->addr) == (uintptr_t)(data + i * buf_size));
+        CHECK(be32toh(dseg->byte_count) == buf_size);
+    }
+
+    // Three messages land in buffer 0, then the HCA fills its tail
+    stride_msg a, b, c;
+    CHECK(srq->consume(stride_cqe(0, 0, 2, 100), a) == STATUS_OK);
+    CHECK(a.data == data && a.len == 100 && a.num_strides == 2);
+    CHECK(srq->consume(stride_cqe(0, 2, 1, 64), b) == STATUS_OK);
+    CHECK(b.data == data + 2 * 64 && b.stride_index == 2);
+    CHECK(srq->consume(stride_cqe(0, 3, 300, 19200), c) == STATUS_OK);
+    stride_msg f;
+    CHECK(srq->consume(stride_cqe(0, 303, 209, 0, true), f) == STATUS_NO_DATA);
+    CHECK(srq->consume(stride_cqe(1, 500, 13, 64), f) == STATUS_INVALID_VALUE);
+
+    // Messages in buffer 1 are independent of buffer 0
+    stride_msg d;
+    CHECK(srq->consume(stride_cqe(1, 0, 1, 10), d) == STATUS_OK);
+    CHECK(d.data == data + buf_size);
+
+    // Buffer 0 is reposted only once its last message is released
+    srq->release(b);
+    srq->release(c);
+    CHECK(be32toh(*dbrec) == 3);
+    srq->release(a);
+    CHECK(be32toh(*dbrec) == 4);
+    CHECK(srq->available() == 0);
+    mlx5_wqe_data_seg* reposted = (mlx5_wqe_data_seg*)(wqe_buf + 3 * stride + 16);
+    CHECK(be64toh(reposted->addr) == (uintptr_t)data);
+
+    // The recycled buffer now lives in WQE 3
+    stride_msg e;
+    CHECK(srq->consume(stride_cqe(3, 0, 1, 8), e) == STATUS_OK);
+    CHECK(e.data == data);
+    srq->release(d);
+    srq->release(e);
+
+    // Regular SRQs have no stride consumer
+    srq_init_params plain;
+    plain.log_srq_size = 2;
+    auto_ref<shared_receive_queue> regular;
+    CHECK(regular->attach_srq_buffers(wqe_buf, dbrec, plain) == STATUS_OK);
+    CHECK(regular->consume(stride_cqe(0, 0, 1, 8), e) == STATUS_INVALID_OPERATION);
+
+    params.log_num_strides = 8;
+    auto_ref<shared_receive_queue> bad;
+    CHECK(bad->attach_srq_buffers(wqe_buf, dbrec, params) == STATUS_INVALID_PARAM);
+
+    free(data);
+    free(wqe_buf);
+    free(dbrec);
+}
+
+struct stride_sink {
+    shared_receive_queue* srq;
+    int                   messages;
+    int                   fillers;
+};
+
+static void
+consume_strides(queue_pair* qp, const cqe_out& cqe, void* arg)
+{
+    (void)qp;
+    stride_sink* sink = (stride_sink*)arg;
+    stride_msg msg;
+    STATUS res = sink->srq->consume(cqe, msg);
+    if (res == STATUS_OK) {
+        sink->messages++;
+        sink->srq->release(msg);
+    } else if (res == STATUS_NO_DATA) {
+        sink->fillers++;
+    }
+}
+
+static void
+test_srq_striding_dispatch()
+{
+    cq_hw_params cq_params;
+    cq_params.log_cq_size = 3;
+    void* cqe_buf = aligned_alloc<char>((1U << cq_params.log_cq_size) * 64);
+    uint32_t* cq_dbrec = aligned_alloc<uint32_t>(2);
+    char* cq_uar = aligned_alloc<char>(get_page_size());
+    auto_ref<completion_queue_devx> cq;
+    CHECK(cq->attach_cq_buffers(cqe_buf, cq_dbrec, cq_uar, cq_params) == STATUS_OK);
+
+    srq_init_params params;
+    params.log_srq_size = 2;
+    params.log_num_strides = 9;
+    params.log_stride_size = 6;
+    char* wqe_buf = aligned_alloc<char>(shared_receive_queue::wqe_stride(1) << params.log_srq_size);
+    uint32_t* dbrec = aligned_alloc<uint32_t>(1);
+    auto_ref<shared_receive_queue> srq;
+    CHECK(srq->attach_srq_buffers(wqe_buf, dbrec, params) == STATUS_OK);
+    char* data = aligned_alloc<char>(3 * srq->get_buffer_size());
+    CHECK(srq->post_stride_buffers(data, 0x77, 3) == STATUS_OK);
+
+    const uint32_t qpn = 0x30;
+    host_qp_buffers bufs(4, 0);
+    bufs.params.srq = srq;
+    auto_ref<queue_pair> qp;
+    CHECK(qp->attach_wq_buffers(bufs.wq_buf, bufs.dbrec, bufs.uar_page, bufs.params) == STATUS_OK);
+    stride_sink sink = { srq, 0, 0 };
+    qp->set_completion_cb(consume_strides, &sink);
+    CHECK(cq->attach_qp(qpn, qp) == STATUS_OK);
+
+    // Two messages and a filler use up buffer 0. complete() must not treat
+    // the stride indexes as WQE indexes; release() reposts the buffer.
+    const uint32_t cqe_cnt = 1U << cq_params.log_cq_size;
+    const uint32_t cqes[3][3] = { { 0, 2, 100 }, { 2, 1, 64 }, { 3, 509, 0 } };
+    for (uint32_t i = 0; i < 3; ++i) {
+        uint32_t byte_cnt = (cqes[i][1] << MLX5_MPRQ_STRIDE_NUM_SHIFT) | cqes[i][2] |
+                            (i == 2 ? MLX5_MPRQ_FILLER_MASK : 0);
+        hw_write_cqe(cqe_buf, cq_params.log_cq_size, i, MLX5_CQE_RESP_SEND, qpn, cqes[i][0], byte_cnt);
+        ((mlx5_cqe64*)((char*)cqe_buf + (i & (cqe_cnt - 1)) * 64))->wqe_id = htobe16(0);
+    }
+
+    cqe_out out[8];
+    CHECK(cq->poll_dispatch(out, 8) == 3);
+    CHECK(sink.messages == 2 && sink.fillers == 1);
+    CHECK(srq->available() == 0);
+    CHECK(be32toh(*dbrec) == 4);
+    CHECK(be64toh(((mlx5_wqe_data_seg*)(wqe_buf + 3 * srq->get_wqe_stride() + 16))->addr) ==
+          (uintptr_t)data);
+
+    cq->detach_qp(qpn, qp);
+    free(data);
+    free(wqe_buf);
+    free(dbrec);
+    free(cqe_buf);
+    free(cq_dbrec);
+    free(cq_uar);
+}
+
+//==============================================================================
+// Registration cache
+//==============================================================================
+
+struct fake_registrar {
+    uint32_t next_key = 0x100;
+    int      regs     = 0;
+    int      deregs   = 0;
+    bool     fail     = false;
+    std::vector<std::pair<uintptr_t, size_t>> live;
+
+    static STATUS reg(void* ctx, void* addr, size_t length,
+                      uint32_t* lkey, uint32_t* rkey, void** handle) {
+        fake_registrar* r = (fake_registrar*)ctx;
+        if (r->fail) {
+            return STATUS_ERR;
+        }
+        r->regs++;
+        *lkey = r->next_key++;
+        *rkey = *lkey | 0x80000000;
+        r->live.push_back({ (uintptr_t)addr, length });
+        *handle = (void*)(uintptr_t)*lkey;
+        return STATUS_OK;
+    }
+
+    static void dereg(void* ctx, void* handle) {
+        fake_registrar* r = (fake_registrar*)ctx;
+        r->deregs++;
+        (void)handle;
+    }
+};
+
+void
+test_mr_cache()
+{
+    const size_t page = 4096;
+    char* pool = aligned_alloc<char>(16 * page);
+    fake_registrar fr;
+    mr_cache_ops ops = { fake_registrar::reg, fake_registrar::dereg, &fr };
+    mr_cache_params params;
+    params.max_bytes = 6 * page;
+    params.alignment = page;
+
+    auto_ref<mr_cache> cache;
+    CHECK(cache->initialize(mr_cache_ops{}, params) == STATUS_INVALID_PARAM);
+    CHECK(cache->initialize(ops, params) == STATUS_OK);
+
+    // A miss registers the page-aligned range; anything inside it hits
+    mr_cache_entry* a = nullptr;
+    CHECK(cache->get(pool + 100, 200, &a) == STATUS_OK);
+    CHECK(fr.regs == 1);
+    CHECK(a->start == (uintptr_t)pool && a->length == page);
+    mr_cache_entry* a2 = nullptr;
+    CHECK(cache->get(pool + 4000, 96, &a2) == STATUS_OK);
+    CHECK(a2 == a && a->refcount == 2 && fr.regs == 1);
+    CHECK(cache->get_hits() == 1 && cache->get_misses() == 1);
+
+    // A range poking out of it registers the union; the old entry lives on
+    // until its last reference goes
+    mr_cache_entry* b = nullptr;
+    CHECK(cache->get(pool + 4000, page, &b) == STATUS_OK);
+    CHECK(b->start == (uintptr_t)pool && b->length == 2 * page);
+    CHECK(cache->get_num_entries() == 1);
+    CHECK(!a->indexed);
+    cache->put(a2);
+    CHECK(fr.deregs == 0);
+    cache->put(a);
+    CHECK(fr.deregs == 1);
+    CHECK(cache->get_registered_bytes() == 2 * page);
+
+    // Unreferenced entries are evicted least recently used first
+    mr_cache_entry* c = nullptr;
+    mr_cache_entry* d = nullptr;
+    CHECK(cache->get(pool + 4 * page, page, &c) == STATUS_OK);
+    CHECK(cache->get(pool + 6 * page, 2 * page, &d) == STATUS_OK);
+    CHECK(cache->get_registered_bytes() == 5 * page);
+    cache->put(c);
+    cache->put(b);
+    cache->put(d);
+
+    mr_cache_entry* e = nullptr;
+    CHECK(cache->get(pool + 10 * page, 2 * page, &e) == STATUS_OK);
+    CHECK(cache->get_evictions() == 1);
+    CHECK(cache->get_num_entries() == 3);
+    mr_cache_entry* probe = nullptr;
+    CHECK(cache->get(pool, page, &probe) == STATUS_OK && probe == b);
+    cache->put(probe);
+    CHECK(fr.regs == 5);
+
+    // Everything left is pinned: the budget refuses instead of evicting
+    mr_cache_entry* f = nullptr;
+    CHECK(cache->get(pool, page, &b) == STATUS_OK);
+    CHECK(cache->get(pool + 6 * page, page, &d) == STATUS_OK);
+    CHECK(cache->get(pool + 13 * page, page, &f) == STATUS_NO_MEM);
+    cache->put(e);
+    CHECK(cache->get(pool + 13 * page, page, &f) == STATUS_OK);
+    CHECK(cache->get_evictions() == 2);
+
+    // Freed memory must not be served from stale registrations
+    cache->put(d);
+    int deregs = fr.deregs;
+    cache->invalidate(pool + 7 * page, 1);
+    CHECK(fr.deregs == deregs + 1);
+    CHECK(cache->get(pool + 6 * page, page, &d) == STATUS_OK);
+    CHECK(fr.regs == 7);
+
+    // A failed registration of the union leaves the entries it overlaps
+    cache->put(d);
+    fr.fail = true;
+    deregs = fr.deregs;
+    mr_cache_entry* g = nullptr;
+    CHECK(cache->get(pool + 5 * page, 2 * page, &g) == STATUS_ERR);
+    CHECK(fr.deregs == deregs && cache->get_num_entries() == 3);
+    CHECK(d->indexed && d->refcount == 0);
+    CHECK(cache->get_registered_bytes() == 4 * page);
+    fr.fail = false;
+
+    // Entries merged away while referenced are released by destroy()
+    CHECK(cache->get(pool + 3 * page / 2, page, &g) == STATUS_OK);
+    CHECK(g->start == (uintptr_t)pool && g->length == 3 * page);
+    CHECK(!b->indexed && fr.regs == 8);
+    cache->put(f);
+    cache->destroy();
+    CHECK(fr.deregs == fr.regs);
+    free(pool);
+}
+
+static void
+test_indirect_mkey_layout()
+{
+    const size_t page = get_page_size();
+    char* pool = aligned_alloc<char>(8 * page);
+
+    memory_region a, b;
+    CHECK(a.attach_mkey(pool, 4 * page, 0x100ef, 0x100ef) == STATUS_OK);
+    CHECK(b.attach_mkey(pool + 4 * page, 4 * page, 0x200ef, 0x200ef) == STATUS_OK);
+
+    // Mixed lengths: KLM entries back to back in list order
+    mkey_segment mixed[] = {
+        { &b, 100, 300 },
+        { &a, 0, 4 * page },
+        { &b, 3 * page, 64 },
+    };
+    mkey_layout layout;
+    CHECK(indirect_mkey::build_layout(mixed, 3, 4, &layout) == STATUS_OK);
+    CHECK(layout.access_mode == MLX5_MKC_ACCESS_MODE_KLMS);
+    CHECK(layout.length == 300 + 4 * page + 64);
+    CHECK(layout.entries.size() == 3);
+    CHECK(be32toh(layout.entries[0].byte_count) == 300);
+    CHECK(be32toh(layout.entries[0].mkey) == 0x200ef);
+    CHECK(be64toh(layout.entries[0].address) == (uintptr_t)pool + 4 * page + 100);
+    CHECK(be32toh(layout.entries[1].mkey) == 0x100ef);
+    CHECK(be64toh(layout.entries[2].address) == (uintptr_t)pool + 7 * page);
+
+    // Equal, aligned power-of-two pieces: KSM
+    mkey_segment uniform[] = {
+        { &b, page, page },
+        { &a, 2 * page, page },
+    };
+    CHECK(indirect_mkey::build_layout(uniform, 2, 4, &layout) == STATUS_OK);
+    CHECK(layout.access_mode == MLX5_MKC_ACCESS_MODE_KSM);
+    CHECK(layout.log_entity_size == get_page_size_log());
+    CHECK(layout.length == 2 * page && layout.entries[1].byte_count == 0);
+
+    // A UMR keeps the mode and KSM entity size of the mkey
+    mkey_layout ksm = layout;
+    mkey_segment halves[] = {
+        { &b, 0, page / 2 },
+        { &a, page / 2, page / 2 },
+    };
+    CHECK(indirect_mkey::build_layout(halves, 2, 4, &layout) == STATUS_OK);
+    CHECK(layout.access_mode == MLX5_MKC_ACCESS_MODE_KSM);
+    CHECK(indirect_mkey::check_update(ksm, layout) == STATUS_INVALID_OPERATION);
+    CHECK(indirect_mkey::check_update(ksm, ksm) == STATUS_OK);
+
+    // Layouts are built in the mkey's own mode: a KSM mkey refuses a ragged
+    // list, a KLM one takes a uniform list as KLM
+    CHECK(indirect_mkey::build_layout(mixed, 3, 4, &layout, MLX5_MKC_ACCESS_MODE_KSM) ==
+          STATUS_INVALID_OPERATION);
+    mkey_layout klm;
+    CHECK(indirect_mkey::build_layout(mixed, 3, 4, &klm, MLX5_MKC_ACCESS_MODE_KLMS) == STATUS_OK);
+    CHECK(indirect_mkey::build_layout(uniform, 2, 4, &layout, MLX5_MKC_ACCESS_MODE_KLMS) == STATUS_OK);
+    CHECK(layout.access_mode == MLX5_MKC_ACCESS_MODE_KLMS && layout.log_entity_size == 0);
+    CHECK(be32toh(layout.entries[0].byte_count) == page);
+    CHECK(indirect_mkey::check_update(klm, layout) == STATUS_OK);
+    CHECK(indirect_mkey::build_layout(uniform, 2, 4, &layout, MLX5_MKC_ACCESS_MODE_KSM) == STATUS_OK);
+    CHECK(indirect_mkey::check_update(ksm, layout) == STATUS_OK);
+    CHECK(indirect_mkey::build_layout(uniform, 2, 4, &layout, 0x7) == STATUS_INVALID_PARAM);
+
+    // Unaligned pieces of equal size stay KLM
+    uniform[0].offset = 64;
+    CHECK(indirect_mkey::build_layout(uniform, 2, 4, &layout) == STATUS_OK);
+    CHECK(layout.access_mode == MLX5_MKC_ACCESS_MODE_KLMS);
+
+    CHECK(indirect_mkey::build_layout(mixed, 3, 2, &layout) == STATUS_INVALID_SIZE);
+    mkey_segment outside[] = { { &a, 3 * page, 2 * page } };
+    CHECK(indirect_mkey::build_layout(outside, 1, 4, &layout) == STATUS_INVALID_PARAM);
+    CHECK(a.attach_mkey(nullptr, page, 1, 1) == STATUS_INVALID_PARAM);
+
+    free(pool);
+}
+
+// Netlink message builder for canned RDMA_NLDEV replies
+struct nl_builder {
+    std::vector<char> buf;
+
+    size_t begin(uint16_t type) {
+        size_t off = buf.size();
+        buf.resize(off + NLA_HDRLEN);
+        ((nlattr*)&buf[off])->nla_type = type;
+        return off;
+    }
+    void end(size_t off) {
+        ((nlattr*)&buf[off])->nla_len = buf.size() - off;
+        buf.resize(NLA_ALIGN(buf.size()));
+    }
+    void put(uint16_t type, const void* data, size_t len) {
+        size_t off = begin(type);
+        buf.insert(buf.end(), (const char*)data, (const char*)data + len);
+        end(off);
+    }
+    void counter(const char* name, uint64_t value) {
+        size_t off = begin(RDMA_NLDEV_ATTR_STAT_HWCOUNTER_ENTRY);
+        put(RDMA_NLDEV_ATTR_STAT_HWCOUNTER_ENTRY_NAME, name, strlen(name) + 1);
+        put(RDMA_NLDEV_ATTR_STAT_HWCOUNTER_ENTRY_VALUE, &value, sizeof(value));
+        end(off);
+    }
+    size_t msg(uint16_t type) {
+        size_t off = buf.size();
+        buf.resize(off + NLMSG_HDRLEN);
+        ((nlmsghdr*)&buf[off])->nlmsg_type = type;
+        return off;
+    }
+    void msg_end(size_t off) {
+        ((nlmsghdr*)&buf[off])->nlmsg_len = buf.size() - off;
+    }
+};
+
+static void
+test_odp()
+{
+    const size_t page = get_page_size();
+    char* pool = aligned_alloc<char>(page);
+
+    // Prefetch advice only applies to ODP registrations
+    memory_region a;
+    CHECK(a.attach_mkey(pool, page, 0x100ef, 0x100ef) == STATUS_OK);
+    CHECK(!a.is_odp());
+    CHECK(a.prefetch(pool, page) == STATUS_INVALID_OPERATION);
+
+    // Two MRs in one STAT_GET message, a third in the next; unrelated
+    // counters and attributes are skipped
+    nl_builder nl;
+    const uint32_t dev_index = 3;
+    size_t m = nl.msg(RDMA_NL_GET_TYPE(RDMA_NL_NLDEV, RDMA_NLDEV_CMD_STAT_GET));
+    nl.put(RDMA_NLDEV_ATTR_DEV_INDEX, &dev_index, sizeof(dev_index));
+    size_t mrs = nl.begin(RDMA_NLDEV_ATTR_RES_MR);
+    size_t mr = nl.begin(RDMA_NLDEV_ATTR_RES_MR_ENTRY);
+    size_t hw = nl.begin(RDMA_NLDEV_ATTR_STAT_HWCOUNTERS);
+    nl.counter("page_faults", 10);
+    nl.counter("page_invalidations", 2);
+    nl.counter("rx_write_requests", 1000);
+    nl.end(hw);
+    nl.end(mr);
+    mr = nl.begin(RDMA_NLDEV_ATTR_RES_MR_ENTRY);
+    hw = nl.begin(RDMA_NLDEV_ATTR_STAT_HWCOUNTERS);
+    nl.counter("page_faults", 5);
+    nl.counter("page_prefetch", 7);
+    nl.end(hw);
+    nl.end(mr);
+    nl.end(mrs);
+    nl.msg_end(m);
+
+    m = nl.msg(RDMA_NL_GET_TYPE(RDMA_NL_NLDEV, RDMA_NLDEV_CMD_STAT_GET));
+    mrs = nl.begin(RDMA_NLDEV_ATTR_RES_MR);
+    mr = nl.begin(RDMA_NLDEV_ATTR_RES_MR_ENTRY);
+    hw = nl.begin(RDMA_NLDEV_ATTR_STAT_HWCOUNTERS);
+    nl.counter("page_invalidations", 1);
+    nl.end(hw);
+    nl.end(mr);
+    nl.end(mrs);
+    nl.msg_end(m);
+
+    odp_counters counters = {};
+    bool done = false;
+    CHECK(rdma_device::parse_odp_counters(nl.buf.data(), nl.buf.size(), &counters, &done) == STATUS_OK);
+    CHECK(!done);
+    CHECK(counters.page_faults == 15);
+    CHECK(counters.page_invalidations == 3);
+    CHECK(counters.page_prefetch == 7);
+
+    // The next recv() ends the dump; counters accumulate across replies
+    size_t tail = nl.buf.size();
+    m = nl.msg(RDMA_NL_GET_TYPE(RDMA_NL_NLDEV, RDMA_NLDEV_CMD_STAT_GET));
+    mrs = nl.begin(RDMA_NLDEV_ATTR_RES_MR);
+    mr = nl.begin(RDMA_NLDEV_ATTR_RES_MR_ENTRY);
+    hw = nl.begin(RDMA_NLDEV_ATTR_STAT_HWCOUNTERS);
+    nl.counter("page_faults", 1);
+    nl.end(hw);
+    nl.end(mr);
+    nl.end(mrs);
+    nl.msg_end(m);
+    nl.msg_end(nl.msg(NLMSG_DONE));
+    CHECK(rdma_device::parse_odp_counters(&nl.buf[tail], nl.buf.size() - tail, &counters, &done) == STATUS_OK);
+    CHECK(done);
+    CHECK(counters.page_faults == 16);
+
+    // Kernels without MR statistics answer with an error
+    nl_builder err;
+    m = err.msg(NLMSG_ERROR);
+    nlmsgerr e = {};
+    e.error = -EOPNOTSUPP;
+    err.buf.insert(err.buf.end(), (const char*)&e, (const char*)&e + sizeof(e));
+    err.msg_end(m);
+    done = false;
+    CHECK(rdma_device::parse_odp_counters(err.buf.data(), err.buf.size(), &counters, &done) == STATUS_NOT_IMPLEMENTED);
+    CHECK(done);
+
+    free(pool);
+}
+
+static void
+test_mr_pool()
+{
+    const size_t slab = 1UL << MR_POOL_MAX_CLASS_LOG;
+    char* arena = aligned_alloc<char>(3 * slab);
+
+    CHECK(mr_pool::size_class(1) == 0 && mr_pool::size_class(64) == 0);
+    CHECK(mr_pool::size_class(65) == 1 && mr_pool::size_class(4096) == 6);
+    CHECK(mr_pool::size_class(slab) == MR_POOL_NUM_CLASSES - 1);
+    CHECK(mr_pool::size_class(slab + 1) == -1);
+
+    auto_ref<mr_pool> small;
+    CHECK(small->attach(arena, slab - 1, 1, 2) == STATUS_INVALID_SIZE);
+
+    mr_pool_params params;
+    params.cache_size = 4;
+    auto_ref<mr_pool> pool;
+    CHECK(pool->attach(arena, 3 * slab, 0x11, 0x22, params) == STATUS_OK);
+    CHECK(pool->get_num_slabs() == 3);
+
+    mr_pool_buf a, b;
+    CHECK(pool->alloc(100, &a) == STATUS_OK);
+    CHECK(a.addr == arena && a.offset == 0 && a.length == 128);
+    CHECK(a.lkey == 0x11 && a.rkey == 0x22);
+    CHECK(pool->alloc(100, &b) == STATUS_OK && b.offset == 128);
+    CHECK(pool->alloc(0, &b) == STATUS_INVALID_SIZE);
+    CHECK(pool->alloc(slab + 1, &b) == STATUS_INVALID_SIZE);
+
+    // A freed block is the next one handed out for its class
+    CHECK(pool->free(a.addr) == STATUS_OK);
+    CHECK(pool->alloc(128, &b) == STATUS_OK && b.addr == a.addr);
+
+    // Stray pointers never reach a free list: off a block boundary, outside
+    // the arena, or in a slab no class has claimed
+    CHECK(pool->free(arena + 64) == STATUS_INVALID_PARAM);
+    CHECK(pool->free(arena - 128) == STATUS_INVALID_PARAM);
+    CHECK(pool->free(arena + 3 * slab) == STATUS_INVALID_PARAM);
+    CHECK(pool->free(arena + slab) == STATUS_INVALID_PARAM);
+    CHECK(pool->alloc(128, &a) == STATUS_OK && a.offset == 256);
+
+    // A second class takes its own slab; 1MB blocks fill one slab each
+    CHECK(pool->alloc(4096, &b) == STATUS_OK && b.offset == slab);
+    CHECK(pool->alloc(slab, &a) == STATUS_OK && a.offset == 2 * slab);
+    CHECK(pool->alloc(slab, &b) == STATUS_NO_MEM);
+    CHECK(pool->get_slabs_used() == 3);
+    CHECK(pool->free(a.addr) == STATUS_OK);
+
+    {
+        // Refills take half the cache; overflow drains half back
+        mr_pool_cache cache(pool.get());
+        mr_pool_buf c[6];
+        CHECK(cache.alloc(4096, &c[0]) == STATUS_OK);
+        CHECK(c[0].offset == slab + 4096 || c[0].offset == slab + 2 * 4096);
+        for (int i = 1; i < 6; ++i) {
+            CHECK(cache.alloc(4000, &c[i]) == STATUS_OK && c[i].length == 4096);
+        }
+        for (int i = 0; i < 6; ++i) {
+            for (int j = 0; j < i; ++j) {
+                CHECK(c[i].addr != c[j].addr);
+            }
+        }
+        for (int i = 0; i < 6; ++i) {
+            CHECK(cache.free(c[i].addr) == STATUS_OK);
+        }
+        CHECK(cache.free((char*)c[0].addr + 64) == STATUS_INVALID_PARAM);
+
+        // Blocks held by a cache are still the pool's to reuse after a flush
+        CHECK(cache.free(b.addr) == STATUS_OK);
+        cache.flush();
+        CHECK(pool->alloc(slab, &a) == STATUS_OK && a.offset == 2 * slab);
+        CHECK(pool->free(a.addr) == STATUS_OK);
+    }
+
+    pool->destroy();
+    free(arena);
+}
+
+static void
+test_page_buffer()
+{
+    const unsigned base_log = get_page_size_log();
+    page_buffer buf;
+
+    CHECK(page_buffer_alloc(100, MEM_PAGE_DEFAULT, &buf));
+    CHECK(buf.page_log == base_log && !buf.mapped);
+    CHECK(((uintptr_t)buf.addr & (get_page_size() - 1)) == 0);
+    page_buffer_free(&buf);
+    CHECK(buf.addr == nullptr);
+
+    // THP is advice only: 2MB aligned and sized, reported as base pages
+    CHECK(page_buffer_alloc(3 << 20, MEM_PAGE_THP, &buf));
+    CHECK(buf.page_log == base_log && buf.size == (4UL << 20));
+    CHECK(((uintptr_t)buf.addr & ((1UL << HUGE_PAGE_2M_LOG) - 1)) == 0);
+    CHECK(((char*)buf.addr)[buf.size - 1] == 0);
+    page_buffer_free(&buf);
+
+    // hugetlbfs pool may be empty here: either 2MB pages or the THP fallback
+    CHECK(page_buffer_alloc(1, MEM_PAGE_HUGE_2M, &buf));
+    CHECK(buf.size == (2UL << 20));
+    CHECK(buf.mapped ? buf.page_log == HUGE_PAGE_2M_LOG : buf.page_log == base_log);
+    CHECK(((char*)buf.addr)[buf.size - 1] == 0);
+    page_buffer_free(&buf);
+
+    CHECK(page_buffer_alloc(1, MEM_PAGE_HUGE_1G, &buf));
+    CHECK(buf.page_log == HUGE_PAGE_1G_LOG || buf.size == (2UL << 20));
+    page_buffer_free(&buf);
+
+    // Lazy zero-fill: a fresh mapping, zero without a memset
+    CHECK(page_buffer_alloc(5000, MEM_PAGE_DEFAULT, &buf, MEM_ALLOC_LAZY_ZERO));
+    CHECK(buf.mapped && buf.size == tlx_align_up_pow2(5000, get_page_size()));
+    CHECK(((char*)buf.addr)[0] == 0 && ((char*)buf.addr)[buf.size - 1] == 0);
+    page_buffer_free(&buf);
+
+    CHECK(page_buffer_alloc(3 << 20, MEM_PAGE_THP, &buf,
+                            MEM_ALLOC_LAZY_ZERO | MEM_ALLOC_PREFAULT));
+    CHECK(buf.mapped && buf.size == (4UL << 20));
+    CHECK(((uintptr_t)buf.addr & ((1UL << HUGE_PAGE_2M_LOG) - 1)) == 0);
+    CHECK(((char*)buf.addr)[buf.size - 1] == 0);
+    page_buffer_free(&buf);
+
+    // Parallel prefault of a fresh mapping covers the ragged tail, still zero
+    const size_t big = 2 * MEM_PREFAULT_CHUNK + 3 * get_page_size();
+    CHECK(page_buffer_alloc(big, MEM_PAGE_DEFAULT, &buf, MEM_ALLOC_LAZY_ZERO));
+    page_buffer_prefault(buf.addr, buf.size, buf.page_log, 3);
+    page_buffer_prefault(buf.addr, buf.size, buf.page_log, 1);
+    CHECK(((char*)buf.addr)[MEM_PREFAULT_CHUNK + 1] == 0);
+    CHECK(((char*)buf.addr)[buf.size - 1] == 0);
+    page_buffer_free(&buf);
+}
+
+int main()
+{
+    test_cq_batch_poll();
+    test_cq_compressed();
+    test_cq_128b_scatter();
+    test_cq_waiter();
+    test_qp_doorbell_batching();
+    test_qp_sgl_wraparound();
+    test_qp_inline();
+    test_qp_umr();
+    test_qp_blueflame();
+    test_qp_wqe_template();
+    test_qp_selective_signaling();
+    test_qp_flow_control();
+    test_shared_cq();
+    test_shared_cq_wait();
+    test_qp_recv();
+    test_srq();
+    test_srq_striding();
+    test_srq_striding_dispatch();
+    test_mr_cache();
+    test_indirect_mkey_layout();
+    test_odp();
+    test_mr_pool();
+    test_page_buffer();
+
+    if (g_failures) {
+        log_error("%d host test check(s) failed", g_failures);
+        return STATUS_ERR;
+    }
+
+    printf("All host tests passed\n");
+    return STATUS_OK;
+}
@@ -176,6 +176,7 @@ enum {
 };
 
 enum mlx5_event {
+	MLX5_EVENT_TYPE_COMP = 0x00,
 	MLX5_EVENT_TYPE_CMD = 0x0a,
 	MLX5_EVENT_TYPE_PAGE_REQUEST = 0xb,
 };
@@ -3553,6 +3554,12 @@ enum {
 	MLX5_QPC_PM_STATE_MIGRATED  = 0x3,
 };
 
+enum {
+	MLX5_QPC_RQ_TYPE_REGULAR    = 0x0,
+	MLX5_QPC_RQ_TYPE_SRQ        = 0x1,
+	MLX5_QPC_RQ_TYPE_ZERO_SIZE  = 0x3,
+};
+
 struct mlx5_ifc_ud_av_bits {
 	u8         reserved_at_0[0x60];
 
@@ -5265,7 +5272,10 @@ struct mlx5_ifc_dealloc_transport_domain_in_bits {
 };
 
 struct mlx5_ifc_create_rmp_out_bits {
-	u8         reserved_at_0[0x40];
+	u8         status[0x8];
+	u8         reserved_at_8[0x18];
+
+	u8         syndrome[0x20];
 
 	u8         reserved_at_40[0x8];
 	u8         rmpn[0x18];
@@ -5482,6 +5492,96 @@ struct mlx5_ifc_delete_l2_table_entry_in_bits {
 	u8         reserved_at_c0[0x140];
 };
 
+enum {
+	MLX5_WQ_TYPE_LINKED_LIST    = 0x0,
+	MLX5_WQ_TYPE_CYCLIC         = 0x1,
+	MLX5_WQ_TYPE_LINKED_LIST_STRIDING_RQ = 0x2,
+};
+
+struct mlx5_ifc_wq_bits {
+	u8         wq_type[0x4];
+	u8         wq_signature[0x1];
+	u8         end_padding_mode[0x2];
+	u8         cd_slave[0x1];
+	u8         reserved_at_8[0x18];
+
+	u8         hds_skip_first_sge[0x1];
+	u8         log2_hds_buf_size[0x3];
+	u8         reserved_at_24[0x7];
+	u8         page_offset[0x5];
+	u8         lwm[0x10];
+
+	u8         reserved_at_40[0x8];
+	u8         pd[0x18];
+
+	u8         reserved_at_60[0x8];
+	u8         uar_page[0x18];
+
+	u8         dbr_addr[0x40];
+
+	u8         hw_counter[0x20];
+
+	u8         sw_counter[0x20];
+
+	u8         reserved_at_100[0xc];
+	u8         log_wq_stride[0x4];
+	u8         reserved_at_110[0x3];
+	u8         log_wq_pg_sz[0x5];
+	u8         reserved_at_118[0x3];
+	u8         log_wq_sz[0x5];
+
+	u8         dbr_umem_valid[0x1];
+	u8         wq_umem_valid[0x1];
+	u8         reserved_at_122[0x1];
+	u8         log_hairpin_num_packets[0x5];
+	u8         reserved_at_128[0x3];
+	u8         log_hairpin_data_sz[0x5];
+
+	u8         reserved_at_130[0x4];
+	u8         single_wqe_log_num_of_strides[0x4];
+	u8         two_byte_shift_en[0x1];
+	u8         reserved_at_139[0x4];
+	u8         single_stride_log_num_of_bytes[0x3];
+
+	u8         dbr_umem_id[0x20];
+
+	u8         wq_umem_id[0x20];
+
+	u8         wq_umem_offset[0x40];
+
+	u8         reserved_at_1c0[0x440];
+};
+
+enum {
+	MLX5_RMPC_STATE_RDY         = 0x1,
+	MLX5_RMPC_STATE_ERR         = 0x3,
+};
+
+struct mlx5_ifc_rmpc_bits {
+	u8         reserved_at_0[0x8];
+	u8         state[0x4];
+	u8         reserved_at_c[0x14];
+
+	u8         basic_cyclic_rcv_wqe[0x1];
+	u8         reserved_at_21[0x1f];
+
+	u8         reserved_at_40[0x140];
+
+	struct mlx5_ifc_wq_bits wq;
+};
+
+struct mlx5_ifc_create_rmp_in_bits {
+	u8         opcode[0x10];
+	u8         uid[0x10];
+
+	u8         reserved_at_20[0x10];
+	u8         op_mod[0x10];
+
+	u8         reserved_at_40[0xc0];
+
+	struct mlx5_ifc_rmpc_bits ctx;
+};
+
 struct mlx5_ifc_create_srq_out_bits {
 	u8         reserved_at_0[0x40];
 
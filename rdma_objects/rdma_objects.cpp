@@ -1,6 +1,9 @@
 #include "rdma_objects.h"
 #include <cstring>
 #include <poll.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <rdma/rdma_netlink.h>
 
 #include "../common/mmio.h"
 
@@ -112,14 +115,154 @@ rdma_device::query_hca_capabilities() {
     _hca_cap.log_max_xrq                  = DEVX_GET(cmd_hca_cap, hca_cap, log_max_xrq);
     _hca_cap.native_port_num              = DEVX_GET(cmd_hca_cap, hca_cap, native_port_num);
     _hca_cap.num_ports                    = DEVX_GET(cmd_hca_cap, hca_cap, num_ports);
+    _hca_cap.bf                           = DEVX_GET(cmd_hca_cap, hca_cap, bf);
+    _hca_cap.log_bf_reg_size              = DEVX_GET(cmd_hca_cap, hca_cap, log_bf_reg_size);
+    _hca_cap.cqe_compression              = DEVX_GET(cmd_hca_cap, hca_cap, cqe_compression);
+    _hca_cap.mini_cqe_resp_stride_index   = DEVX_GET(cmd_hca_cap, hca_cap, mini_cqe_resp_stride_index);
+    _hca_cap.umr_modify_atomic_disabled   = DEVX_GET(cmd_hca_cap, hca_cap, umr_modify_atomic_disabled);
     _hca_cap.max_wqe_sz_sq                = DEVX_GET(cmd_hca_cap, hca_cap, max_wqe_sz_sq);
 
+    ibv_device_attr_ex attr_ex = {};
+    if (ibv_query_device_ex(_context, nullptr, &attr_ex) == 0) {
+        _hca_cap.odp_general_caps = attr_ex.odp_caps.general_caps;
+        _hca_cap.odp_rc_caps      = attr_ex.odp_caps.per_transport_caps.rc_odp_caps;
+    } else {
+        _hca_cap.odp_general_caps = 0;
+        _hca_cap.odp_rc_caps      = 0;
+    }
+
     log_debug("HCA Capabilities successfully queried, log_max_qp_sz: %u", _hca_cap.log_max_qp_sz);
     log_debug("HCA log_max_cq_sz: %u, log_max_cq: %u", _hca_cap.log_max_cq_sz, _hca_cap.log_max_cq);
 
     return STATUS_OK;
 }
 
+template <typename F>
+static void
+nl_for_each_attr(const char* data, int len, F&& fn) {
+    while (len >= NLA_HDRLEN) {
+        const nlattr* attr = (const nlattr*)data;
+        if (attr->nla_len < NLA_HDRLEN || attr->nla_len > len) {
+            return;
+        }
+        fn(attr->nla_type & NLA_TYPE_MASK, data + NLA_HDRLEN, attr->nla_len - NLA_HDRLEN);
+        data += NLA_ALIGN(attr->nla_len);
+        len  -= NLA_ALIGN(attr->nla_len);
+    }
+}
+
+static void
+nl_put_u32(nlmsghdr* hdr, uint16_t type, uint32_t value) {
+    nlattr* attr = (nlattr*)((char*)hdr + NLMSG_ALIGN(hdr->nlmsg_len));
+    attr->nla_type = type;
+    attr->nla_len  = NLA_HDRLEN + sizeof(value);
+    memcpy((char*)attr + NLA_HDRLEN, &value, sizeof(value));
+    hdr->nlmsg_len = NLMSG_ALIGN(hdr->nlmsg_len) + NLA_ALIGN(attr->nla_len);
+}
+
+STATUS
+rdma_device::parse_odp_counters(const void* reply, size_t reply_len, odp_counters* counters, bool* done) {
+    int len = (int)reply_len;
+    for (const nlmsghdr* msg = (const nlmsghdr*)reply; NLMSG_OK(msg, len); msg = NLMSG_NEXT(msg, len)) {
+        if (msg->nlmsg_type == NLMSG_DONE) {
+            *done = true;
+            break;
+        }
+        if (msg->nlmsg_type == NLMSG_ERROR) {
+            const nlmsgerr* err = (const nlmsgerr*)NLMSG_DATA(msg);
+            log_info("RDMA netlink MR statistics unavailable: %s", strerror(-err->error));
+            *done = true;
+            return STATUS_NOT_IMPLEMENTED;
+        }
+
+        // RES_MR { RES_MR_ENTRY { STAT_HWCOUNTERS { HWCOUNTER_ENTRY { NAME, VALUE } } } }
+        nl_for_each_attr((const char*)NLMSG_DATA(msg), NLMSG_PAYLOAD(msg, 0),
+                         [&](int type, const char* mrs, int mrs_len) {
+            if (type != RDMA_NLDEV_ATTR_RES_MR) return;
+            nl_for_each_attr(mrs, mrs_len, [&](int, const char* mr, int mr_len) {
+                nl_for_each_attr(mr, mr_len, [&](int type, const char* hw, int hw_len) {
+                    if (type != RDMA_NLDEV_ATTR_STAT_HWCOUNTERS) return;
+                    nl_for_each_attr(hw, hw_len, [&](int, const char* entry, int entry_len) {
+                        const char* name = nullptr;
+                        uint64_t value = 0;
+                        nl_for_each_attr(entry, entry_len, [&](int type, const char* v, int) {
+                            if (type == RDMA_NLDEV_ATTR_STAT_HWCOUNTER_ENTRY_NAME) {
+                                name = v;
+                            } else if (type == RDMA_NLDEV_ATTR_STAT_HWCOUNTER_ENTRY_VALUE) {
+                                memcpy(&value, v, sizeof(value));
+                            }
+                        });
+                        if (!name) {
+                            return;
+                        }
+                        if (!strcmp(name, "page_faults")) {
+                            counters->page_faults += value;
+                        } else if (!strcmp(name, "page_invalidations")) {
+                            counters->page_invalidations += value;
+                        } else if (!strcmp(name, "page_prefetch")) {
+                            counters->page_prefetch += value;
+                        }
+                    });
+                });
+            });
+        });
+    }
+    return STATUS_OK;
+}
+
+STATUS
+rdma_device::query_odp_counters(odp_counters* counters) const {
+    int dev_index = ibv_get_device_index(_device);
+    if (dev_index < 0) {
+        return STATUS_NOT_IMPLEMENTED;
+    }
+
+    int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_RDMA);
+    if (fd < 0) {
+        log_error("Failed to open RDMA netlink socket: %s", strerror(errno));
+        return STATUS_ERR;
+    }
+
+    // Per-MR statistics dump; the driver attaches the ODP counters of each
+    // on-demand MR as hardware counter entries
+    alignas(nlmsghdr) char req[NLMSG_SPACE(2 * NLA_ALIGN(NLA_HDRLEN + 4))] = {};
+    nlmsghdr* hdr = (nlmsghdr*)req;
+    hdr->nlmsg_len   = NLMSG_LENGTH(0);
+    hdr->nlmsg_type  = RDMA_NL_GET_TYPE(RDMA_NL_NLDEV, RDMA_NLDEV_CMD_STAT_GET);
+    hdr->nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    hdr->nlmsg_seq   = 1;
+    nl_put_u32(hdr, RDMA_NLDEV_ATTR_DEV_INDEX, dev_index);
+    nl_put_u32(hdr, RDMA_NLDEV_ATTR_STAT_RES, RDMA_NLDEV_ATTR_RES_MR);
+
+    if (send(fd, req, hdr->nlmsg_len, 0) < 0) {
+        log_error("Failed to send RDMA netlink request: %s", strerror(errno));
+        close(fd);
+        return STATUS_ERR;
+    }
+
+    *counters = odp_counters();
+    STATUS status = STATUS_OK;
+    bool done = false;
+    std::vector<char> buf(1 << 16);
+
+    while (!done) {
+        ssize_t len = recv(fd, buf.data(), buf.size(), 0);
+        if (len < 0) {
+            log_error("Failed to read RDMA netlink reply: %s", strerror(errno));
+            status = STATUS_ERR;
+            break;
+        }
+
+        status = parse_odp_counters(buf.data(), len, counters, &done);
+        if (status != STATUS_OK) {
+            break;
+        }
+    }
+
+    close(fd);
+    return status;
+}
+
 STATUS rdma_device::initialize(const std::string& device_name) {
     _device_list = ibv_get_device_list(nullptr);
     if (!_device_list) {
@@ -417,6 +560,8 @@ user_memory::user_memory()
     , _size(0)
     , _umem_id(0)
     , _umem_buf(nullptr)
+    , _owns_buf(false)
+    , _page_log(0)
 {}
 
 void user_memory::destroy() {
@@ -426,11 +571,13 @@ void user_memory::destroy() {
         _umem = nullptr;
     }
 
-    if (_umem_buf) {
+    if (_umem_buf && _owns_buf) {
         log_debug("Freeing user memory address: %p", _umem_buf);  // Fixed: was using _umem instead of _umem_buf
-        free(_umem_buf);
-        _umem_buf = nullptr;
+        page_buffer_free(&_pages);
     }
+    _umem_buf = nullptr;
+    _owns_buf = false;
+    _page_log = 0;
 
     _umem_id = 0;
     _size = 0;
@@ -443,39 +590,95 @@ user_memory::~user_memory() {
 
 STATUS
 user_memory::initialize(ibv_context* context, size_t size) {
+    return initialize(context, size, MEM_PAGE_DEFAULT);
+}
+
+STATUS
+user_memory::initialize(ibv_context* context, size_t size, mem_page_policy policy,
+                        uint32_t alloc_flags) {
     if (_initialized) {
         return STATUS_OK;
     }
 
-    // Fix: don't redeclare _umem_buf as a local variable, update the class member directly
-    size_t allocated_size;
-    _umem_buf = aligned_alloc<char>(size, &allocated_size);
-    log_debug("Allocated user memory address: %p, size:%zu", _umem_buf, allocated_size);
-
-    if (!_umem_buf || allocated_size == 0) {
+    if (!page_buffer_alloc(size, policy, &_pages, alloc_flags) || _pages.size == 0) {
         return STATUS_ERR;
     }
+    _umem_buf = _pages.addr;
+    log_debug("Allocated user memory address: %p, size:%zu, page 2^%u",
+              _umem_buf, _pages.size, _pages.page_log);
 
     uint32_t access = IBV_ACCESS_LOCAL_WRITE
                     | IBV_ACCESS_REMOTE_WRITE
                     | IBV_ACCESS_REMOTE_READ;         
 
-    auto* reg = mlx5dv_devx_umem_reg(context, _umem_buf, allocated_size, access);
+    // Let the kernel build the umem MTT from pages as large as we hold
+    mlx5dv_devx_umem_in umem_in = {};
+    umem_in.addr        = _umem_buf;
+    umem_in.size        = _pages.size;
+    umem_in.access      = access;
+    umem_in.pgsz_bitmap = (1UL << (_pages.page_log + 1)) - 1;
+
+    auto* reg = mlx5dv_devx_umem_reg_ex(context, &umem_in);
+    if (!reg) {
+        // Older kernels: plain registration, base-page translation
+        reg = mlx5dv_devx_umem_reg(context, _umem_buf, _pages.size, access);
+        _pages.page_log = get_page_size_log();
+    }
     if (!reg) {
-        free(_umem_buf);
+        log_error("Failed to register user memory, error: %s", strerror(errno));
+        page_buffer_free(&_pages);
         _umem_buf = nullptr;
         return STATUS_ERR;
     }
 
-    _size = allocated_size;
+    _size = _pages.size;
+    _page_log = _pages.page_log;
     _umem = reg;
     _umem_id = reg->umem_id;
+    _owns_buf = true;
     _initialized = true;
 
     log_debug("User memory initialized with umem_id: %d", _umem_id);
     return STATUS_OK;
 }
 
+STATUS
+user_memory::register_buffer(ibv_context* context, void* buf, size_t size) {
+    if (_initialized) {
+        return STATUS_OK;
+    }
+    if (!buf || !size) {
+        return STATUS_INVALID_PARAM;
+    }
+
+    const uintptr_t page  = get_page_size();
+    const uintptr_t start = (uintptr_t)buf & ~(page - 1);
+    const uintptr_t end   = ((uintptr_t)buf + size + page - 1) & ~(page - 1);
+
+    uint32_t access = IBV_ACCESS_LOCAL_WRITE
+                    | IBV_ACCESS_REMOTE_WRITE
+                    | IBV_ACCESS_REMOTE_READ;
+
+    auto* reg = mlx5dv_devx_umem_reg(context, (void*)start, end - start, access);
+    if (!reg) {
+        log_error("Failed to register user buffer %p (%zu bytes), error: %s",
+                  buf, size, strerror(errno));
+        return STATUS_ERR;
+    }
+
+    _umem_buf = (void*)start;
+    _size = end - start;
+    _page_log = get_page_size_log();
+    _umem = reg;
+    _umem_id = reg->umem_id;
+    _owns_buf = false;
+    _initialized = true;
+
+    log_debug("User buffer %p registered as umem_id: %d (pages %p, %zu bytes)",
+              buf, _umem_id, _umem_buf, _size);
+    return STATUS_OK;
+}
+
 mlx5dv_devx_umem*
 user_memory::get() const {
     return _umem;
@@ -517,13 +720,11 @@ uar::destroy() {
 }
 
 STATUS
-uar::initialize(ibv_context* ctx) {
-    
-    uint32_t access = MLX5DV_UAR_ALLOC_TYPE_NC;
+uar::initialize(ibv_context* ctx, uint32_t alloc_type) {
 
-    log_debug("Using UAR access type: %u", access);
+    log_debug("Using UAR access type: %u", alloc_type);
     
-    _uar = mlx5dv_devx_alloc_uar(ctx, access);
+    _uar = mlx5dv_devx_alloc_uar(ctx, alloc_type);
     if (!_uar) {
         log_error("Failed to allocate UAR");
         return STATUS_ERR;
@@ -596,6 +797,7 @@ memory_key::get_rkey() const {
 //============================================================================
 memory_region::memory_region() :
     _cross_mr(nullptr),
+    _odp_mr(nullptr),
     _umem(nullptr),
     _qp(nullptr),
     _rdevice(nullptr),
@@ -607,7 +809,10 @@ memory_region::memory_region() :
     _mr_handle(0),
     _mr_pd(0),
     _mr_access(0),
-    _mr_flags(0)
+    _mr_flags(0),
+    _prefetch_calls(0),
+    _prefetch_bytes(0),
+    _prefetch_errors(0)
 {}
 
 memory_region::~memory_region() {
@@ -621,6 +826,12 @@ memory_region::destroy() {
         mlx5dv_devx_obj_destroy(_cross_mr);
     }
 
+    if (_odp_mr) {
+        log_debug("Deregistering ODP memory region with lkey: 0x%x", _lkey);
+        ibv_dereg_mr(_odp_mr);
+        _odp_mr = nullptr;
+    }
+
     if (_umem) {
         destroy_user_memory();
     }
@@ -632,7 +843,9 @@ memory_region::initialize(
     rdma_device* rdevice,
     queue_pair* qp,
     protection_domain* pd,
-    size_t length
+    size_t length,
+    mem_page_policy page_policy,
+    uint32_t alloc_flags
 ) {
     if (_cross_mr) {
         return STATUS_OK;
@@ -642,13 +855,50 @@ memory_region::initialize(
     _qp      = qp;
     _length  = length;
 
-    STATUS res = create_user_memory(rdevice, length);
+    STATUS res = create_user_memory(rdevice, length, page_policy, alloc_flags);
     RETURN_IF_FAILED(res);
 
+    return create_mkey(pd, 0);
+}
+
+STATUS
+memory_region::initialize(
+    rdma_device* rdevice,
+    queue_pair* qp,
+    protection_domain* pd,
+    void* addr,
+    size_t length
+) {
+    if (_cross_mr) {
+        return STATUS_OK;
+    }
+    if (!addr || !length) {
+        return STATUS_INVALID_PARAM;
+    }
+
+    _rdevice = rdevice;
+    _qp      = qp;
+
+    _umem = new user_memory();
+    STATUS res = _umem->register_buffer(rdevice->get_context(), addr, length);
+    if (FAILED(res)) {
+        destroy_user_memory();
+        return res;
+    }
+
+    _addr   = addr;
+    _length = length;
+    return create_mkey(pd, (uintptr_t)addr - (uintptr_t)_umem->addr());
+}
+
+STATUS
+memory_region::create_mkey(protection_domain* pd, size_t umem_offset) {
     // Print all fields for debugging
     log_debug("Registering memory region with these parameters:");
     log_debug("  addr: %p", _addr);
     log_debug("  size: %zu", _length);
+    log_debug("  umem offset: %zu", umem_offset);
+    log_debug("  page size: 2^%u", _umem->page_size_log());
 
 
     uint32_t mkey_in[DEVX_ST_SZ_DW(create_mkey_in)] = {0};
@@ -657,7 +907,7 @@ memory_region::initialize(
     DEVX_SET(create_mkey_in, mkey_in, opcode, MLX5_CMD_OP_CREATE_MKEY);
     DEVX_SET(create_mkey_in, mkey_in, mkey_umem_valid, 1);
     DEVX_SET(create_mkey_in, mkey_in, mkey_umem_id, _umem->get()->umem_id);
-    DEVX_SET(create_mkey_in, mkey_in, mkey_umem_offset, 0);
+    DEVX_SET64(create_mkey_in, mkey_in, mkey_umem_offset, umem_offset);
     DEVX_SET(create_mkey_in, mkey_in, translations_octword_actual_size, 8);
 
     void *mkc = DEVX_ADDR_OF(create_mkey_in, mkey_in, memory_key_mkey_entry);
@@ -671,12 +921,12 @@ memory_region::initialize(
     DEVX_SET(mkc, mkc, qpn, 0xFFFFFF);    
     DEVX_SET(mkc, mkc, mkey_7_0, 0xef);
     DEVX_SET64(mkc, mkc, start_addr, (intptr_t)_addr);
-    DEVX_SET64(mkc, mkc, len, length);
+    DEVX_SET64(mkc, mkc, len, _length);
     DEVX_SET(mkc, mkc, translations_octword_size, 8);
-    DEVX_SET(mkc, mkc, log_page_size, get_page_size_log());
+    DEVX_SET(mkc, mkc, log_page_size, _umem->page_size_log());
 
     // Create the MKEY object
-    _cross_mr = mlx5dv_devx_obj_create(rdevice->get_context(),
+    _cross_mr = mlx5dv_devx_obj_create(_rdevice->get_context(),
                                        mkey_in, sizeof(mkey_in), 
                                        mkey_out, sizeof(mkey_out));
     if (!_cross_mr) {
@@ -743,257 +993,1754 @@ memory_region::get_mr_flags() const {
     return _mr_flags;
 }
 
+STATUS
+memory_region::attach_mkey(void* addr, size_t length, uint32_t lkey, uint32_t rkey) {
+    if (_cross_mr || _odp_mr || _umem) {
+        return STATUS_INVALID_STATE;
+    }
+    if (!addr || !length) {
+        return STATUS_INVALID_PARAM;
+    }
+
+    _addr   = addr;
+    _length = length;
+    _lkey   = lkey;
+    _rkey   = rkey;
+    return STATUS_OK;
+}
+
+STATUS
+memory_region::initialize_odp(rdma_device* rdevice, protection_domain* pd,
+                              void* addr, size_t length) {
+    if (_cross_mr || _odp_mr) {
+        return STATUS_OK;
+    }
+    if (!rdevice || !pd || (!addr != !length)) {
+        return STATUS_INVALID_PARAM;
+    }
+
+    const hca_capabilities& caps = rdevice->get_hca_cap();
+    uint32_t rc_needed = IBV_ODP_SUPPORT_SEND | IBV_ODP_SUPPORT_RECV |
+                         IBV_ODP_SUPPORT_WRITE | IBV_ODP_SUPPORT_READ;
+    if (!(caps.odp_general_caps & IBV_ODP_SUPPORT) ||
+        (caps.odp_rc_caps & rc_needed) != rc_needed) {
+        log_error("Device does not support ODP for RC (general 0x%lx, rc 0x%x)",
+                  caps.odp_general_caps, caps.odp_rc_caps);
+        return STATUS_NOT_IMPLEMENTED;
+    }
+    if (!addr && !(caps.odp_general_caps & IBV_ODP_SUPPORT_IMPLICIT)) {
+        log_error("Device does not support implicit ODP");
+        return STATUS_NOT_IMPLEMENTED;
+    }
+
+    int access = IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE |
+                 IBV_ACCESS_REMOTE_READ | IBV_ACCESS_ON_DEMAND;
+    if (caps.odp_rc_caps & IBV_ODP_SUPPORT_ATOMIC) {
+        access |= IBV_ACCESS_REMOTE_ATOMIC;
+    }
+
+    // Implicit ODP is requested as the whole address space from 0
+    _odp_mr = ibv_reg_mr(pd->get(), addr, addr ? length : SIZE_MAX, access);
+    if (!_odp_mr) {
+        log_error("Failed to register %s ODP memory region, error: %s",
+                  addr ? "explicit" : "implicit", strerror(errno));
+        return STATUS_ERR;
+    }
+
+    _rdevice   = rdevice;
+    _addr      = addr;
+    _length    = addr ? length : SIZE_MAX;
+    _lkey      = _odp_mr->lkey;
+    _rkey      = _odp_mr->rkey;
+    _mr_access = access;
+    _mr_id     = _lkey >> 8;
+
+    log_debug("Registered %s ODP memory region %p (%zu bytes), lkey: 0x%x",
+              addr ? "explicit" : "implicit", addr, length, _lkey);
+    return STATUS_OK;
+}
+
+STATUS
+memory_region::prefetch(void* addr, size_t length, bool write, bool sync) {
+    if (!_odp_mr) {
+        return STATUS_INVALID_OPERATION;
+    }
+    if (!addr || !length) {
+        return STATUS_INVALID_PARAM;
+    }
+    if (_addr && ((char*)addr < (char*)_addr ||
+                  (char*)addr + length > (char*)_addr + _length)) {
+        return STATUS_INVALID_ADDRESS;
+    }
+
+    const ibv_advise_mr_advice advice = write ? IBV_ADVISE_MR_ADVICE_PREFETCH_WRITE
+                                              : IBV_ADVISE_MR_ADVICE_PREFETCH;
+    const uint32_t flags = sync ? IBV_ADVISE_MR_FLAG_FLUSH : 0;
+
+    // An SGE carries 32 bits of length; advise in 1GB pieces
+    const size_t chunk = 1UL << 30;
+    for (size_t off = 0; off < length; off += chunk) {
+        ibv_sge sge;
+        sge.addr   = (uintptr_t)addr + off;
+        sge.length = std::min(chunk, length - off);
+        sge.lkey   = _lkey;
+
+        int ret = ibv_advise_mr(_odp_mr->pd, advice, flags, &sge, 1);
+        if (ret) {
+            _prefetch_errors++;
+            log_error("ODP prefetch of %p (+%u) failed: %s", (void*)sge.addr, sge.length, strerror(ret));
+            return STATUS_ERR;
+        }
+    }
+
+    _prefetch_calls++;
+    _prefetch_bytes += length;
+    return STATUS_OK;
+}
+
 //============================================================================
-// Completion DEVX Queue Implementation
+// Indirect Mkey Implementation
 //============================================================================
 
-completion_queue_devx::completion_queue_devx() :
-    _cq(nullptr),
-    _cqn(0),
-    _consumer_index(0)
+indirect_mkey::indirect_mkey()
+    : _mkey(nullptr)
+    , _lkey(0)
+    , _max_entries(0)
 {}
 
-completion_queue_devx::~completion_queue_devx() {
+indirect_mkey::~indirect_mkey() {
     destroy();
 }
 
 void
-completion_queue_devx::set_cq_hw_params(cq_hw_params& params) {
-    // Store the provided parameters
-    _cq_hw_params = params;
-    
-    // Log the parameters for debugging purposes
-    log_debug("Setting CQ hardware parameters:");
-    log_debug("  log_cq_size: %u", params.log_cq_size);
-    log_debug("  log_page_size: %u", params.log_page_size);
-    log_debug("  cqe_sz: %u", params.cqe_sz);
-    log_debug("  cqe_comp_en: %s", params.cqe_comp_en ? "true" : "false");
-    log_debug("  cq_period_mode: %u", params.cq_period_mode);
-    log_debug("  cq_period: %u", params.cq_period);
-    log_debug("  cq_max_count: %u", params.cq_max_count);
-}
-
-cq_hw_params
-completion_queue_devx::get_cq_hw_params() const {
-    return _cq_hw_params;
+indirect_mkey::destroy() {
+    if (_mkey) {
+        log_debug("Destroying indirect mkey 0x%x", _lkey);
+        mlx5dv_devx_obj_destroy(_mkey);
+        _mkey = nullptr;
+    }
+    _lkey = 0;
+    _max_entries = 0;
+    _layout = mkey_layout();
 }
 
 STATUS
-completion_queue_devx::initialize_cq_resources(
-    rdma_device* rdevice,
-    cq_hw_params& cq_hw_params
-) {
-    _rdevice = rdevice;
-
-    const hca_capabilities& caps = rdevice->get_hca_cap();
-    uint8_t max_log_cq_size = caps.log_max_cq_sz;
-
-    _uar->initialize(rdevice->get_context());
-    if (_uar->get() == nullptr) {
-        log_error("Failed to initialize UAR");
-        return STATUS_ERR;
-    }
+indirect_mkey::build_layout(const mkey_segment* segs, size_t num_segs,
+                            uint32_t max_entries, mkey_layout* layout,
+                            uint8_t access_mode) {
+    if (!segs || !num_segs) {
+        return STATUS_INVALID_PARAM;
+    }
+    if (num_segs > max_entries) {
+        log_error("%zu segments exceed the KLM list limit of %u", num_segs, max_entries);
+        return STATUS_INVALID_SIZE;
+    }
+
+    bool ksm = (segs[0].length & (segs[0].length - 1)) == 0;
+    for (size_t i = 0; i < num_segs; ++i) {
+        const mkey_segment& seg = segs[i];
+        if (!seg.mr || !seg.length || seg.length > MLX5_KLM_MAX_BYTE_COUNT ||
+            seg.offset + seg.length > seg.mr->get_length()) {
+            log_error("Segment %zu [%zu, +%zu) is not inside its memory region",
+                      i, seg.offset, seg.length);
+            return STATUS_INVALID_PARAM;
+        }
 
-    _umem_db->initialize(rdevice->get_context(), 1024);
-    if (_umem_db->get() == nullptr) {
-        log_error("Failed to initialize user memory for DB");
-        return STATUS_ERR;
+        uintptr_t addr = (uintptr_t)seg.mr->get_addr() + seg.offset;
+        ksm &= (seg.length == segs[0].length) && !(addr & (seg.length - 1));
     }
 
-    if (cq_hw_params.log_cq_size == 0 || 
-        cq_hw_params.log_cq_size > max_log_cq_size) {
-        cq_hw_params.log_cq_size = 9;
+    if (access_mode == MLX5_MKC_ACCESS_MODE_KSM && !ksm) {
+        log_error("Segments of unequal, non power-of-two or unaligned length can't be KSM");
+        return STATUS_INVALID_OPERATION;
     }
-    
-    const size_t cqe_size = 64;
-    uint32_t cq_entries = 1U << cq_hw_params.log_cq_size;
-
-    log_debug("Allocating user memory for CQ: %u entries (%u bytes per entry),%zu bytes total (log_cq_size=%u)",
-              cq_entries,
-              cqe_size,
-              cq_entries * cqe_size,
-              cq_hw_params.log_cq_size);
-    
-    _umem->initialize(rdevice->get_context(), cq_entries * cqe_size);
-    if (_umem->get() == nullptr) {
-        log_error("Failed to initialize user memory for CQ");
-        return STATUS_ERR;
+    if (access_mode == MLX5_MKC_ACCESS_MODE_KLMS) {
+        ksm = false;
+    } else if (access_mode != MLX5_MKC_ACCESS_MODE_KSM && access_mode != MKEY_ACCESS_MODE_AUTO) {
+        return STATUS_INVALID_PARAM;
     }
 
-    void* cqe_buffer = _umem->get_umem_buf();
-    if (!cqe_buffer) {
-        log_error("Failed to get CQE buffer");
-        return STATUS_ERR;
-    }
+    layout->access_mode     = ksm ? MLX5_MKC_ACCESS_MODE_KSM : MLX5_MKC_ACCESS_MODE_KLMS;
+    layout->log_entity_size = ksm ? ilog2(segs[0].length) : 0;
+    layout->length          = 0;
+    layout->entries.resize(num_segs);
 
-    memset(cqe_buffer, 0, cq_entries * cqe_size);
-    uint32_t cq_mask = cq_entries - 1;
-    for (size_t i = 0; i < cq_entries; ++i) {
-        struct mlx5_cqe64* cqe = (struct mlx5_cqe64*)((char*)cqe_buffer + i * cqe_size);
-        uint8_t owner = ((i & (cq_mask + 1)) ? 1 : 0);
-        cqe->op_own = (MLX5_CQE_INVALID << 4) | owner;
+    for (size_t i = 0; i < num_segs; ++i) {
+        mlx5_wqe_umr_klm_seg& klm = layout->entries[i];
+        klm.byte_count = ksm ? 0 : htobe32(segs[i].length);
+        klm.mkey       = htobe32(segs[i].mr->get_lkey());
+        klm.address    = htobe64((uintptr_t)segs[i].mr->get_addr() + segs[i].offset);
+        layout->length += segs[i].length;
     }
 
-    log_debug("CQE buffer initialized with op_own and correct owner bits");
     return STATUS_OK;
 }
 
 STATUS
-completion_queue_devx::initialize(
-    rdma_device* rdevice,
-    cq_hw_params& cq_hw_params_list
-) {
-    STATUS status = initialize_cq_resources(rdevice, cq_hw_params_list);
-    RETURN_IF_FAILED(status);
+indirect_mkey::initialize(rdma_device* rdevice, protection_domain* pd,
+                          const mkey_segment* segs, size_t num_segs,
+                          uint32_t max_entries, uint8_t access_mode) {
+    if (_mkey) {
+        return STATUS_OK;
+    }
+    if (!rdevice || !pd) {
+        return STATUS_INVALID_PARAM;
+    }
 
-    uint32_t eqn = 0;
-    if (mlx5dv_devx_query_eqn(rdevice->get_context(), 0, &eqn)) {
-        log_error("Failed to query EQN");
-        return STATUS_ERR;
+    uint32_t list_limit = 1U << rdevice->get_hca_cap().log_max_klm_list_size;
+    if (max_entries < num_segs) {
+        max_entries = num_segs;
+    }
+    if (max_entries > list_limit) {
+        log_error("%u entries exceed the KLM list limit of %u", max_entries, list_limit);
+        return STATUS_INVALID_SIZE;
     }
 
-    // Initialize with zeros
-    uint32_t in[DEVX_ST_SZ_DW(create_cq_in)]  = {0};
-    uint32_t out[DEVX_ST_SZ_DW(create_cq_out)] = {0};
+    STATUS res = build_layout(segs, num_segs, max_entries, &_layout, access_mode);
+    RETURN_IF_FAILED(res);
 
-    DEVX_SET(create_cq_in, in, opcode, MLX5_CMD_OP_CREATE_CQ);
-    void* cq_context = DEVX_ADDR_OF(create_cq_in, in, cqc);
+    // The translation list follows the command, in octwords padded to 4;
+    // the mkey keeps room for max_entries of them
+    const uint32_t num_entries = _layout.entries.size();
+    const uint32_t octwords = tlx_align_up_pow2(max_entries, 4U);
+    std::vector<uint32_t> mkey_in((DEVX_ST_SZ_BYTES(create_mkey_in) +
+                                   octwords * sizeof(mlx5_wqe_umr_klm_seg)) / sizeof(uint32_t));
+    uint32_t mkey_out[DEVX_ST_SZ_DW(create_mkey_out)] = {0};
 
-    DEVX_SET(cqc, cq_context, c_eqn, eqn);
-    DEVX_SET(cqc, cq_context, uar_page, _uar->get()->page_id);
-    DEVX_SET(cqc, cq_context, log_cq_size, cq_hw_params_list.log_cq_size);
+    DEVX_SET(create_mkey_in, mkey_in.data(), opcode, MLX5_CMD_OP_CREATE_MKEY);
+    DEVX_SET(create_mkey_in, mkey_in.data(), translations_octword_actual_size, num_entries);
+
+    void *mkc = DEVX_ADDR_OF(create_mkey_in, mkey_in.data(), memory_key_mkey_entry);
+    DEVX_SET(mkc, mkc, access_mode_1_0, _layout.access_mode & 0x3);
+    DEVX_SET(mkc, mkc, access_mode_4_2, _layout.access_mode >> 2);
+    DEVX_SET(mkc, mkc, umr_en, 1);
+    DEVX_SET(mkc, mkc, a, 1);
+    DEVX_SET(mkc, mkc, rw, 1);
+    DEVX_SET(mkc, mkc, rr, 1);
+    DEVX_SET(mkc, mkc, lw, 1);
+    DEVX_SET(mkc, mkc, lr, 1);
+    DEVX_SET(mkc, mkc, pd, pd->get_pdn());
+    DEVX_SET(mkc, mkc, qpn, 0xFFFFFF);
+    DEVX_SET(mkc, mkc, mkey_7_0, 0xef);
+    DEVX_SET64(mkc, mkc, start_addr, 0);
+    DEVX_SET64(mkc, mkc, len, _layout.length);
+    DEVX_SET(mkc, mkc, translations_octword_size, octwords);
+    DEVX_SET(mkc, mkc, log_page_size, _layout.log_entity_size);
 
-    DEVX_SET(cqc, cq_context, cqe_sz, cq_hw_params_list.cqe_sz);
-    DEVX_SET(cqc, cq_context, cqe_comp_en, cq_hw_params_list.cqe_comp_en);
-    DEVX_SET(cqc, cq_context, cq_period_mode, cq_hw_params_list.cq_period_mode);
-    DEVX_SET(cqc, cq_context, cq_period, cq_hw_params_list.cq_period);
-    
-    DEVX_SET(cqc, cq_context, dbr_umem_valid, 1);
-    DEVX_SET(cqc, cq_context, dbr_umem_id, _umem_db->get()->umem_id);
-    
-    DEVX_SET(create_cq_in, in, cq_umem_valid, 1);
-    DEVX_SET(create_cq_in, in, cq_umem_id, _umem->get()->umem_id);
-    DEVX_SET(create_cq_in, in, cq_umem_offset, 0);
-    
-    log_debug("Creating CQ with parameters:");
-    log_debug("  log_cq_size: %u", cq_hw_params_list.log_cq_size);
-    log_debug("  cqe_sz: 0 (64 bytes)");
-    log_debug("  eqn: %u", eqn);
-    log_debug("  uar_page: %u", _uar->get()->page_id);
-    log_debug("  umem_id: %u", _umem->get()->umem_id);
-    log_debug("  dbr_umem_id: %u", _umem_db->get()->umem_id);
+    memcpy(DEVX_ADDR_OF(create_mkey_in, mkey_in.data(), klm_pas_mtt),
+           _layout.entries.data(), num_entries * sizeof(mlx5_wqe_umr_klm_seg));
 
-    _cq = mlx5dv_devx_obj_create(_rdevice->get_context(), in, sizeof(in), out, sizeof(out));
-    if (!_cq) {
-        log_error("Failed to create completion queue, error: %d (%s)", errno, strerror(errno));
-        log_error("Syndrome: 0x%x", DEVX_GET(create_cq_out, out, syndrome));
+    _mkey = mlx5dv_devx_obj_create(rdevice->get_context(),
+                                   mkey_in.data(), mkey_in.size() * sizeof(uint32_t),
+                                   mkey_out, sizeof(mkey_out));
+    if (!_mkey) {
+        log_error("Failed to create indirect mkey, error: %s, syndrome: 0x%x",
+                  strerror(errno), DEVX_GET(create_mkey_out, mkey_out, syndrome));
+        _layout = mkey_layout();
         return STATUS_ERR;
     }
 
-    _cqn = DEVX_GET(create_cq_out, out, cqn);
-    log_debug("Created completion queue with cqn: %d", _cqn);
+    _lkey = (DEVX_GET(create_mkey_out, mkey_out, mkey_index) << 8) | 0xef;
+    _max_entries = octwords;
+    log_debug("Created %s mkey 0x%x: %u entries, %lu bytes",
+              _layout.access_mode == MLX5_MKC_ACCESS_MODE_KSM ? "KSM" : "KLM",
+              _lkey, num_entries, _layout.length);
+    return STATUS_OK;
+}
 
+STATUS
+indirect_mkey::check_update(const mkey_layout& from, const mkey_layout& to) {
+    if (to.access_mode != from.access_mode) {
+        log_error("Layout is %s, the new segments need %s",
+                  from.access_mode == MLX5_MKC_ACCESS_MODE_KSM ? "KSM" : "KLM",
+                  to.access_mode == MLX5_MKC_ACCESS_MODE_KSM ? "KSM" : "KLM");
+        return STATUS_INVALID_OPERATION;
+    }
+    if (to.log_entity_size != from.log_entity_size) {
+        log_error("KSM entity size is 2^%u, the new segments need 2^%u",
+                  from.log_entity_size, to.log_entity_size);
+        return STATUS_INVALID_OPERATION;
+    }
     return STATUS_OK;
 }
 
 STATUS
-completion_queue_devx::poll_cq() {
-    if (!_umem || !_umem_db) return STATUS_ERR;
-    void* cqe_buf = _umem->addr();
-    if (!cqe_buf) return STATUS_ERR;
-
-    uint32_t cqe_cnt = 1U << _cq_hw_params.log_cq_size;
-    uint32_t ci = _consumer_index % cqe_cnt;
-    volatile struct mlx5_cqe64* cqe = 
-            (volatile struct mlx5_cqe64*)((char*)cqe_buf + ci * sizeof(struct mlx5_cqe64));
-
-    uint8_t owner = mlx5dv_get_cqe_owner((struct mlx5_cqe64*)cqe);
-    uint8_t expected_owner = (_consumer_index / cqe_cnt) & 0x1;
-    uint8_t opcode = mlx5dv_get_cqe_opcode((struct mlx5_cqe64*)cqe);
-    uint8_t se = mlx5dv_get_cqe_se((struct mlx5_cqe64*)cqe);
-    uint8_t format = mlx5dv_get_cqe_format((struct mlx5_cqe64*)cqe);
-
-    log_debug("[DEVX CQ poll] ci=%u owner=%u expected_owner=%u opcode=0x%x se=%u format=%u wqe_counter=%u byte_cnt=%u",
-              ci, owner, expected_owner, opcode, se, format, cqe->wqe_counter, cqe->byte_cnt);
-
-    if (owner == expected_owner && (opcode != 0x0)) {
-        const volatile struct mlx5_err_cqe* err_cqe = (const volatile struct mlx5_err_cqe*)cqe;
-        log_error("CQE error: opcode=0x%x", opcode);
-        log_error("  syndrome=0x%x", err_cqe->syndrome);
-        log_error("  vendor_err_synd=0x%x", err_cqe->vendor_err_synd);
-        log_error("  wqe_counter=0x%x", err_cqe->wqe_counter);
-        log_error("  s_wqe_opcode_qpn=0x%x", err_cqe->s_wqe_opcode_qpn);
-        log_error("  signature=0x%x", err_cqe->signature);
-        log_error("  op_own=0x%x", err_cqe->op_own);
-        log_error("  srqn=0x%x", err_cqe->srqn);
-        _consumer_index++;
-        volatile uint32_t* dbrec = (volatile uint32_t*)_umem_db->addr();
-        *dbrec = htobe32(_consumer_index & 0xffffff);
-        __sync_synchronize();
-        return STATUS_ERR;
+indirect_mkey::update(queue_pair* qp, const mkey_segment* segs, size_t num_segs,
+                      uint32_t access, uint32_t flags) {
+    if (!_mkey || !qp) {
+        return STATUS_INVALID_STATE;
     }
 
-    if (owner == expected_owner && opcode == 0x0) {
-        log_debug("DEVX CQE received: opcode=%u, wqe_counter=%u, byte_cnt=%u, timestamp=%llu",
-                  opcode, cqe->wqe_counter, cqe->byte_cnt, cqe->timestamp);
-        _consumer_index++;
-        volatile uint32_t* dbrec = (volatile uint32_t*)_umem_db->addr();
-        *dbrec = htobe32(_consumer_index & 0xffffff);
-        __sync_synchronize();
-        return STATUS_OK;
+    mkey_layout layout;
+    STATUS res = build_layout(segs, num_segs, _max_entries, &layout, _layout.access_mode);
+    if (FAILED(res)) {
+        log_error("Mkey 0x%x can't be re-pointed at these segments", _lkey);
+        return res;
+    }
+    res = check_update(_layout, layout);
+    if (FAILED(res)) {
+        log_error("Mkey 0x%x can't be re-pointed at these segments", _lkey);
+        return res;
+    }
+
+    res = qp->post_umr(_lkey, layout, access, flags);
+    if (FAILED(res)) {
+        return res;
     }
 
-    return STATUS_ERR;
+    _layout = std::move(layout);
+    return STATUS_OK;
 }
 
-#define MLX5_CQ_ARM_DB 0x1
+//============================================================================
+// Registration Cache Implementation
+//============================================================================
+
+mr_cache::mr_cache() :
+    _ops(),
+    _bytes(0),
+    _hits(0),
+    _misses(0),
+    _evictions(0)
+{}
+
+mr_cache::~mr_cache() {
+    destroy();
+}
+
+STATUS
+mr_cache::initialize(const mr_cache_ops& ops, const mr_cache_params& params) {
+    if (!ops.reg || !ops.dereg) {
+        return STATUS_INVALID_PARAM;
+    }
+
+    _ops    = ops;
+    _params = params;
+    if (!_params.alignment) {
+        _params.alignment = get_page_size();
+    }
+    if (_params.alignment & (_params.alignment - 1)) {
+        log_error("Registration cache alignment %zu is not a power of two", _params.alignment);
+        return STATUS_INVALID_ALIGNMENT;
+    }
+    return STATUS_OK;
+}
+
+mr_cache_entry*
+mr_cache::lookup(uintptr_t start, uintptr_t end) const {
+    auto it = _index.upper_bound(start);
+    if (it == _index.begin()) {
+        return nullptr;
+    }
+    mr_cache_entry* entry = std::prev(it)->second;
+    return end <= entry->start + entry->length ? entry : nullptr;
+}
+
+void
+mr_cache::unindex(mr_cache_entry* entry) {
+    _index.erase(entry->start);
+    entry->indexed = false;
+    if (!entry->refcount) {
+        _lru.erase(entry->lru);
+        release(entry);
+        return;
+    }
+    // Still referenced: kept for destroy() until its last put()
+    _retired.push_front(entry);
+    entry->lru = _retired.begin();
+}
+
+void
+mr_cache::release(mr_cache_entry* entry) {
+    _ops.dereg(_ops.ctx, entry->handle);
+    _bytes -= entry->length;
+    delete entry;
+}
+
+bool
+mr_cache::evict_for(size_t length) {
+    while (_bytes + length > _params.max_bytes && !_lru.empty()) {
+        mr_cache_entry* victim = _lru.back();
+        log_debug("Evicting registration [0x%lx, +%zu)", victim->start, victim->length);
+        unindex(victim);
+        _evictions++;
+    }
+    return _bytes + length <= _params.max_bytes;
+}
+
+STATUS
+mr_cache::get(void* addr, size_t length, mr_cache_entry** entry) {
+    if (!_ops.reg || !addr || !length || !entry) {
+        return STATUS_INVALID_PARAM;
+    }
+
+    uintptr_t start = (uintptr_t)addr & ~(_params.alignment - 1);
+    uintptr_t end   = ((uintptr_t)addr + length + _params.alignment - 1) & ~(_params.alignment - 1);
+
+    mr_cache_entry* hit = lookup((uintptr_t)addr, (uintptr_t)addr + length);
+    if (hit) {
+        if (!hit->refcount++) {
+            _lru.erase(hit->lru);
+        }
+        _hits++;
+        *entry = hit;
+        return STATUS_OK;
+    }
+    _misses++;
+
+    // Grow the range over every cached entry it touches. They are retired only
+    // once the union is registered, so a failure leaves the cache as it was.
+    auto it = _index.upper_bound(start);
+    if (it != _index.begin()) {
+        --it;
+    }
+    std::vector<mr_cache_entry*> overlapped;
+    for (; it != _index.end() && it->first < end; ++it) {
+        mr_cache_entry* e = it->second;
+        if (e->start + e->length <= start) {
+            continue;
+        }
+        start = std::min(start, e->start);
+        end   = std::max(end, e->start + e->length);
+        overlapped.push_back(e);
+    }
+
+    // Pin them so eviction passes them over; the unreferenced ones count
+    // toward the budget as bytes the union gives back
+    size_t reclaimed = 0;
+    for (mr_cache_entry* o : overlapped) {
+        if (!o->refcount++) {
+            _lru.erase(o->lru);
+            reclaimed += o->length;
+        }
+    }
+    auto unpin = [this, &overlapped]() {
+        for (mr_cache_entry* o : overlapped) {
+            put(o);
+        }
+    };
+
+    const size_t length_needed = end - start;
+    if (!evict_for(length_needed > reclaimed ? length_needed - reclaimed : 0)) {
+        log_error("Registration of %zu bytes exceeds the cache budget (%zu of %zu in use)",
+                  length_needed, _bytes, _params.max_bytes);
+        unpin();
+        return STATUS_NO_MEM;
+    }
+
+    mr_cache_entry* e = new mr_cache_entry();
+    e->start  = start;
+    e->length = length_needed;
+    STATUS res = _ops.reg(_ops.ctx, (void*)start, e->length, &e->lkey, &e->rkey, &e->handle);
+    if (FAILED(res)) {
+        delete e;
+        unpin();
+        return res;
+    }
+
+    unpin();
+    for (mr_cache_entry* o : overlapped) {
+        unindex(o);
+    }
+
+    e->refcount = 1;
+    e->indexed  = true;
+    _index[start] = e;
+    _bytes += e->length;
+    *entry = e;
+    return STATUS_OK;
+}
+
+void
+mr_cache::put(mr_cache_entry* entry) {
+    if (!entry || !entry->refcount) {
+        return;
+    }
+    if (--entry->refcount) {
+        return;
+    }
+
+    if (!entry->indexed) {
+        _retired.erase(entry->lru);
+        release(entry);
+        return;
+    }
+    _lru.push_front(entry);
+    entry->lru = _lru.begin();
+}
+
+void
+mr_cache::invalidate(void* addr, size_t length) {
+    uintptr_t start = (uintptr_t)addr;
+    uintptr_t end   = start + length;
+
+    auto it = _index.upper_bound(start);
+    if (it != _index.begin()) {
+        --it;
+    }
+    std::vector<mr_cache_entry*> stale;
+    for (; it != _index.end() && it->first < end; ++it) {
+        if (it->second->start + it->second->length > start) {
+            stale.push_back(it->second);
+        }
+    }
+    for (mr_cache_entry* e : stale) {
+        unindex(e);
+    }
+}
+
+void
+mr_cache::destroy() {
+    // Outstanding references die with the cache; callers must not put() them after this
+    for (auto& kv : _index) {
+        mr_cache_entry* e = kv.second;
+        _ops.dereg(_ops.ctx, e->handle);
+        delete e;
+    }
+    for (mr_cache_entry* e : _retired) {
+        _ops.dereg(_ops.ctx, e->handle);
+        delete e;
+    }
+    _index.clear();
+    _lru.clear();
+    _retired.clear();
+    _bytes = 0;
+}
+
+STATUS
+mr_region_registrar::reg(void* ctx, void* addr, size_t length,
+                         uint32_t* lkey, uint32_t* rkey, void** handle) {
+    mr_region_registrar* self = static_cast<mr_region_registrar*>(ctx);
+    memory_region* mr = new memory_region();
+    STATUS res = mr->initialize(self->rdevice, nullptr, self->pd, addr, length);
+    if (FAILED(res)) {
+        delete mr;
+        return res;
+    }
+
+    *lkey   = mr->get_lkey();
+    *rkey   = mr->get_rkey();
+    *handle = mr;
+    return STATUS_OK;
+}
+
+void
+mr_region_registrar::dereg(void* ctx, void* handle) {
+    (void)ctx;
+    delete static_cast<memory_region*>(handle);
+}
+
+//============================================================================
+// Registered Memory Pool Implementation
+//============================================================================
+
+mr_pool::mr_pool()
+    : _mr(nullptr)
+    , _base(nullptr)
+    , _length(0)
+    , _lkey(0)
+    , _rkey(0)
+    , _num_slabs(0)
+    , _next_slab(0)
+{
+    memset(_classes, 0, sizeof(_classes));
+}
+
+mr_pool::~mr_pool() {
+    destroy();
+}
+
+void
+mr_pool::destroy() {
+    if (_mr) {
+        delete _mr;
+        _mr = nullptr;
+    }
+
+    _slab_class.clear();
+    memset(_classes, 0, sizeof(_classes));
+    _base = nullptr;
+    _length = 0;
+    _num_slabs = 0;
+    _next_slab = 0;
+    _initialized = false;
+}
+
+STATUS
+mr_pool::initialize(rdma_device* rdevice, protection_domain* pd, const mr_pool_params& params) {
+    if (_initialized) {
+        return STATUS_OK;
+    }
+    if (!rdevice || !pd) {
+        return STATUS_INVALID_PARAM;
+    }
+
+    memory_region* mr = new memory_region();
+    STATUS res = mr->initialize(rdevice, nullptr, pd, params.size,
+                                (mem_page_policy)params.page_policy,
+                                MEM_ALLOC_LAZY_ZERO);
+    if (FAILED(res)) {
+        log_error("Failed to register %zu byte pool arena", params.size);
+        delete mr;
+        return res;
+    }
+
+    res = attach(mr->get_addr(), params.size, mr->get_lkey(), mr->get_rkey(), params);
+    if (FAILED(res)) {
+        delete mr;
+        return res;
+    }
+
+    _mr = mr;
+    return STATUS_OK;
+}
+
+STATUS
+mr_pool::attach(void* base, size_t length, uint32_t lkey, uint32_t rkey,
+                const mr_pool_params& params) {
+    if (_initialized) {
+        return STATUS_OK;
+    }
+    if (!base || !params.cache_size) {
+        return STATUS_INVALID_PARAM;
+    }
+    if ((length >> MR_POOL_MAX_CLASS_LOG) == 0) {
+        log_error("Pool arena of %zu bytes is smaller than one slab", length);
+        return STATUS_INVALID_SIZE;
+    }
+
+    _base      = static_cast<char*>(base);
+    _length    = length;
+    _lkey      = lkey;
+    _rkey      = rkey;
+    _params    = params;
+    _num_slabs = length >> MR_POOL_MAX_CLASS_LOG;
+    _next_slab = 0;
+    _slab_class.assign(_num_slabs, MR_POOL_SLAB_UNUSED);
+    memset(_classes, 0, sizeof(_classes));
+    _initialized = true;
+
+    log_debug("Memory pool at %p: %u slabs, lkey 0x%x", base, _num_slabs, lkey);
+    return STATUS_OK;
+}
+
+mr_pool::free_block*
+mr_pool::pop(int cls) {
+    size_class_state& sc = _classes[cls];
+
+    free_block* block = sc.free_list;
+    if (block) {
+        sc.free_list = block->next;
+        return block;
+    }
+
+    if (sc.bump == sc.bump_end) {
+        if (_next_slab == _num_slabs) {
+            return nullptr;
+        }
+        _slab_class[_next_slab] = cls;
+        sc.bump     = _base + ((size_t)_next_slab << MR_POOL_MAX_CLASS_LOG);
+        sc.bump_end = sc.bump + (1UL << MR_POOL_MAX_CLASS_LOG);
+        _next_slab++;
+    }
+
+    block = reinterpret_cast<free_block*>(sc.bump);
+    sc.bump += 1UL << (cls + MR_POOL_MIN_CLASS_LOG);
+    return block;
+}
+
+void
+mr_pool::push(int cls, free_block* block) {
+    block->next = _classes[cls].free_list;
+    _classes[cls].free_list = block;
+}
+
+STATUS
+mr_pool::alloc(size_t size, mr_pool_buf* buf) {
+    int cls = size_class(size);
+    if (unlikely(cls < 0 || size == 0)) {
+        return STATUS_INVALID_SIZE;
+    }
+
+    free_block* block;
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        block = pop(cls);
+    }
+    if (unlikely(!block)) {
+        return STATUS_NO_MEM;
+    }
+
+    fill(block, cls, buf);
+    return STATUS_OK;
+}
+
+STATUS
+mr_pool::free(void* addr) {
+    int cls = class_of(addr);
+    if (unlikely(cls < 0)) {
+        log_error("Freeing %p, which is not a block of pool %p", addr, _base);
+        return STATUS_INVALID_PARAM;
+    }
+
+    std::lock_guard<std::mutex> guard(_lock);
+    push(cls, static_cast<free_block*>(addr));
+    return STATUS_OK;
+}
+
+mr_pool_cache::mr_pool_cache(mr_pool* pool)
+    : _pool(pool)
+{
+    memset(_bins, 0, sizeof(_bins));
+}
+
+mr_pool_cache::~mr_pool_cache() {
+    flush();
+}
+
+STATUS
+mr_pool_cache::alloc(size_t size, mr_pool_buf* buf) {
+    int cls = mr_pool::size_class(size);
+    if (unlikely(cls < 0 || size == 0)) {
+        return STATUS_INVALID_SIZE;
+    }
+
+    bin& b = _bins[cls];
+    if (unlikely(!b.head)) {
+        // Refill half a cache in one trip to the pool
+        uint32_t want = (_pool->get_cache_size() + 1) / 2;
+        std::lock_guard<std::mutex> guard(_pool->_lock);
+        while (b.count < want) {
+            mr_pool::free_block* block = _pool->pop(cls);
+            if (!block) {
+                break;
+            }
+            block->next = b.head;
+            b.head = block;
+            b.count++;
+        }
+    }
+    if (unlikely(!b.head)) {
+        return STATUS_NO_MEM;
+    }
+
+    mr_pool::free_block* block = b.head;
+    b.head = block->next;
+    b.count--;
+    _pool->fill(block, cls, buf);
+    return STATUS_OK;
+}
+
+STATUS
+mr_pool_cache::free(void* addr) {
+    int cls = _pool->class_of(addr);
+    if (unlikely(cls < 0)) {
+        log_error("Freeing %p, which is not a block of pool %p", addr, _pool->_base);
+        return STATUS_INVALID_PARAM;
+    }
+    bin& b = _bins[cls];
+
+    mr_pool::free_block* block = static_cast<mr_pool::free_block*>(addr);
+    block->next = b.head;
+    b.head = block;
+    if (unlikely(++b.count > _pool->get_cache_size())) {
+        drain(cls, b.count / 2);
+    }
+    return STATUS_OK;
+}
+
+void
+mr_pool_cache::drain(int cls, uint32_t count) {
+    bin& b = _bins[cls];
+    std::lock_guard<std::mutex> guard(_pool->_lock);
+    while (count-- && b.head) {
+        mr_pool::free_block* block = b.head;
+        b.head = block->next;
+        b.count--;
+        _pool->push(cls, block);
+    }
+}
+
+void
+mr_pool_cache::flush() {
+    for (int cls = 0; cls < MR_POOL_NUM_CLASSES; ++cls) {
+        if (_bins[cls].count) {
+            drain(cls, _bins[cls].count);
+        }
+    }
+}
+
+//============================================================================
+// Completion DEVX Queue Implementation
+//============================================================================
+
+completion_queue_devx::completion_queue_devx() :
+    _cq(nullptr),
+    _cqn(0),
+    _cqe_buf(nullptr),
+    _dbrec(nullptr),
+    _uar_reg(nullptr),
+    _cqe_cnt(0),
+    _cqe_size(0),
+    _consumer_index(0),
+    _arm_sn(0),
+    _title(),
+    _title_ci(0),
+    _mini_cnt(0),
+    _mini_idx(0)
+{}
+
+completion_queue_devx::~completion_queue_devx() {
+    destroy();
+}
+
+void
+completion_queue_devx::set_cq_hw_params(cq_hw_params& params) {
+    // Store the provided parameters
+    _cq_hw_params = params;
+    
+    // Log the parameters for debugging purposes
+    log_debug("Setting CQ hardware parameters:");
+    log_debug("  log_cq_size: %u", params.log_cq_size);
+    log_debug("  log_page_size: %u", params.log_page_size);
+    log_debug("  cqe_sz: %u", params.cqe_sz);
+    log_debug("  cqe_comp_en: %s", params.cqe_comp_en ? "true" : "false");
+    log_debug("  mini_cqe_res_format: %u", params.mini_cqe_res_format);
+    log_debug("  cq_period_mode: %u", params.cq_period_mode);
+    log_debug("  cq_period: %u", params.cq_period);
+    log_debug("  cq_max_count: %u", params.cq_max_count);
+}
+
+cq_hw_params
+completion_queue_devx::get_cq_hw_params() const {
+    return _cq_hw_params;
+}
+
+STATUS
+completion_queue_devx::initialize_cq_resources(
+    rdma_device* rdevice,
+    cq_hw_params& cq_hw_params
+) {
+    _rdevice = rdevice;
+
+    const hca_capabilities& caps = rdevice->get_hca_cap();
+    uint8_t max_log_cq_size = caps.log_max_cq_sz;
+
+    _uar->initialize(rdevice->get_context());
+    if (_uar->get() == nullptr) {
+        log_error("Failed to initialize UAR");
+        return STATUS_ERR;
+    }
+
+    _umem_db->initialize(rdevice->get_context(), 1024);
+    if (_umem_db->get() == nullptr) {
+        log_error("Failed to initialize user memory for DB");
+        return STATUS_ERR;
+    }
+
+    if (cq_hw_params.log_cq_size == 0 || 
+        cq_hw_params.log_cq_size > max_log_cq_size) {
+        cq_hw_params.log_cq_size = 9;
+    }
+
+    if (cq_hw_params.cqe_comp_en && !caps.cqe_compression) {
+        log_info("Device does not support CQE compression, using full CQEs");
+        cq_hw_params.cqe_comp_en = false;
+    }
+    if (cq_hw_params.mini_cqe_res_format == MLX5_MINI_CQE_FORMAT_CSUM_STRIDX &&
+        !caps.mini_cqe_resp_stride_index) {
+        log_info("Device does not support stride index mini CQEs, using hash format");
+        cq_hw_params.mini_cqe_res_format = MLX5_MINI_CQE_FORMAT_HASH;
+    }
+    
+    if (cq_hw_params.cqe_comp_en && cq_hw_params.cqe_sz) {
+        log_info("CQE compression is only used with 64-byte CQEs, using full CQEs");
+        cq_hw_params.cqe_comp_en = false;
+    }
+
+    const size_t cqe_size = cq_hw_params.cqe_sz ? 128 : 64;
+    uint32_t cq_entries = 1U << cq_hw_params.log_cq_size;
+
+    log_debug("Allocating user memory for CQ: %u entries (%u bytes per entry),%zu bytes total (log_cq_size=%u)",
+              cq_entries,
+              cqe_size,
+              cq_entries * cqe_size,
+              cq_hw_params.log_cq_size);
+    
+    // attach_cq_buffers() initializes every CQE, so skip the zero-fill
+    _umem->initialize(rdevice->get_context(), cq_entries * cqe_size,
+                      (mem_page_policy)cq_hw_params.page_policy, MEM_ALLOC_LAZY_ZERO);
+    if (_umem->get() == nullptr) {
+        log_error("Failed to initialize user memory for CQ");
+        return STATUS_ERR;
+    }
+    cq_hw_params.log_page_size = _umem->page_size_log();
+
+    void* cqe_buffer = _umem->get_umem_buf();
+    if (!cqe_buffer) {
+        log_error("Failed to get CQE buffer");
+        return STATUS_ERR;
+    }
+
+    return attach_cq_buffers(cqe_buffer, _umem_db->addr(), _uar->get()->reg_addr, cq_hw_params);
+}
+
+STATUS
+completion_queue_devx::attach_cq_buffers(
+    void* cqe_buf,
+    void* dbrec,
+    void* uar_reg,
+    cq_hw_params& params
+) {
+    if (!cqe_buf || !dbrec) {
+        return STATUS_INVALID_PARAM;
+    }
+
+    // A 128-byte CQE is scatter data followed by the regular 64-byte CQE
+    const size_t cqe_size = params.cqe_sz ? 128 : 64;
+    uint32_t cq_entries = 1U << params.log_cq_size;
+
+    memset(cqe_buf, 0, cq_entries * cqe_size);
+    uint32_t cq_mask = cq_entries - 1;
+    for (size_t i = 0; i < cq_entries; ++i) {
+        struct mlx5_cqe64* cqe = (struct mlx5_cqe64*)((char*)cqe_buf + i * cqe_size + cqe_size - 64);
+        uint8_t owner = ((i & (cq_mask + 1)) ? 1 : 0);
+        cqe->op_own = (MLX5_CQE_INVALID << 4) | owner;
+    }
+
+    _cq_hw_params   = params;
+    _cqe_buf        = static_cast<uint8_t*>(cqe_buf);
+    _dbrec          = static_cast<volatile uint32_t*>(dbrec);
+    _uar_reg        = uar_reg;
+    _cqe_cnt        = cq_entries;
+    _cqe_size       = cqe_size;
+    _consumer_index = 0;
+    _mini_cnt       = 0;
+    _mini_idx       = 0;
+
+    log_debug("CQE buffer initialized with op_own and correct owner bits");
+    return STATUS_OK;
+}
+
+STATUS
+completion_queue_devx::initialize(
+    rdma_device* rdevice,
+    cq_hw_params& cq_hw_params_list
+) {
+    STATUS status = initialize_cq_resources(rdevice, cq_hw_params_list);
+    RETURN_IF_FAILED(status);
+
+    uint32_t eqn = 0;
+    if (mlx5dv_devx_query_eqn(rdevice->get_context(), 0, &eqn)) {
+        log_error("Failed to query EQN");
+        return STATUS_ERR;
+    }
+
+    // Initialize with zeros
+    uint32_t in[DEVX_ST_SZ_DW(create_cq_in)]  = {0};
+    uint32_t out[DEVX_ST_SZ_DW(create_cq_out)] = {0};
+
+    DEVX_SET(create_cq_in, in, opcode, MLX5_CMD_OP_CREATE_CQ);
+    void* cq_context = DEVX_ADDR_OF(create_cq_in, in, cqc);
+
+    DEVX_SET(cqc, cq_context, c_eqn, eqn);
+    DEVX_SET(cqc, cq_context, uar_page, _uar->get()->page_id);
+    DEVX_SET(cqc, cq_context, log_cq_size, cq_hw_params_list.log_cq_size);
+    DEVX_SET(cqc, cq_context, log_page_size, _umem->page_size_log() - 12);   // 4KB units
+
+    DEVX_SET(cqc, cq_context, cqe_sz, cq_hw_params_list.cqe_sz);
+    DEVX_SET(cqc, cq_context, cqe_comp_en, cq_hw_params_list.cqe_comp_en);
+    DEVX_SET(cqc, cq_context, mini_cqe_res_format, cq_hw_params_list.mini_cqe_res_format);
+    DEVX_SET(cqc, cq_context, cqe_comp_layout, cq_hw_params_list.cqe_comp_layout);
+    DEVX_SET(cqc, cq_context, cq_period_mode, cq_hw_params_list.cq_period_mode);
+    DEVX_SET(cqc, cq_context, cq_period, cq_hw_params_list.cq_period);
+    DEVX_SET(cqc, cq_context, cq_max_count, cq_hw_params_list.cq_max_count);
+    
+    DEVX_SET(cqc, cq_context, dbr_umem_valid, 1);
+    DEVX_SET(cqc, cq_context, dbr_umem_id, _umem_db->get()->umem_id);
+    
+    DEVX_SET(create_cq_in, in, cq_umem_valid, 1);
+    DEVX_SET(create_cq_in, in, cq_umem_id, _umem->get()->umem_id);
+    DEVX_SET(create_cq_in, in, cq_umem_offset, 0);
+    
+    log_debug("Creating CQ with parameters:");
+    log_debug("  log_cq_size: %u", cq_hw_params_list.log_cq_size);
+    log_debug("  cqe_sz: %u (%u bytes)", cq_hw_params_list.cqe_sz, _cqe_size);
+    log_debug("  page size: 2^%u", _umem->page_size_log());
+    log_debug("  eqn: %u", eqn);
+    log_debug("  uar_page: %u", _uar->get()->page_id);
+    log_debug("  umem_id: %u", _umem->get()->umem_id);
+    log_debug("  dbr_umem_id: %u", _umem_db->get()->umem_id);
+
+    _cq = mlx5dv_devx_obj_create(_rdevice->get_context(), in, sizeof(in), out, sizeof(out));
+    if (!_cq) {
+        log_error("Failed to create completion queue, error: %d (%s)", errno, strerror(errno));
+        log_error("Syndrome: 0x%x", DEVX_GET(create_cq_out, out, syndrome));
+        return STATUS_ERR;
+    }
+
+    _cqn = DEVX_GET(create_cq_out, out, cqn);
+    log_debug("Created completion queue with cqn: %d", _cqn);
+
+    return STATUS_OK;
+}
+
+static inline void
+decode_cqe(const struct mlx5_cqe64* cqe, uint8_t op_own, cqe_out* out)
+{
+    out->opcode      = op_own >> 4;
+    out->wqe_counter = be16toh(cqe->wqe_counter);
+    out->wqe_id      = be16toh(cqe->wqe_id);
+    out->qpn         = be32toh(cqe->sop_drop_qpn) & 0xffffff;
+    out->byte_cnt    = be32toh(cqe->byte_cnt);
+    out->imm         = be32toh(cqe->imm_inval_pkey);
+    out->timestamp   = be64toh(cqe->timestamp);
+
+    if (out->opcode == MLX5_CQE_REQ_ERR || out->opcode == MLX5_CQE_RESP_ERR) {
+        const struct mlx5_err_cqe* err_cqe = (const struct mlx5_err_cqe*)cqe;
+        out->syndrome        = err_cqe->syndrome;
+        out->vendor_err_synd = err_cqe->vendor_err_synd;
+    } else {
+        out->syndrome        = 0;
+        out->vendor_err_synd = 0;
+    }
+
+    /* Responder scatter-to-CQE: 32 bytes at the head of the CQE, 64 bytes
+       in the first half of a 128-byte CQE */
+    out->inline_data = nullptr;
+    if (out->opcode >= MLX5_CQE_RESP_SEND && out->opcode <= MLX5_CQE_RESP_SEND_INV) {
+        uint8_t scatter = op_own & (MLX5_INLINE_SCATTER_32 | MLX5_INLINE_SCATTER_64);
+        if (scatter == MLX5_INLINE_SCATTER_32) {
+            out->inline_data = (const uint8_t*)cqe;
+        } else if (scatter == MLX5_INLINE_SCATTER_64) {
+            out->inline_data = (const uint8_t*)cqe - 64;
+        }
+    }
+}
+
+int
+completion_queue_devx::expand_mini_cqes(cqe_out* cqes, int max) {
+    const uint32_t mask = _cqe_cnt - 1;
+    const bool requester = _title.opcode == MLX5_CQE_REQ;
+    const bool stride_idx = _cq_hw_params.mini_cqe_res_format == MLX5_MINI_CQE_FORMAT_CSUM_STRIDX;
+    int n = 0;
+
+    while (n < max && _mini_idx < _mini_cnt) {
+        uint32_t i = _mini_idx++;
+        uint32_t slot = _title_ci + (i < MLX5_MINI_CQE_ARRAY_SIZE ? 1 : i & ~(MLX5_MINI_CQE_ARRAY_SIZE - 1));
+        const mlx5_mini_cqe8* mini = (const mlx5_mini_cqe8*)(_cqe_buf + (slot & mask) * _cqe_size) +
+                                     (i & (MLX5_MINI_CQE_ARRAY_SIZE - 1));
+
+        /* Everything but the per-completion fields comes from the title */
+        cqe_out* out = &cqes[n++];
+        *out = _title;
+        out->byte_cnt    = be32toh(mini->byte_cnt);
+        out->inline_data = nullptr;
+        if (requester) {
+            out->wqe_counter = be16toh(mini->s_wqe_info.wqe_counter);
+        } else if (stride_idx) {
+            out->wqe_counter = be16toh(mini->stride_idx);
+        } else {
+            out->wqe_counter = _title.wqe_counter + i;
+        }
+    }
+    return n;
+}
+
+uint32_t
+completion_queue_devx::close_session() {
+    const uint32_t mask = _cqe_cnt - 1;
+
+    /* Mini arrays overwrite op_own; don't let a stale one pass for a CQE next lap */
+    for (uint32_t i = 0; i < _mini_cnt; i += MLX5_MINI_CQE_ARRAY_SIZE) {
+        uint32_t slot = _title_ci + (i ? i : 1);
+        ((struct mlx5_cqe64*)(_cqe_buf + (slot & mask) * _cqe_size))->op_own = MLX5_CQE_INVALID << 4;
+    }
+
+    /* The title and its mini arrays span _mini_cnt slots */
+    uint32_t ci = _title_ci + _mini_cnt;
+    _mini_cnt = 0;
+    _mini_idx = 0;
+    return ci;
+}
+
+int
+completion_queue_devx::poll_cq(cqe_out* cqes, int max) {
+    if (unlikely(!_cqe_buf)) return 0;
+
+    /* Locals: stores into cqes[] may alias the members as far as the compiler knows */
+    const uint32_t cnt    = _cqe_cnt;
+    const uint32_t mask   = cnt - 1;
+    const uint32_t stride = _cqe_size;
+    uint8_t* const ring   = _cqe_buf + stride - 64;   /* the 64-byte CQE of each entry */
+    uint32_t ci = _consumer_index;
+    int n = 0;
+
+    while (n < max) {
+        if (unlikely(_mini_cnt)) {
+            n += expand_mini_cqes(&cqes[n], max - n);
+            if (_mini_idx < _mini_cnt) {
+                break;
+            }
+            ci = close_session();
+            continue;
+        }
+
+        struct mlx5_cqe64* cqe = (struct mlx5_cqe64*)(ring + (ci & mask) * stride);
+        uint8_t op_own = *(volatile uint8_t*)&cqe->op_own;
+
+        /* SW owns the entry when its owner bit matches the CI wrap parity */
+        if ((op_own & MLX5_CQE_OWNER_MASK) != !!(ci & cnt) ||
+            (op_own >> 4) == MLX5_CQE_INVALID) {
+            break;
+        }
+
+        /* Don't read the CQE body before the ownership check */
+        udma_from_device_barrier();
+
+        /* Pull a CQE a couple of entries ahead while this one is decoded */
+        __builtin_prefetch(ring + ((ci + CQ_PREFETCH_AHEAD) & mask) * stride);
+
+        if (unlikely(((op_own >> 2) & 0x3) == MLX5_CQE_FORMAT_COMPRESSED)) {
+            decode_cqe(cqe, op_own, &_title);
+            _title_ci = ci;
+            _mini_cnt = _title.byte_cnt;
+            _mini_idx = 0;
+            if (!_mini_cnt) {
+                ++ci;
+            }
+            continue;
+        }
+
+        decode_cqe(cqe, op_own, &cqes[n]);
+        ++n;
+        ++ci;
+    }
+
+    if (n) {
+        _consumer_index = ci;
+        udma_to_device_barrier();
+        *_dbrec = htobe32(ci & 0xffffff);
+    }
+
+    return n;
+}
+
+bool
+completion_queue_devx::dispatch(const cqe_out& cqe) {
+    queue_pair* qp = lookup_qp(cqe.qpn);
+    if (unlikely(!qp)) {
+        log_dp_debug("CQE for unattached qpn 0x%x on cqn %u", cqe.qpn, _cqn);
+        return false;
+    }
+    qp->complete(cqe);
+    qp->notify(cqe);
+    return true;
+}
+
+int
+completion_queue_devx::poll_dispatch(cqe_out* cqes, int max) {
+    int n = poll_cq(cqes, max);
+    for (int i = 0; i < n; ++i) {
+        dispatch(cqes[i]);
+    }
+    return n;
+}
+
+STATUS
+completion_queue_devx::attach_qp(uint32_t qpn, queue_pair* qp) {
+    if (!qp || qpn > 0xffffff) {
+        return STATUS_INVALID_PARAM;
+    }
+
+    uint32_t page = qpn >> CQ_QP_TABLE_SHIFT;
+    if (page >= _qp_table.size()) {
+        _qp_table.resize(page + 1);
+    }
+    if (!_qp_table[page]) {
+        _qp_table[page].reset(new queue_pair*[CQ_QP_TABLE_MASK + 1]());
+    }
+
+    queue_pair*& slot = _qp_table[page][qpn & CQ_QP_TABLE_MASK];
+    if (slot && slot != qp) {
+        log_error("qpn 0x%x is already attached to cqn %u", qpn, _cqn);
+        return STATUS_INVALID_STATE;
+    }
+    if (!slot) {
+        slot = qp;
+        _num_qps++;
+    }
+    return STATUS_OK;
+}
+
+void
+completion_queue_devx::detach_qp(uint32_t qpn, queue_pair* qp) {
+    uint32_t page = qpn >> CQ_QP_TABLE_SHIFT;
+    if (page >= _qp_table.size() || !_qp_table[page]) {
+        return;
+    }
+    queue_pair*& slot = _qp_table[page][qpn & CQ_QP_TABLE_MASK];
+    if (slot == qp) {
+        slot = nullptr;
+        _num_qps--;
+    }
+}
+
+STATUS
+completion_queue_devx::poll_cq() {
+    cqe_out cqe;
+    if (poll_cq(&cqe, 1) == 0) {
+        return STATUS_NO_DATA;
+    }
+
+    if (cqe_is_error(cqe)) {
+        log_error("CQE error: opcode=0x%x", cqe.opcode);
+        log_error("  syndrome=0x%x", cqe.syndrome);
+        log_error("  vendor_err_synd=0x%x", cqe.vendor_err_synd);
+        log_error("  wqe_counter=0x%x", cqe.wqe_counter);
+        log_error("  qpn=0x%x", cqe.qpn);
+        return STATUS_ERR;
+    }
+
+    log_dp_debug("DEVX CQE received: opcode=%u, wqe_counter=%u, byte_cnt=%u, timestamp=%llu",
+              cqe.opcode, cqe.wqe_counter, cqe.byte_cnt, (unsigned long long)cqe.timestamp);
+    return STATUS_OK;
+}
+
+#define MLX5_CQ_ARM_DB 0x1
+
+STATUS
+completion_queue_devx::arm_cq(int solicited)
+{
+    volatile uint32_t* dbrec = _dbrec;
+    if (!dbrec) return STATUS_ERR;
+    void* uar_reg = _uar_reg;
+    if (!uar_reg) return STATUS_ERR;
+
+    uint32_t sn = _arm_sn & 3;
+    uint32_t ci = _consumer_index & 0xffffff;
+
+    uint32_t cmd = solicited ? MLX5_CQ_DB_REQ_NOT_SOL : MLX5_CQ_DB_REQ_NOT;
+    uint64_t doorbell = ((uint64_t)(sn << 28 | cmd | ci) << 32) | _cqn;
+
+    log_dp_debug("CQ Arming: sn=%u, ci=%u, cmd=%s, cqn=%u",
+                 sn, ci, solicited ? "solicited" : "unsolicited", _cqn);
+
+    dbrec[MLX5_CQ_ARM_DB] = htobe32(sn << 28 | cmd | ci);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    volatile uint64_t* uar_db = (volatile uint64_t*)((char*)uar_reg + MLX5_CQ_DOORBELL);
+    *uar_db = htobe64(doorbell);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    
+    return STATUS_OK;
+}
+
+void
+completion_queue_devx::destroy() {
+    if (_cq) {
+        log_debug("Destroying completion queue with cqn: %d", _cqn);
+        mlx5dv_devx_obj_destroy(_cq);
+        _cq = nullptr;
+    }
+
+    if (_umem_db) {
+        _umem_db->destroy();
+    }
+
+    if (_umem) {
+        _umem->destroy();
+    }
+
+    if (_uar) {
+        _uar->destroy();
+    }
+
+    _cqe_buf = nullptr;
+    _dbrec   = nullptr;
+    _uar_reg = nullptr;
+}
+
+//============================================================================
+// Completion Channel Implementation
+//============================================================================
+
+completion_channel::completion_channel() :
+    _channel(nullptr),
+    _fd(-1),
+    _fd_cq(nullptr)
+{}
+
+completion_channel::~completion_channel() {
+    destroy();
+}
+
+STATUS
+completion_channel::initialize(rdma_device* rdevice) {
+    _channel = mlx5dv_devx_create_event_channel(rdevice->get_context(),
+                                                MLX5DV_DEVX_CREATE_EVENT_CHANNEL_FLAGS_OMIT_EV_DATA);
+    if (!_channel) {
+        log_error("Failed to create DEVX event channel, error: %d (%s)", errno, strerror(errno));
+        return STATUS_ERR;
+    }
+
+    _fd = _channel->fd;
+    log_debug("Created completion channel with fd: %d", _fd);
+    return STATUS_OK;
+}
+
+STATUS
+completion_channel::attach_fd(int fd) {
+    if (fd < 0) {
+        return STATUS_INVALID_HANDLE;
+    }
+    _fd = fd;
+    return STATUS_OK;
+}
+
+STATUS
+completion_channel::subscribe(completion_queue_devx* cq) {
+    if (!cq) {
+        return STATUS_INVALID_PARAM;
+    }
+
+    if (!_channel) {
+        if (_fd_cq) {
+            return STATUS_INVALID_OPERATION;
+        }
+        _fd_cq = cq;
+        return STATUS_OK;
+    }
+
+    uint16_t event = MLX5_EVENT_TYPE_COMP;
+    if (mlx5dv_devx_subscribe_devx_event(_channel, cq->get(), sizeof(event), &event,
+                                         (uint64_t)(uintptr_t)cq)) {
+        log_error("Failed to subscribe CQ %u to completion events, error: %d (%s)",
+                  cq->get_cqn(), errno, strerror(errno));
+        return STATUS_ERR;
+    }
+    return STATUS_OK;
+}
+
+STATUS
+completion_channel::get_event(completion_queue_devx** cq, int timeout_ms) {
+    if (_fd < 0) {
+        return STATUS_INVALID_STATE;
+    }
+
+    struct pollfd pfd = { _fd, POLLIN, 0 };
+    int ret = poll(&pfd, 1, timeout_ms);
+    if (ret == 0) {
+        return STATUS_NO_DATA;
+    }
+    if (ret < 0) {
+        return errno == EINTR ? STATUS_NO_DATA : STATUS_ERR;
+    }
+
+    completion_queue_devx* source = nullptr;
+    if (_channel) {
+        struct mlx5dv_devx_async_event_hdr hdr;
+        if (mlx5dv_devx_get_event(_channel, &hdr, sizeof(hdr)) < (ssize_t)sizeof(hdr)) {
+            log_error("Failed to read completion event, error: %d (%s)", errno, strerror(errno));
+            return STATUS_ERR;
+        }
+        source = (completion_queue_devx*)(uintptr_t)hdr.cookie;
+    } else {
+        uint64_t count;
+        if (read(_fd, &count, sizeof(count)) != sizeof(count)) {
+            return STATUS_ERR;
+        }
+        source = _fd_cq;
+    }
+
+    if (!source) {
+        return STATUS_INVALID_OBJECT;
+    }
+    source->cq_event();
+    *cq = source;
+    return STATUS_OK;
+}
+
+void
+completion_channel::destroy() {
+    if (_channel) {
+        mlx5dv_devx_destroy_event_channel(_channel);
+        _channel = nullptr;
+    }
+    _fd    = -1;
+    _fd_cq = nullptr;
+}
+
+cq_waiter::cq_waiter(completion_queue_devx* cq, completion_channel* channel,
+                     const cq_wait_params& params) :
+    _cq(cq),
+    _channel(channel),
+    _params(params),
+    _spin_ns(params.spin_ns),
+    _spin_hits(0),
+    _sleeps(0)
+{}
+
+int
+cq_waiter::wait(cqe_out* cqes, int max) {
+    using clock = std::chrono::steady_clock;
+
+    auto start = clock::now();
+    auto spin_end = start + std::chrono::nanoseconds(_spin_ns);
+    do {
+        int n = _cq->poll_cq(cqes, max);
+        if (n) {
+            _spin_hits++;
+            return n;
+        }
+    } while (clock::now() < spin_end);
+
+    // Arm, then look once more: a CQE that landed before the arm raises no event
+    if (_cq->arm_cq() != STATUS_OK) {
+        return -1;
+    }
+    int n = _cq->poll_cq(cqes, max);
+    if (n) {
+        return n;
+    }
+
+    _sleeps++;
+    auto sleep_start = clock::now();
+    completion_queue_devx* cq = nullptr;
+    STATUS res = _channel->get_event(&cq, _params.timeout_ms);
+    if (res == STATUS_NO_DATA) {
+        return 0;
+    }
+    if (res != STATUS_OK || cq != _cq) {
+        return -1;
+    }
+
+    uint64_t slept_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            clock::now() - sleep_start).count();
+    if (slept_ns < _spin_ns) {
+        _spin_ns = std::min(_spin_ns * 2, _params.max_spin_ns);
+    } else if (slept_ns > 8ull * _spin_ns) {
+        _spin_ns = std::max(_spin_ns / 2, _params.min_spin_ns);
+    }
+
+    return _cq->poll_cq(cqes, max);
+}
+
+//============================================================================
+// Shared Receive Queue Implementation
+//============================================================================
+
+// Fill the data segments of a receive WQE. A list shorter than the WQE ends
+// with an invalid-lkey segment; zero-length SGEs (2GB to the HCA) are skipped.
+static void
+set_recv_data_segs(char* seg, const ibv_sge* sgl, uint32_t num_sge, uint32_t max_sge)
+{
+    mlx5_wqe_data_seg* dseg = (mlx5_wqe_data_seg*)seg;
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < num_sge; ++i) {
+        if (unlikely(!sgl[i].length)) {
+            continue;
+        }
+        mlx5_set_data_seg(&dseg[n++], sgl[i].length, sgl[i].lkey, sgl[i].addr);
+    }
+    if (n < max_sge) {
+        mlx5_set_data_seg(&dseg[n], 0, MLX5_INVALID_LKEY, 0);
+    }
+}
+
+shared_receive_queue::shared_receive_queue() :
+    _srq(nullptr),
+    _srqn(0),
+    _buf(nullptr),
+    _dbrec(nullptr),
+    _wqe_cnt(0),
+    _stride(0),
+    _max_sge(0),
+    _head(0),
+    _tail(0),
+    _counter(0),
+    _free(0)
+{}
+
+shared_receive_queue::~shared_receive_queue() {
+    destroy();
+}
+
+void
+shared_receive_queue::destroy() {
+    if (_srq) {
+        log_debug("Destroying SRQ with srqn: %d", _srqn);
+        mlx5dv_devx_obj_destroy(_srq);
+        _srq = nullptr;
+    }
+
+    if (_umem_db) {
+        _umem_db->destroy();
+    }
+
+    if (_umem) {
+        _umem->destroy();
+    }
+
+    _srqn  = 0;
+    _buf   = nullptr;
+    _dbrec = nullptr;
+}
+
+uint32_t
+shared_receive_queue::wqe_stride(uint32_t max_sge) {
+    uint32_t bytes = sizeof(mlx5_wqe_srq_next_seg) + max_sge * sizeof(mlx5_wqe_data_seg);
+    uint32_t stride = 32;
+    while (stride < bytes) {
+        stride <<= 1;
+    }
+    return stride;
+}
+
+STATUS
+shared_receive_queue::initialize(rdma_device* rdevice, srq_init_params& params) {
+    if (_srq) {
+        return STATUS_OK;
+    }
+
+    if (!rdevice) {
+        log_error("Invalid device");
+        return STATUS_ERR;
+    }
+
+    const hca_capabilities& caps = rdevice->get_hca_cap();
+    if (params.log_srq_size == 0 || params.log_srq_size > caps.log_max_srq_sz) {
+        log_error("SRQ size 2^%u out of range (max 2^%u)", params.log_srq_size, caps.log_max_srq_sz);
+        return STATUS_INVALID_SIZE;
+    }
+
+    if (params.log_num_strides &&
+        (params.log_stride_size < caps.log_min_stride_sz_rq ||
+         params.log_stride_size > caps.log_max_stride_sz_rq)) {
+        log_error("Stride size 2^%u out of range (2^%u..2^%u)", params.log_stride_size,
+                  caps.log_min_stride_sz_rq, caps.log_max_stride_sz_rq);
+        return STATUS_INVALID_SIZE;
+    }
+
+    uint32_t stride = wqe_stride(params.log_num_strides || !params.max_sge ? 1 : params.max_sge);
+    size_t buf_bytes = (size_t)stride << params.log_srq_size;
+
+    STATUS res = _umem->initialize(rdevice->get_context(), buf_bytes);
+    RETURN_IF_FAILED_MSG(res, "Failed to initialize user memory for SRQ");
+
+    res = _umem_db->initialize(rdevice->get_context(), get_page_size());
+    RETURN_IF_FAILED_MSG(res, "Failed to initialize user memory for SRQ DB");
+
+    res = attach_srq_buffers(_umem->addr(), _umem_db->addr(), params);
+    RETURN_IF_FAILED(res);
+
+    uint32_t in[DEVX_ST_SZ_DW(create_rmp_in)]   = {0};
+    uint32_t out[DEVX_ST_SZ_DW(create_rmp_out)] = {0};
+
+    DEVX_SET(create_rmp_in, in, opcode, MLX5_CMD_OP_CREATE_RMP);
+
+    void* rmpc = DEVX_ADDR_OF(create_rmp_in, in, ctx);
+    DEVX_SET(rmpc, rmpc, state, MLX5_RMPC_STATE_RDY);
+
+    void* wq = DEVX_ADDR_OF(rmpc, rmpc, wq);
+    if (is_striding()) {
+        DEVX_SET(wq, wq, wq_type, MLX5_WQ_TYPE_LINKED_LIST_STRIDING_RQ);
+        DEVX_SET(wq, wq, single_wqe_log_num_of_strides, params.log_num_strides - 9);
+        DEVX_SET(wq, wq, single_stride_log_num_of_bytes, params.log_stride_size - 6);
+    } else {
+        DEVX_SET(wq, wq, wq_type, MLX5_WQ_TYPE_LINKED_LIST);
+    }
+    DEVX_SET(wq, wq, pd, params.pdn);
+    DEVX_SET(wq, wq, lwm, params.lwm);
+    DEVX_SET(wq, wq, log_wq_stride, ilog2(_stride));
+    DEVX_SET(wq, wq, log_wq_sz, params.log_srq_size);
+    DEVX_SET(wq, wq, log_wq_pg_sz, _umem->page_size_log() - 12);   // 4KB units
+    DEVX_SET(wq, wq, page_offset, 0);
+    DEVX_SET(wq, wq, wq_umem_valid, 1);
+    DEVX_SET(wq, wq, wq_umem_id, _umem->umem_id());
+    DEVX_SET(wq, wq, dbr_umem_valid, 1);
+    DEVX_SET(wq, wq, dbr_umem_id, _umem_db->umem_id());
+    DEVX_SET64(wq, wq, dbr_addr, 0);
+
+    _srq = mlx5dv_devx_obj_create(rdevice->get_context(), in, sizeof(in), out, sizeof(out));
+    if (!_srq) {
+        log_error("Failed to create SRQ (RMP)");
+        log_error("Errorno: %s", strerror(errno));
+        log_error("Syndrome: 0x%x", DEVX_GET(create_rmp_out, out, syndrome));
+        return STATUS_ERR;
+    }
+
+    _srqn = DEVX_GET(create_rmp_out, out, rmpn);
+    log_info("Created SRQ with srqn: %d, %u WQEs of %u bytes", _srqn, _wqe_cnt, _stride);
+
+    return STATUS_OK;
+}
 
 STATUS
-completion_queue_devx::arm_cq(int solicited)
-{
-    if (!_umem_db || !_uar) return STATUS_ERR;
-    volatile uint32_t* dbrec = (volatile uint32_t*)_umem_db->addr();
-    if (!dbrec) return STATUS_ERR;
-    void* uar_reg = _uar->get()->reg_addr;
-    if (!uar_reg) return STATUS_ERR;    
+shared_receive_queue::attach_srq_buffers(void* wqe_buf, void* dbrec, srq_init_params& params) {
+    if (!wqe_buf || !dbrec) {
+        return STATUS_INVALID_PARAM;
+    }
+    if (params.log_srq_size == 0 || params.log_srq_size > 15) {
+        log_error("Invalid SRQ size 2^%u", params.log_srq_size);
+        return STATUS_INVALID_SIZE;
+    }
+
+    // Striding buffers are a single data segment each
+    if (params.log_num_strides &&
+        (params.log_num_strides < 9 || params.log_num_strides > 16 || params.log_stride_size < 6)) {
+        log_error("Invalid striding layout: 2^%u strides of 2^%u bytes",
+                  params.log_num_strides, params.log_stride_size);
+        return STATUS_INVALID_PARAM;
+    }
+
+    _buf     = static_cast<char*>(wqe_buf);
+    _dbrec   = static_cast<volatile uint32_t*>(dbrec);
+    _wqe_cnt = 1u << params.log_srq_size;
+    _max_sge = params.log_num_strides ? 1 : (params.max_sge ? params.max_sge : 1);
+    _stride  = wqe_stride(_max_sge);
+
+    _log_num_strides = params.log_num_strides;
+    _stride_size     = _log_num_strides ? 1u << params.log_stride_size : 0;
+    _wqe_data.assign(_log_num_strides ? _wqe_cnt : 0, nullptr);
+    _strides_held.assign(_log_num_strides ? _wqe_cnt : 0, 0);
+
+    // Link every WQE to the next one; the last one is the initial tail
+    for (uint32_t i = 0; i < _wqe_cnt; ++i) {
+        mlx5_wqe_srq_next_seg* next = (mlx5_wqe_srq_next_seg*)get_wqe(i);
+        memset(next, 0, sizeof(*next));
+        next->next_wqe_index = htobe16((i + 1) & (_wqe_cnt - 1));
+    }
+    _head    = 0;
+    _tail    = _wqe_cnt - 1;
+    _counter = 0;
+    _free    = _wqe_cnt - 1;
+    *_dbrec  = 0;
 
-    uint32_t sn = _arm_sn & 3;
-    uint32_t ci = _consumer_index & 0xffffff;
+    return STATUS_OK;
+}
 
-    uint32_t cmd = solicited ? MLX5_CQ_DB_REQ_NOT_SOL : MLX5_CQ_DB_REQ_NOT;
-    uint64_t doorbell = ((uint64_t)(sn << 28 | cmd | ci) << 32) | _cqn;
+STATUS
+shared_receive_queue::post_recv(const ibv_sge* sgl, uint32_t num_sge) {
+    if (unlikely(num_sge > _max_sge)) {
+        log_error("Too many receive SGEs: %u (max %u)", num_sge, _max_sge);
+        return STATUS_INVALID_PARAM;
+    }
+    if (unlikely(!_free)) {
+        return STATUS_WOULD_BLOCK;
+    }
 
-    log_debug("CQ Arming: sn=%u, ci=%u, cmd=%s, cqn=%u", 
-              sn, ci, solicited ? "solicited" : "unsolicited", _cqn);
+    char* wqe = get_wqe(_head);
+    _head = be16toh(((mlx5_wqe_srq_next_seg*)wqe)->next_wqe_index);
+    set_recv_data_segs(wqe + sizeof(mlx5_wqe_srq_next_seg), sgl, num_sge, _max_sge);
+    _free--;
+    _counter++;
 
-    dbrec[MLX5_CQ_ARM_DB] = htobe32(sn << 28 | cmd | ci);
-    __atomic_thread_fence(__ATOMIC_SEQ_CST);
-    volatile uint64_t* uar_db = (volatile uint64_t*)((char*)uar_reg + MLX5_CQ_DOORBELL);
-    *uar_db = htobe64(doorbell);
-    __atomic_thread_fence(__ATOMIC_SEQ_CST);
-    
+    udma_to_device_barrier();
+    *_dbrec = htobe32(_counter);
+    return STATUS_OK;
+}
+
+STATUS
+shared_receive_queue::post_recv_batch(const ibv_sge* sges, uint32_t count) {
+    if (unlikely(count > _free)) {
+        return STATUS_WOULD_BLOCK;
+    }
+
+    for (uint32_t i = 0; i < count; ++i) {
+        char* wqe = get_wqe(_head);
+        _head = be16toh(((mlx5_wqe_srq_next_seg*)wqe)->next_wqe_index);
+        set_recv_data_segs(wqe + sizeof(mlx5_wqe_srq_next_seg), &sges[i], 1, _max_sge);
+    }
+    _free -= count;
+    _counter += count;
+
+    udma_to_device_barrier();
+    *_dbrec = htobe32(_counter);
+    log_dp_debug("Posted %u SRQ WQEs, counter: %u", count, _counter);
     return STATUS_OK;
 }
 
 void
-completion_queue_devx::destroy() {
-    if (_cq) {
-        log_debug("Destroying completion queue with cqn: %d", _cqn);
-        mlx5dv_devx_obj_destroy(_cq);
-        _cq = nullptr;
+shared_receive_queue::srq_complete(uint16_t wqe_counter) {
+    // Append the consumed WQE behind the current tail
+    mlx5_wqe_srq_next_seg* tail = (mlx5_wqe_srq_next_seg*)get_wqe(_tail);
+    tail->next_wqe_index = htobe16(wqe_counter);
+    _tail = wqe_counter;
+    _free++;
+}
+
+STATUS
+shared_receive_queue::post_stride_buffers(void* base, uint32_t lkey, uint32_t num_buffers) {
+    if (!is_striding()) {
+        return STATUS_INVALID_OPERATION;
+    }
+    if (num_buffers > _free) {
+        return STATUS_WOULD_BLOCK;
     }
 
-    if (_umem_db) {
-        _umem_db->destroy();
+    _stride_lkey = lkey;
+    char* data = static_cast<char*>(base);
+    for (uint32_t i = 0; i < num_buffers; ++i, data += get_buffer_size()) {
+        uint16_t idx = _head;
+        ibv_sge sge = { (uintptr_t)data, get_buffer_size(), lkey };
+        STATUS res = post_recv(&sge, 1);
+        RETURN_IF_FAILED(res);
+        _wqe_data[idx] = data;
+        _strides_held[idx] = 1u << _log_num_strides;
     }
+    return STATUS_OK;
+}
 
-    if (_umem) {
-        _umem->destroy();
+void
+shared_receive_queue::put_strides(uint16_t wqe_index, uint32_t count) {
+    _strides_held[wqe_index] -= count;
+    if (_strides_held[wqe_index]) {
+        return;
     }
 
-    if (_uar) {
-        _uar->destroy();
+    // Every stride is back: recycle the WQE with the same buffer
+    char* data = _wqe_data[wqe_index];
+    srq_complete(wqe_index);
+    uint16_t idx = _head;
+    ibv_sge sge = { (uintptr_t)data, get_buffer_size(), _stride_lkey };
+    if (post_recv(&sge, 1) == STATUS_OK) {
+        _wqe_data[idx] = data;
+        _strides_held[idx] = 1u << _log_num_strides;
+    }
+}
+
+STATUS
+shared_receive_queue::consume(const cqe_out& cqe, stride_msg& msg) {
+    if (unlikely(!is_striding())) {
+        return STATUS_INVALID_OPERATION;
+    }
+
+    const uint32_t num_strides = 1u << _log_num_strides;
+    uint16_t wqe_index = cqe.wqe_id & (_wqe_cnt - 1);
+    uint32_t strides = (cqe.byte_cnt & MLX5_MPRQ_STRIDE_NUM_MASK) >> MLX5_MPRQ_STRIDE_NUM_SHIFT;
+
+    if (unlikely(cqe.wqe_counter + strides > num_strides || !_wqe_data[wqe_index])) {
+        log_error("Bad striding CQE: wqe %u stride %u count %u", wqe_index, cqe.wqe_counter, strides);
+        return STATUS_INVALID_VALUE;
+    }
+
+    // The HCA skipped the buffer tail: nothing to read, strides go back now
+    if (cqe.byte_cnt & MLX5_MPRQ_FILLER_MASK) {
+        put_strides(wqe_index, strides);
+        return STATUS_NO_DATA;
     }
+
+    msg.data         = _wqe_data[wqe_index] + (size_t)cqe.wqe_counter * _stride_size;
+    msg.len          = cqe.byte_cnt & MLX5_MPRQ_LEN_MASK;
+    msg.wqe_index    = wqe_index;
+    msg.stride_index = cqe.wqe_counter;
+    msg.num_strides  = strides;
+    return STATUS_OK;
+}
+
+void
+shared_receive_queue::release(const stride_msg& msg) {
+    put_strides(msg.wqe_index, msg.num_strides);
 }
 
 //============================================================================
@@ -1025,6 +2772,9 @@ queue_pair::~queue_pair() {
 void
 queue_pair::destroy() {
     if (_qp) {
+        if (_send_cq) {
+            _send_cq->detach_qp(_qpn, this);
+        }
         log_debug("Destroying QP with qpn: %d", _qpn);
         mlx5dv_devx_obj_destroy(_qp);
         _qp = nullptr;
@@ -1076,8 +2826,20 @@ queue_pair::initialize(qp_init_creation_params& params) {
     DEVX_SET(qpc, qpc, cqn_rcv, params.cqn);
 
     DEVX_SET(qpc, qpc, log_sq_size , ilog2(params.sq_size));
-    DEVX_SET(qpc, qpc, log_rq_size , ilog2(params.rq_size));
-    DEVX_SET(qpc, qpc, log_rq_stride, MLX5_RQ_STRIDE);    
+    if (params.srq) {
+        DEVX_SET(qpc, qpc, rq_type, MLX5_QPC_RQ_TYPE_SRQ);
+        DEVX_SET(qpc, qpc, srqn_rmpn_xrqn, params.srq->get_srqn());
+    } else {
+        DEVX_SET(qpc, qpc, log_rq_size , ilog2(params.rq_size));
+        DEVX_SET(qpc, qpc, log_rq_stride, MLX5_RQ_STRIDE);
+    }
+
+    if (params.scatter_to_cqe == QP_SCATTER_TO_CQE_64 && params.send_cq &&
+        !params.send_cq->get_cq_hw_params().cqe_sz) {
+        log_info("64-byte scatter-to-CQE needs 128-byte CQEs, scattering up to 32 bytes");
+        params.scatter_to_cqe = QP_SCATTER_TO_CQE_32;
+    }
+    DEVX_SET(qpc, qpc, cs_res, params.scatter_to_cqe);
 
     DEVX_SET(qpc, qpc, no_sq, 0);
     DEVX_SET(qpc, qpc, wq_signature, 0);
@@ -1091,7 +2853,7 @@ queue_pair::initialize(qp_init_creation_params& params) {
     DEVX_SET(create_qp_in, in, wq_umem_id, params.umem_sq->get()->umem_id);
     DEVX_SET(create_qp_in, in, wq_umem_valid, 1);
 
-    DEVX_SET(qpc, qpc, log_page_size, get_page_size_log());
+    DEVX_SET(qpc, qpc, log_page_size, params.umem_sq->page_size_log() - 12);   // 4KB units
     DEVX_SET(qpc, qpc, page_offset, 0);
     DEVX_SET(qpc, qpc, log_rra_max, params.max_rd_atomic);
     DEVX_SET(qpc, qpc, ts_format, MLX5_CQE_TIMESTAMP_FORMAT_DEFAULT);
@@ -1109,21 +2871,106 @@ queue_pair::initialize(qp_init_creation_params& params) {
     _uar = params.uar_obj;
     _umem_sq = params.umem_sq;
     _umem_db = params.umem_db;
+    _send_cq = params.send_cq;
+
+    // The BF register is split in two halves used alternately by consecutive
+    // doorbells, so each WQE copy lands in a fresh write-combining buffer.
+    const hca_capabilities& caps = _rdevice->get_hca_cap();
+    if (!params.bf_buf_size && caps.log_bf_reg_size) {
+        params.bf_buf_size = (1u << caps.log_bf_reg_size) / 2;
+    }
+    if (params.use_bf && !caps.bf) {
+        log_info("Device does not support BlueFlame, using plain doorbells");
+        params.use_bf = false;
+    }
+
+    STATUS res = attach_wq_buffers(_umem_sq->addr(), _umem_db->addr(),
+                                   _uar->get()->reg_addr, params);
+    RETURN_IF_FAILED(res);
+
+    if (_send_cq) {
+        res = _send_cq->attach_qp(_qpn, this);
+        RETURN_IF_FAILED(res);
+    }
+
+    log_debug("Queue Pair initialized with qpn: %d, sq_size: %u", _qpn, _sq_size);
+
+    return STATUS_OK;
+}
+
+STATUS
+queue_pair::attach_wq_buffers(void* wq_buf, void* dbrec, void* uar_reg,
+                              qp_init_creation_params& params) {
+    if (!wq_buf || !dbrec || !uar_reg) {
+        return STATUS_INVALID_PARAM;
+    }
+
+    if (params.sq_size == 0 || (params.sq_size & (params.sq_size - 1))) {
+        log_error("SQ size %u is not a power of two", params.sq_size);
+        return STATUS_INVALID_SIZE;
+    }
+
+    _bf_buf_size = params.bf_buf_size ? params.bf_buf_size : MLX5_DEFAULT_BF_BUF_SIZE;
+    if (_bf_buf_size % MLX5_SEND_WQE_BB) {
+        log_error("BlueFlame buffer size %u is not a multiple of %d", _bf_buf_size, MLX5_SEND_WQE_BB);
+        return STATUS_INVALID_SIZE;
+    }
+    _bf_offset = 0;
+    _use_bf = params.use_bf;
+    _umr_atomic_disabled = params.rdevice &&
+                           params.rdevice->get_hca_cap().umr_modify_atomic_disabled;
 
-    _bf_buf_size = get_page_size();
-    
     // Initialize send queue parameters
     _sq_size = params.sq_size;
     _sq_pi = 0;
     _sq_ci = 0;
 
+    // With an SRQ the QP has no RQ and the SQ starts the WQ buffer
     const size_t rq_stride_bytes = 16u << MLX5_RQ_STRIDE;
-    size_t rq_bytes = params.rq_size * rq_stride_bytes;
+    _srq = params.srq;
+    _rq_size = _srq ? 0 : params.rq_size;
+    if (_rq_size & (_rq_size - 1)) {
+        log_error("RQ size %u is not a power of two", _rq_size);
+        return STATUS_INVALID_SIZE;
+    }
+    _rq_pi = 0;
+    _rq_ci = 0;
+    _rq_buf = static_cast<char*>(wq_buf);
+    _max_recv_sge = params.max_recv_sge ? params.max_recv_sge : 1;
+    if (_max_recv_sge > rq_stride_bytes / sizeof(mlx5_wqe_data_seg)) {
+        _max_recv_sge = rq_stride_bytes / sizeof(mlx5_wqe_data_seg);
+    }
+    size_t rq_bytes = _rq_size * rq_stride_bytes;
 
     _sq_buf_offset = (rq_bytes + RDMA_WQE_SEG_SIZE - 1) & ~(RDMA_WQE_SEG_SIZE - 1); // Base offset in the send queue buffer
     log_debug("Send queue buffer offset: %u", _sq_buf_offset);
-    
-    log_debug("Queue Pair initialized with qpn: %d, sq_size: %u", _qpn, _sq_size);
+
+    // A WQE's DS count is 6 bits: ctrl + raddr leave room for 61 data segments
+    _max_send_sge = params.max_send_sge ? params.max_send_sge : 1;
+    if (_max_send_sge > 61) {
+        _max_send_sge = 61;
+    }
+
+    // Inline payload shares the same DS budget: ctrl + raddr + 4-byte header
+    _max_inline = params.max_inline_data;
+    if (_max_inline > 61 * 16 - sizeof(mlx5_wqe_inline_seg)) {
+        _max_inline = 61 * 16 - sizeof(mlx5_wqe_inline_seg);
+    }
+
+    _sig_mode = params.sq_signal_mode;
+    _sig_period = params.sq_signal_period ? params.sq_signal_period : 1;
+    if (_sig_mode > QP_SIGNAL_ON_REQUEST) {
+        log_error("Invalid SQ signal mode %u", _sig_mode);
+        return STATUS_INVALID_PARAM;
+    }
+    _unsignaled = 0;
+    _unsignaled_bb = 0;
+    _sq_wqe_bb.assign(_sq_size, 0);
+
+    _sq_buf = static_cast<char*>(wq_buf) + _sq_buf_offset;
+    _sq_end = _sq_buf + (size_t)_sq_size * RDMA_WQE_SEG_SIZE;
+    _dbrec  = static_cast<volatile uint32_t*>(dbrec);
+    _db_reg = uar_reg;
 
     return STATUS_OK;
 }
@@ -1271,113 +3118,418 @@ queue_pair::rtr_to_rts(qp_init_connection_params &params)
 }
 
 #define RDMA_MAX_WQE_BB         4    // Maximum number of basic blocks per WQE
-#define MLX5_SEND_WQE_BB        64   // Basic block size for send WQEs
-#define MLX5_OPCODE_RDMA_WRITE  8    // RDMA Write opcode
-#define MLX5_OPCODE_RDMA_READ   12   // RDMA Read opcode
-#define MLX5_OPCODE_SEND        0    // Send opcode
-#define MLX5_OPCODE_SEND_IMM    1    // Send with immediate opcode
-#define MLX5_OPCODE_RDMA_WRITE_IMM 9 // RDMA Write with immediate opcode
+// MLX5_SEND_WQE_BB and the MLX5_OPCODE_* send opcodes come from mlx5dv.h
 
-// Implementation of the post_send method in queue_pair class
-STATUS queue_pair::post_send(struct mlx5_wqe_ctrl_seg* ctrl, unsigned wqe_size) {
-    if ((uintptr_t)ctrl % RDMA_WQE_SEG_SIZE != 0) {
-        log_error("WQE control segment not aligned to %d bytes", RDMA_WQE_SEG_SIZE);
-        return STATUS_ERR;
+// Account a fully built WQE in the SQ without telling the HCA about it yet
+void queue_pair::commit_wqe(struct mlx5_wqe_ctrl_seg* ctrl, unsigned wqe_size, uint32_t flags) {
+    uint16_t num_bb = (wqe_size + MLX5_SEND_WQE_BB - 1) / MLX5_SEND_WQE_BB;
+
+    bool signaled = (ctrl->fm_ce_se & MLX5_WQE_CTRL_CQ_UPDATE) || (flags & IBV_SEND_SIGNALED);
+    switch (_sig_mode) {
+    case QP_SIGNAL_ALL:
+        signaled = true;
+        break;
+    case QP_SIGNAL_EVERY_N:
+        signaled |= (_unsignaled + 1 >= _sig_period);
+        break;
+    default:
+        break;
+    }
+    // Only a CQE reclaims slots: never let the unsignaled run cover the SQ
+    signaled |= (_unsignaled_bb + num_bb >= _sq_size / 2);
+
+    if (signaled) {
+        ctrl->fm_ce_se |= MLX5_WQE_CTRL_CQ_UPDATE;
+        _unsignaled = 0;
+        _unsignaled_bb = 0;
+    } else {
+        _unsignaled++;
+        _unsignaled_bb += num_bb;
+    }
+
+    _sq_wqe_bb[_sq_pi & (_sq_size - 1)] = num_bb;
+    _sq_pi += num_bb;
+    _last_ctrl = ctrl;
+    _last_wqe_size = wqe_size;
+    _db_pending++;
+    log_dp_debug("Committed WQE, SQ producer index: %u, pending: %u, signaled: %d",
+                 _sq_pi, _db_pending, signaled);
+}
+
+void queue_pair::sq_complete(uint16_t wqe_counter) {
+    _sq_ci = wqe_counter + _sq_wqe_bb[wqe_counter & (_sq_size - 1)];
+    log_dp_debug("SQ completion up to WQE %u, consumer index: %u", wqe_counter, _sq_ci);
+}
+
+void queue_pair::complete(const cqe_out& cqe) {
+    // Flushed WQEs complete in error with a valid wqe_counter too
+    switch (cqe.opcode) {
+    case MLX5_CQE_REQ:
+    case MLX5_CQE_REQ_ERR:
+        sq_complete(cqe.wqe_counter);
+        break;
+    case MLX5_CQE_RESP_WR_IMM:
+    case MLX5_CQE_RESP_SEND:
+    case MLX5_CQE_RESP_SEND_IMM:
+    case MLX5_CQE_RESP_SEND_INV:
+    case MLX5_CQE_RESP_ERR:
+        if (_srq) {
+            // A striding SRQ reports a stride index here; its WQEs go back
+            // through consume()/release() instead
+            if (!_srq->is_striding()) {
+                _srq->srq_complete(cqe.wqe_counter);
+            }
+        } else {
+            rq_complete(cqe.wqe_counter);
+        }
+        break;
+    default:
+        break;
     }
+}
 
-    log_debug("Posting WQE at index %u, size %zu bytes", _sq_pi, wqe_size);
+int queue_pair::poll_send_cq(cqe_out* cqes, int max) {
+    if (unlikely(!_send_cq)) {
+        return 0;
+    }
 
-    uint16_t num_bb = (wqe_size + MLX5_SEND_WQE_BB - 1) / MLX5_SEND_WQE_BB;
-    uint16_t new_pi = _sq_pi + num_bb;
+    // Already completed when a waiting post reaped them
+    int n = 0;
+    while (unlikely(!_reaped.empty()) && n < max) {
+        cqes[n++] = _reaped.front();
+        _reaped.pop_front();
+    }
+
+    int polled = _send_cq->poll_cq(cqes + n, max - n);
+    for (int i = n; i < n + polled; ++i) {
+        if (owns_cqe(cqes[i])) {
+            complete(cqes[i]);
+        } else {
+            _send_cq->dispatch(cqes[i]);
+        }
+    }
+    return n + polled;
+}
+
+STATUS queue_pair::wait_sq_room(unsigned num_bb, uint32_t flags) {
+    log_dp_debug("SQ full: pi=%u ci=%u, need %u WQEBBs", _sq_pi, _sq_ci, num_bb);
+    if (!(flags & QP_POST_WAIT) || !_send_cq) {
+        return STATUS_WOULD_BLOCK;
+    }
+    if (unlikely(num_bb > _sq_size)) {
+        return STATUS_INVALID_SIZE;
+    }
+
+    // WQEs held back by QP_POST_NO_DOORBELL would never complete
+    ring_doorbell();
+
+    // Nothing reaped here is dropped: neighbours' CQEs are dispatched to
+    // them, our own go to the completion callback or wait in _reaped
+    cqe_out cqes[16];
+    STATUS res = STATUS_OK;
+    while (res == STATUS_OK && !sq_has_room(num_bb)) {
+        int n = _send_cq->poll_cq(cqes, 16);
+        for (int i = 0; i < n; ++i) {
+            if (!owns_cqe(cqes[i])) {
+                _send_cq->dispatch(cqes[i]);
+                continue;
+            }
+            complete(cqes[i]);
+            if (unlikely(cqes[i].opcode == MLX5_CQE_REQ_ERR)) {
+                log_error("Send CQE error while waiting for SQ room: qpn=0x%x syndrome=0x%x vendor=0x%x",
+                          cqes[i].qpn, cqes[i].syndrome, cqes[i].vendor_err_synd);
+                res = STATUS_ERR;
+            }
+            if (_comp_cb) {
+                notify(cqes[i]);
+            } else {
+                _reaped.push_back(cqes[i]);
+            }
+        }
+    }
+    return res;
+}
 
-    void *bf_reg = static_cast<char*>(_uar->get()->reg_addr) + _bf_offset;
+STATUS queue_pair::ring_doorbell() {
+    if (!_db_pending) {
+        return STATUS_OK;
+    }
 
-    unsigned bytecnt   = wqe_size; 
-    void *queue_start  = _umem_sq->addr();
-    void *queue_end    = static_cast<char*>(queue_start) + _sq_size * RDMA_WQE_SEG_SIZE;
+    void *bf_reg = static_cast<char*>(_db_reg) + _bf_offset;
 
+    // WQEs must be in memory before the doorbell record, and the record
+    // before the UAR write that makes the HCA read it.
     udma_to_device_barrier();
-    volatile uint32_t *dbrec = static_cast<volatile uint32_t*>(_umem_db->addr());
-    dbrec[MLX5_SND_DBR] = htobe32(new_pi & 0xffff); 
+    _dbrec[MLX5_SND_DBR] = htobe32(_sq_pi & 0xffff);
+    mmio_wc_start();
+
+    // BlueFlame carries a single WQE that fits one half of the register and
+    // replaces the doorbell; a chain is published by the 8-byte doorbell of
+    // its last control segment.
+    if (_use_bf && _db_pending == 1 && _last_wqe_size <= _bf_buf_size) {
+        bf_copy(bf_reg, _last_ctrl, _last_wqe_size, _sq_buf, _sq_end);
+    } else {
+        *(volatile uint64_t*)bf_reg = *(const uint64_t*)_last_ctrl;
+    }
     mmio_flush_writes();
 
-    if (unlikely(_use_bf)) bf_copy(bf_reg, ctrl, bytecnt, queue_start, queue_end);
-    mmio_write64_be(bf_reg, ctrl);
-   
     _bf_offset ^= _bf_buf_size;
-    _sq_pi = new_pi;
-    log_debug("Updated SQ producer index to: %u", _sq_pi);
+    log_dp_debug("Rang SQ doorbell, producer index: %u, WQEs: %u", _sq_pi, _db_pending);
+    _db_pending = 0;
+    _last_ctrl = nullptr;
     return STATUS_OK;
 }
 
+// Implementation of the post_send method in queue_pair class
+STATUS queue_pair::post_send(struct mlx5_wqe_ctrl_seg* ctrl, unsigned wqe_size) {
+    if (unlikely((uintptr_t)ctrl % RDMA_WQE_SEG_SIZE != 0)) {
+        log_error("WQE control segment not aligned to %d bytes", RDMA_WQE_SEG_SIZE);
+        return STATUS_ERR;
+    }
+
+    log_dp_debug("Posting WQE at index %u, size %u bytes", _sq_pi, wqe_size);
+
+    commit_wqe(ctrl, wqe_size, 0);
+    return ring_doorbell();
+}
+
 
 STATUS queue_pair::post_wqe(uint8_t opcode, void* laddr, uint32_t lkey,
                             void* raddr, uint32_t rkey, uint32_t length,
                             uint32_t imm_data, uint32_t flags) {
-    // Calculate WQE size based on segments needed
-    size_t wqe_size = sizeof(mlx5_wqe_ctrl_seg);
-    wqe_size += sizeof(mlx5_wqe_data_seg);
+    if ((flags & IBV_SEND_INLINE) && length <= _max_inline &&
+        opcode != MLX5_OPCODE_RDMA_READ) {
+        return post_wqe_inline(opcode, laddr, length, raddr, rkey, imm_data, flags);
+    }
+
+    ibv_sge sge = { (uintptr_t)laddr, length, lkey };
+    return post_wqe_sgl(opcode, &sge, 1, raddr, rkey, imm_data, flags);
+}
+
+STATUS queue_pair::post_wqe_inline(uint8_t opcode, const void* data, uint32_t length,
+                                   void* raddr, uint32_t rkey,
+                                   uint32_t imm_data, uint32_t flags) {
+    if (unlikely(length > _max_inline)) {
+        log_error("Inline length %u exceeds max inline %u", length, _max_inline);
+        return STATUS_INVALID_LENGTH;
+    }
+
     bool need_raddr = (opcode == MLX5_OPCODE_RDMA_WRITE ||
-                       opcode == MLX5_OPCODE_RDMA_WRITE_IMM ||
-                       opcode == MLX5_OPCODE_RDMA_READ);
+                       opcode == MLX5_OPCODE_RDMA_WRITE_IMM);
+
+    unsigned wqe_size = align64((1 + need_raddr + (sizeof(mlx5_wqe_inline_seg) + length + 15) / 16) * 16);
+    if (unlikely(!sq_has_room(wqe_size / MLX5_SEND_WQE_BB))) {
+        STATUS res = wait_sq_room(wqe_size / MLX5_SEND_WQE_BB, flags);
+        if (res != STATUS_OK) {
+            return res;
+        }
+    }
+
+    mlx5_wqe_ctrl_seg* ctrl = (mlx5_wqe_ctrl_seg*)(_sq_buf +
+                              (_sq_pi & (_sq_size - 1)) * RDMA_WQE_SEG_SIZE);
+
+    // Signaling is decided in commit_wqe()
+    uint8_t fm_ce_se = 0;
+    uint32_t imm = 0;
+
+    char* segment = (char*)(ctrl + 1);
+    uint8_t ds = 1;
     if (need_raddr) {
-        wqe_size += sizeof(mlx5_wqe_raddr_seg);
+        mlx5_set_rdma_seg((mlx5_wqe_raddr_seg*)segment, raddr, (uintptr_t)rkey);
+        segment += sizeof(struct mlx5_wqe_raddr_seg);
+        ds++;
+    }
+
+    // The inline header sits in the first WQEBB; the payload right behind it
+    // may run past the end of the SQ and continue at its start.
+    mlx5_wqe_inline_seg* inl = (mlx5_wqe_inline_seg*)segment;
+    inl->byte_count = htobe32(length | MLX5_INLINE_SEG);
+
+    char* dst = segment + sizeof(*inl);
+    size_t room = _sq_end - dst;
+    if (likely(length <= room)) {
+        memcpy(dst, data, length);
+    } else {
+        memcpy(dst, data, room);
+        memcpy(_sq_buf, (const char*)data + room, length - room);
+    }
+    ds += (sizeof(*inl) + length + 15) / 16;
+
+    log_dp_debug("Post inline WQE: idx=%u ctrl=%p opcode=0x%x length=%u raddr=%p rkey=0x%x "
+                 "flags=0x%x qpn=0x%x ds=%u",
+                 _sq_pi, ctrl, opcode, length, raddr, rkey, flags, _qpn, ds);
+
+    if (opcode == MLX5_OPCODE_SEND_IMM || opcode == MLX5_OPCODE_RDMA_WRITE_IMM) {
+        imm = htobe32(imm_data);
+    }
+    mlx5_set_ctrl_seg(ctrl, _sq_pi, opcode, 0, _qpn, fm_ce_se, ds, 0, imm);
+
+    commit_wqe(ctrl, wqe_size, flags);
+    if (flags & QP_POST_NO_DOORBELL) {
+        return STATUS_OK;
+    }
+    return ring_doorbell();
+}
+
+STATUS queue_pair::post_wqe_sgl(uint8_t opcode, const ibv_sge* sgl, uint32_t num_sge,
+                                void* raddr, uint32_t rkey,
+                                uint32_t imm_data, uint32_t flags) {
+    if (unlikely(num_sge > _max_send_sge)) {
+        log_error("Too many SGEs: %u (max %u)", num_sge, _max_send_sge);
+        return STATUS_INVALID_PARAM;
     }
-    wqe_size = (wqe_size + RDMA_WQE_SEG_SIZE - 1) & ~(RDMA_WQE_SEG_SIZE - 1);
 
-    mlx5_wqe_ctrl_seg* ctrl = (mlx5_wqe_ctrl_seg*)((char*)_umem_sq->addr() +
-                              _sq_buf_offset + (_sq_pi % _sq_size) * RDMA_WQE_SEG_SIZE);
-    log_debug("Posting WQE at index %u, size %zu bytes", _sq_pi, wqe_size);
-    log_debug("WQE control segment at %p", ctrl);
+    bool need_raddr = (opcode == MLX5_OPCODE_RDMA_WRITE ||
+                       opcode == MLX5_OPCODE_RDMA_WRITE_IMM ||
+                       opcode == MLX5_OPCODE_RDMA_READ);
+
+    // Zero-length SGEs are skipped below, so this bounds the WQE size
+    unsigned max_bb = align64((1 + need_raddr + num_sge) * 16) / MLX5_SEND_WQE_BB;
+    if (unlikely(!sq_has_room(max_bb))) {
+        STATUS res = wait_sq_room(max_bb, flags);
+        if (res != STATUS_OK) {
+            return res;
+        }
+    }
 
-    memset(ctrl, 0, wqe_size);
+    // Every segment below is written in full, so the slot needs no memset;
+    // the HCA ignores whatever follows the last DS.
+    mlx5_wqe_ctrl_seg* ctrl = (mlx5_wqe_ctrl_seg*)(_sq_buf +
+                              (_sq_pi & (_sq_size - 1)) * RDMA_WQE_SEG_SIZE);
 
-    uint8_t num_data_seg = 1;
-    uint8_t ds = (need_raddr ? 2 : 1) + num_data_seg;
-    uint8_t fm_ce_se = MLX5_WQE_CTRL_CQ_UPDATE;
+    uint8_t fm_ce_se = 0;   // signaling is decided in commit_wqe()
     uint8_t signature = 0;
     uint8_t opmod = 0;
     uint32_t imm = 0;
 
-    log_debug("Post WQE with parameters:");
-    log_debug("  opcode: 0x%x", opcode);
-    log_debug("  laddr: %p", laddr);
-    log_debug("  lkey: 0x%x", lkey);
-    log_debug("  raddr: 0x%lx", raddr);
-    log_debug("  rkey: 0x%x", rkey);
-    log_debug("  length: %u", length);
-    log_debug("  flags: 0x%x", flags);
-    log_debug("  need_raddr: %s", need_raddr ? "true" : "false");
-    log_debug("  num_data_seg: %u", num_data_seg);
-
-
-    log_debug("Calling mlx5dv_set_ctrl_seg with:");
-    log_debug("  ctrl_addr: %p", ctrl);
-    log_debug("  wqe_index: %u", _sq_pi); // Assuming _sq_pi is the correct index here
-    log_debug("  opcode: 0x%x", opcode);
-    log_debug("  opmod: 0x%x", opmod);
-    log_debug("  qpn: 0x%x", _qpn);
-    log_debug("  fm_ce_se: 0x%x", fm_ce_se); // <<< Check this value! Should be 2
-    log_debug("  ds: %u", ds);
-    log_debug("  signature: 0x%x", signature);
-    log_debug("  imm: 0x%x", imm_data);
+    // Control and remote address segments always fit in the first WQEBB
+    char* segment = (char*)(ctrl + 1);
+    uint8_t ds = 1;
+    if (need_raddr) {
+        mlx5_wqe_raddr_seg* raddr_seg = (mlx5_wqe_raddr_seg*)segment;
+        mlx5_set_rdma_seg(raddr_seg, raddr, (uintptr_t)rkey);
+        segment += sizeof(struct mlx5_wqe_raddr_seg);
+        ds++;
+    }
+
+    // Data segments may run past the end of the SQ and wrap to its start
+    for (uint32_t i = 0; i < num_sge; ++i) {
+        if (unlikely(!sgl[i].length)) {
+            continue;
+        }
+        if (unlikely(segment == _sq_end)) {
+            segment = _sq_buf;
+        }
+        mlx5_set_data_seg((mlx5_wqe_data_seg*)segment, sgl[i].length, sgl[i].lkey, sgl[i].addr);
+        segment += sizeof(struct mlx5_wqe_data_seg);
+        ds++;
+    }
+
+    unsigned wqe_size = align64(ds * 16);
+
+    log_dp_debug("Post WQE: idx=%u ctrl=%p opcode=0x%x num_sge=%u raddr=%p rkey=0x%x "
+                 "flags=0x%x qpn=0x%x ds=%u fm_ce_se=0x%x imm=0x%x",
+                 _sq_pi, ctrl, opcode, num_sge, raddr, rkey,
+                 flags, _qpn, ds, fm_ce_se, imm_data);
 
     if (opcode == MLX5_OPCODE_SEND_IMM || opcode == MLX5_OPCODE_RDMA_WRITE_IMM) {
         imm = htobe32(imm_data);
     }
     mlx5_set_ctrl_seg(ctrl, _sq_pi, opcode, opmod, _qpn, fm_ce_se, ds, signature, imm);
 
-    void* segment = ctrl + 1;
-    if (need_raddr) {
+    if constexpr (k_datapath_log_level >= LOG_LEVEL_DEBUG) {
+        dump_wqe((unsigned char*)ctrl);
+    }
+
+    commit_wqe(ctrl, wqe_size, flags);
+    if (flags & QP_POST_NO_DOORBELL) {
+        return STATUS_OK;
+    }
+    return ring_doorbell();
+}
+
+STATUS
+queue_pair::make_wqe_template(wqe_template& tmpl, uint8_t opcode,
+                              uint32_t rkey, uint32_t lkey,
+                              uint32_t flags, uint32_t imm_data) const {
+    bool has_imm = false;
+    switch (opcode) {
+    case MLX5_OPCODE_SEND:
+    case MLX5_OPCODE_RDMA_WRITE:
+    case MLX5_OPCODE_RDMA_READ:
+        break;
+    case MLX5_OPCODE_SEND_IMM:
+    case MLX5_OPCODE_RDMA_WRITE_IMM:
+        has_imm = true;
+        break;
+    default:
+        log_error("Unsupported template opcode 0x%x", opcode);
+        return STATUS_INVALID_PARAM;
+    }
+
+    memset(&tmpl, 0, sizeof(tmpl));
+    tmpl.has_raddr = (opcode == MLX5_OPCODE_RDMA_WRITE ||
+                      opcode == MLX5_OPCODE_RDMA_WRITE_IMM ||
+                      opcode == MLX5_OPCODE_RDMA_READ);
+    tmpl.flags = flags;
+
+    uint8_t ds = tmpl.has_raddr ? 3 : 2;
+    mlx5_set_ctrl_seg(&tmpl.ctrl, 0, opcode, 0, _qpn, 0, ds, 0,
+                      has_imm ? htobe32(imm_data) : 0);
+    tmpl.qpn_ds_nodata = htobe32((_qpn << 8) | (ds - 1));
+    mlx5_set_rdma_seg(&tmpl.raddr, nullptr, rkey);
+    mlx5_set_data_seg(&tmpl.data, 0, lkey, 0);
+
+    return STATUS_OK;
+}
+
+STATUS
+queue_pair::post_template(const wqe_template& tmpl, void* laddr,
+                          void* raddr, uint32_t length, uint32_t flags) {
+    flags |= tmpl.flags;
+
+    // ctrl + raddr + data is at most 48 bytes: one WQEBB, no wrap
+    if (unlikely(!sq_has_room(1))) {
+        STATUS res = wait_sq_room(1, flags);
+        if (res != STATUS_OK) {
+            return res;
+        }
+    }
+
+    char* slot = _sq_buf + (_sq_pi & (_sq_size - 1)) * RDMA_WQE_SEG_SIZE;
+    mlx5_wqe_ctrl_seg* ctrl = (mlx5_wqe_ctrl_seg*)slot;
+    char* segment = slot + sizeof(mlx5_wqe_ctrl_seg);
+
+    memcpy(ctrl, &tmpl.ctrl, sizeof(tmpl.ctrl));
+    ctrl->opmod_idx_opcode = tmpl.ctrl.opmod_idx_opcode | htobe32((_sq_pi & 0xffff) << 8);
+
+    if (tmpl.has_raddr) {
         mlx5_wqe_raddr_seg* raddr_seg = (mlx5_wqe_raddr_seg*)segment;
-        mlx5_set_rdma_seg(raddr_seg, raddr, (uintptr_t)rkey);
-        segment = (void*)((char*)segment + sizeof(struct mlx5_wqe_raddr_seg));
+        raddr_seg->raddr    = htobe64((uintptr_t)raddr);
+        raddr_seg->rkey     = tmpl.raddr.rkey;
+        raddr_seg->reserved = 0;
+        segment += sizeof(mlx5_wqe_raddr_seg);
+    }
+
+    // A zero byte_count means 2GB to the HCA, so an empty post has no data
+    // segment, as in post_wqe_sgl()
+    if (likely(length)) {
+        mlx5_wqe_data_seg* dseg = (mlx5_wqe_data_seg*)segment;
+        dseg->byte_count = htobe32(length);
+        dseg->lkey       = tmpl.data.lkey;
+        dseg->addr       = htobe64((uintptr_t)laddr);
+    } else {
+        ctrl->qpn_ds = tmpl.qpn_ds_nodata;
     }
-    mlx5_wqe_data_seg* data_seg = (mlx5_wqe_data_seg*)segment;
-    mlx5_set_data_seg(data_seg, length, lkey, (uintptr_t)laddr);
-    dump_wqe((unsigned char*)ctrl);
 
-    return post_send(ctrl, wqe_size);
+    log_dp_debug("Post template WQE: idx=%u ctrl=%p length=%u raddr=%p",
+                 _sq_pi, ctrl, length, raddr);
+
+    commit_wqe(ctrl, RDMA_WQE_SEG_SIZE, flags);
+    if (flags & QP_POST_NO_DOORBELL) {
+        return STATUS_OK;
+    }
+    return ring_doorbell();
 }
 
 // Implementations of the convenience methods
@@ -1416,6 +3568,124 @@ queue_pair::post_rdma_write_imm(void* laddr, uint32_t lkey,
     return post_wqe(MLX5_OPCODE_RDMA_WRITE_IMM, laddr, lkey, raddr, rkey, length, imm_data, flags);
 }
 
+STATUS
+queue_pair::post_rdma_write_sgl(const ibv_sge* sgl, uint32_t num_sge,
+                                void* raddr, uint32_t rkey, uint32_t flags) {
+    return post_wqe_sgl(MLX5_OPCODE_RDMA_WRITE, sgl, num_sge, raddr, rkey, 0, flags);
+}
+
+STATUS
+queue_pair::post_rdma_read_sgl(const ibv_sge* sgl, uint32_t num_sge,
+                               void* raddr, uint32_t rkey, uint32_t flags) {
+    return post_wqe_sgl(MLX5_OPCODE_RDMA_READ, sgl, num_sge, raddr, rkey, 0, flags);
+}
+
+STATUS
+queue_pair::post_rdma_write_inline(const void* data, uint32_t length,
+                                   void* raddr, uint32_t rkey, uint32_t flags) {
+    return post_wqe_inline(MLX5_OPCODE_RDMA_WRITE, data, length, raddr, rkey, 0, flags);
+}
+
+STATUS
+queue_pair::post_send_inline(const void* data, uint32_t length, uint32_t flags) {
+    return post_wqe_inline(MLX5_OPCODE_SEND, data, length, nullptr, 0, 0, flags);
+}
+
+STATUS
+queue_pair::post_send_sgl(const ibv_sge* sgl, uint32_t num_sge, uint32_t flags) {
+    return post_wqe_sgl(MLX5_OPCODE_SEND, sgl, num_sge, nullptr, 0, 0, flags);
+}
+
+STATUS
+queue_pair::post_umr(uint32_t mkey, const mkey_layout& layout,
+                     uint32_t access, uint32_t flags) {
+    const uint32_t num_entries = layout.entries.size();
+    if (unlikely(!num_entries || num_entries > UMR_MAX_INLINE_ENTRIES)) {
+        log_error("UMR list of %u entries (max %u inline)", num_entries, UMR_MAX_INLINE_ENTRIES);
+        return STATUS_INVALID_SIZE;
+    }
+
+    const uint32_t octwords = tlx_align_up_pow2(num_entries, 4U);
+    const unsigned num_bb = 2 + octwords / 4;
+    const unsigned wqe_size = num_bb * MLX5_SEND_WQE_BB;
+    if (unlikely(num_bb > _sq_size)) {
+        return STATUS_INVALID_SIZE;
+    }
+    if (unlikely(!sq_has_room(num_bb))) {
+        STATUS res = wait_sq_room(num_bb, flags);
+        if (res != STATUS_OK) {
+            return res;
+        }
+    }
+
+    // Every part of the WQE is a whole WQEBB, each of which may wrap
+    auto wqebb = [this](unsigned i) {
+        return _sq_buf + ((_sq_pi + i) & (_sq_size - 1)) * RDMA_WQE_SEG_SIZE;
+    };
+
+    mlx5_wqe_ctrl_seg* ctrl = (mlx5_wqe_ctrl_seg*)wqebb(0);
+    mlx5_wqe_umr_ctrl_seg* umr = (mlx5_wqe_umr_ctrl_seg*)(ctrl + 1);
+    memset(umr, 0, sizeof(*umr));
+    umr->flags         = MLX5_WQE_UMR_CTRL_FLAG_INLINE;
+    umr->klm_octowords = htobe16(octwords);
+    // Like the kernel, leave the atomic bit alone where the HCA refuses to modify it
+    uint64_t mkey_mask = MLX5_WQE_UMR_CTRL_MKEY_MASK_LEN |
+                         MLX5_WQE_UMR_CTRL_MKEY_MASK_START_ADDR |
+                         MLX5_WQE_UMR_CTRL_MKEY_MASK_ACCESS_LOCAL_WRITE |
+                         MLX5_WQE_UMR_CTRL_MKEY_MASK_ACCESS_REMOTE_READ |
+                         MLX5_WQE_UMR_CTRL_MKEY_MASK_ACCESS_REMOTE_WRITE |
+                         MLX5_WQE_UMR_CTRL_MKEY_MASK_FREE;
+    if (!_umr_atomic_disabled) {
+        mkey_mask |= MLX5_WQE_UMR_CTRL_MKEY_MASK_ACCESS_ATOMIC;
+    }
+    umr->mkey_mask     = htobe64(mkey_mask);
+
+    uint8_t access_flags = MLX5_WQE_MKEY_CONTEXT_ACCESS_FLAGS_LOCAL_READ;
+    if (access & IBV_ACCESS_LOCAL_WRITE) {
+        access_flags |= MLX5_WQE_MKEY_CONTEXT_ACCESS_FLAGS_LOCAL_WRITE;
+    }
+    if (access & IBV_ACCESS_REMOTE_READ) {
+        access_flags |= MLX5_WQE_MKEY_CONTEXT_ACCESS_FLAGS_REMOTE_READ;
+    }
+    if (access & IBV_ACCESS_REMOTE_WRITE) {
+        access_flags |= MLX5_WQE_MKEY_CONTEXT_ACCESS_FLAGS_REMOTE_WRITE;
+    }
+    if ((access & IBV_ACCESS_REMOTE_ATOMIC) && !_umr_atomic_disabled) {
+        access_flags |= MLX5_WQE_MKEY_CONTEXT_ACCESS_FLAGS_ATOMIC;
+    }
+
+    mlx5_wqe_mkey_context_seg* mk = (mlx5_wqe_mkey_context_seg*)wqebb(1);
+    memset(mk, 0, MLX5_SEND_WQE_BB);
+    mk->access_flags              = access_flags;
+    mk->qpn_mkey                  = htobe32(0xffffff00 | (mkey & 0xff));
+    mk->start_addr                = 0;
+    mk->len                       = htobe64(layout.length);
+    mk->translations_octword_size = htobe32(octwords);
+    // No page size in mkey_mask: the entity size stays the one the mkey was
+    // created with, which indirect_mkey::update() checks
+
+    // Four entries per WQEBB, the last one zero padded
+    for (uint32_t i = 0; i < num_entries; i += 4) {
+        char* dst = wqebb(2 + i / 4);
+        uint32_t cnt = std::min(num_entries - i, 4U);
+        memcpy(dst, &layout.entries[i], cnt * sizeof(mlx5_wqe_umr_klm_seg));
+        memset(dst + cnt * sizeof(mlx5_wqe_umr_klm_seg), 0,
+               (4 - cnt) * sizeof(mlx5_wqe_umr_klm_seg));
+    }
+
+    log_dp_debug("Post UMR WQE: idx=%u mkey=0x%x entries=%u length=%lu access=0x%x qpn=0x%x",
+                 _sq_pi, mkey, num_entries, layout.length, access, _qpn);
+
+    mlx5_set_ctrl_seg(ctrl, _sq_pi, MLX5_OPCODE_UMR, 0, _qpn,
+                      MLX5_WQE_CTRL_INITIATOR_SMALL_FENCE, wqe_size / 16, 0, htobe32(mkey));
+
+    commit_wqe(ctrl, wqe_size, flags);
+    if (flags & QP_POST_NO_DOORBELL) {
+        return STATUS_OK;
+    }
+    return ring_doorbell();
+}
+
 STATUS 
 queue_pair::query_qp_counters(uint32_t* hw_counter,
                               uint32_t* sw_counter,
@@ -1455,12 +3725,45 @@ queue_pair::query_qp_counters(uint32_t* hw_counter,
     return STATUS_OK;
 }
 
-// Implement the empty post_recv method from the header
-STATUS queue_pair::post_recv() {
-    // Implementation for posting receive WQEs
-    // This would follow a similar pattern but use the receive queue
-    log_error("post_recv not yet implemented");
-    return STATUS_NOT_IMPLEMENTED;
+STATUS queue_pair::post_recv(const ibv_sge* sgl, uint32_t num_sge) {
+    if (unlikely(_srq)) {
+        return STATUS_INVALID_OPERATION;
+    }
+    if (unlikely(num_sge > _max_recv_sge)) {
+        log_error("Too many receive SGEs: %u (max %u)", num_sge, _max_recv_sge);
+        return STATUS_INVALID_PARAM;
+    }
+    if (unlikely(!rq_available())) {
+        return STATUS_WOULD_BLOCK;
+    }
+
+    char* wqe = _rq_buf + (_rq_pi & (_rq_size - 1)) * (16u << MLX5_RQ_STRIDE);
+    set_recv_data_segs(wqe, sgl, num_sge, _max_recv_sge);
+    _rq_pi++;
+
+    udma_to_device_barrier();
+    _dbrec[MLX5_RCV_DBR] = htobe32(_rq_pi & 0xffff);
+    return STATUS_OK;
+}
+
+STATUS queue_pair::post_recv_batch(const ibv_sge* sges, uint32_t count) {
+    if (unlikely(_srq)) {
+        return STATUS_INVALID_OPERATION;
+    }
+    if (unlikely(count > rq_available())) {
+        return STATUS_WOULD_BLOCK;
+    }
+
+    for (uint32_t i = 0; i < count; ++i) {
+        char* wqe = _rq_buf + ((_rq_pi + i) & (_rq_size - 1)) * (16u << MLX5_RQ_STRIDE);
+        set_recv_data_segs(wqe, &sges[i], 1, _max_recv_sge);
+    }
+    _rq_pi += count;
+
+    udma_to_device_barrier();
+    _dbrec[MLX5_RCV_DBR] = htobe32(_rq_pi & 0xffff);
+    log_dp_debug("Posted %u RQ WQEs, producer index: %u", count, _rq_pi);
+    return STATUS_OK;
 }
 
 // Implementation for queue_pair::get()
@@ -8,8 +8,12 @@
 #include <chrono>
 #include <vector>
 #include <map>
+#include <list>
+#include <deque>
 #include <cstddef>
 #include <cstdint>
+#include <memory>
+#include <mutex>
 
 #include "mlx5_ifc.h"
 #include "../common/rdma_common.h"
@@ -18,6 +22,13 @@
 
 #define MLX5_RQ_STRIDE          2
 #define RDMA_WQE_SEG_SIZE       64
+#define MLX5_DEFAULT_BF_BUF_SIZE 256
+
+/* byte_cnt of a striding-RQ receive CQE */
+#define MLX5_MPRQ_LEN_MASK          0x0000ffff
+#define MLX5_MPRQ_STRIDE_NUM_MASK   0x3fff0000
+#define MLX5_MPRQ_STRIDE_NUM_SHIFT  16
+#define MLX5_MPRQ_FILLER_MASK       0x80000000
 
 inline void dump_wqe(unsigned char* wqe_buf) {
     for (int i = 0; i < 64; i += 16) {
@@ -85,6 +96,20 @@ struct hca_capabilities {
     uint8_t log_max_xrq;
     uint8_t native_port_num;
     uint8_t num_ports;
+    uint8_t bf;
+    uint8_t log_bf_reg_size;
+    uint8_t cqe_compression;
+    uint8_t mini_cqe_resp_stride_index;
+    uint8_t umr_modify_atomic_disabled;
+    uint64_t odp_general_caps;      /* IBV_ODP_SUPPORT* */
+    uint32_t odp_rc_caps;           /* IBV_ODP_SUPPORT_SEND/RECV/WRITE/READ/ATOMIC */
+};
+
+/* Kernel ODP statistics, summed over the device's on-demand MRs */
+struct odp_counters {
+    uint64_t page_faults;
+    uint64_t page_invalidations;
+    uint64_t page_prefetch;
 };
 
 //==============================================================================
@@ -144,6 +169,16 @@ public:
         return _hca_cap;
     }
 
+    /* ODP fault, invalidation and prefetch counts of every on-demand MR on
+       this device visible to the process, from the RDMA netlink statistics.
+       STATUS_NOT_IMPLEMENTED when the kernel does not report them. */
+    STATUS query_odp_counters(odp_counters* counters) const;
+
+    /* Adds the ODP counters of one netlink STAT_GET dump reply to *counters;
+       sets *done once the reply carries NLMSG_DONE or NLMSG_ERROR. */
+    static STATUS parse_odp_counters(const void* reply, size_t len,
+                                     odp_counters* counters, bool* done);
+
 private:
     struct ibv_device** _device_list;
     struct ibv_device* _device;
@@ -183,17 +218,34 @@ public:
     ~user_memory();
     void destroy() override;
     STATUS initialize(ibv_context* context, size_t size);
+
+    /* Allocate on the pages chosen by policy (see page_buffer_alloc());
+       page_size_log() reports what was obtained. alloc_flags are
+       mem_alloc_flags. */
+    STATUS initialize(ibv_context* context, size_t size, mem_page_policy policy,
+                      uint32_t alloc_flags = 0);
+
+    /* Register the pages spanning a caller-owned buffer instead of allocating
+       one. addr() is then the first of those pages; the buffer stays the
+       caller's and is not freed by destroy(). */
+    STATUS register_buffer(ibv_context* context, void* buf, size_t size);
+
     mlx5dv_devx_umem* get() const;
     void* addr() const;
     size_t size() const;
     uint32_t umem_id() const;
     void* get_umem_buf() const { return _umem_buf; }
+    bool owns_buffer() const { return _owns_buf; }
+    unsigned page_size_log() const { return _page_log; }
 
 private:
     mlx5dv_devx_umem* _umem;
     size_t _size;
     uint32_t _umem_id;
     void* _umem_buf;
+    bool _owns_buf;
+    unsigned _page_log;
+    page_buffer _pages;
 };
 
 //==============================================================================
@@ -205,7 +257,7 @@ public:
     uar();
     ~uar();
     void destroy() override;
-    STATUS initialize(ibv_context* ctx);
+    STATUS initialize(ibv_context* ctx, uint32_t alloc_type = MLX5DV_UAR_ALLOC_TYPE_NC);
     mlx5dv_devx_uar* get() const;
 
 private:
@@ -251,11 +303,42 @@ enum CQE_TIMESTAMP_FORMAT {
     MLX5_CQE_TIMESTAMP_FORMAT_FREE_RUNNING = 2
 };
 
+/*
+CQE compression: a session starts with a title CQE (cqe_format 3) whose
+byte_cnt is the number of mini CQEs that follow and whose remaining fields
+are shared by all of them. Mini CQEs come packed eight to a 64-byte slot:
+the first array right after the title, array j > 0 in the slot of mini 8j.
+*/
+#define MLX5_CQE_FORMAT_COMPRESSED  0x3
+#define MLX5_MINI_CQE_ARRAY_SIZE    8
+
+enum MINI_CQE_RES_FORMAT {
+    MLX5_MINI_CQE_FORMAT_HASH        = 0,   /* rx hash result + byte_cnt        */
+    MLX5_MINI_CQE_FORMAT_CSUM_STRIDX = 2    /* checksum + stride index + byte_cnt */
+};
+
+struct mlx5_mini_cqe8 {
+    union {
+        __be32 rx_hash_result;
+        struct {
+            __be16 checksum;
+            __be16 stride_idx;
+        };
+        struct {
+            __be16  wqe_counter;
+            uint8_t s_wqe_opcode;
+            uint8_t reserved;
+        } s_wqe_info;                       /* requester sessions */
+    };
+    __be32 byte_cnt;
+};
+
 struct cq_hw_params
 {
     uint8_t  log_cq_size              = 9;
-    uint8_t  log_page_size            = get_page_size_log(); // Added for CQ page size
-    uint8_t  cqe_sz                   = 1;
+    uint8_t  log_page_size            = get_page_size_log(); // CQ buffer page size, set from the buffer obtained
+    uint8_t  page_policy              = MEM_PAGE_DEFAULT;    // mem_page_policy of the CQE buffer
+    uint8_t  cqe_sz                   = 0;   /* 0: 64-byte CQEs, 1: 128-byte CQEs */
     bool     cqe_comp_en              = false;
     uint8_t  cqe_comp_layout          = 0;
     uint8_t  mini_cqe_res_format      = 0;
@@ -271,6 +354,37 @@ struct cq_hw_params
     uint8_t  st                       = 0;
 };
 
+/* Decoded completion handed back by the batched poller (host byte order) */
+struct cqe_out {
+    uint64_t timestamp;
+    uint32_t qpn;
+    uint32_t byte_cnt;
+    uint32_t imm;              /* immediate data / invalidated rkey         */
+    uint16_t wqe_counter;      /* stride index on a striding RQ             */
+    uint16_t wqe_id;           /* WQE index on a striding RQ                */
+    uint8_t  opcode;           /* MLX5_CQE_REQ, MLX5_CQE_RESP_*, *_ERR      */
+    uint8_t  syndrome;         /* valid for MLX5_CQE_REQ_ERR / RESP_ERR     */
+    uint8_t  vendor_err_synd;
+    const uint8_t* inline_data; /* scatter-to-CQE payload (byte_cnt bytes) in
+                                   the CQ ring, nullptr when the data went to
+                                   the receive buffer; read it before the slot
+                                   can be reused                            */
+};
+
+class queue_pair;
+struct mkey_layout;
+
+/* poll_cq() prefetches the CQE this many entries past the one it decodes */
+#define CQ_PREFETCH_AHEAD 2
+
+/* Shared CQ qpn->QP table: 4K pages of 4K entries cover the 24-bit QPN */
+#define CQ_QP_TABLE_SHIFT 12
+#define CQ_QP_TABLE_MASK  ((1u << CQ_QP_TABLE_SHIFT) - 1)
+
+static inline bool cqe_is_error(const cqe_out& cqe) {
+    return cqe.opcode == MLX5_CQE_REQ_ERR || cqe.opcode == MLX5_CQE_RESP_ERR;
+}
+
 class completion_queue_devx : public base_object {
     public:
         completion_queue_devx();
@@ -278,9 +392,17 @@ class completion_queue_devx : public base_object {
         void destroy() override;
         STATUS initialize(rdma_device* rdevice, cq_hw_params& params);
 
+        /* Reap up to @max CQEs; the CI doorbell record is written once per call */
+        int    poll_cq(cqe_out* cqes, int max);
         STATUS poll_cq();
         STATUS arm_cq(int solicited = 0);
 
+        /* Bind the poller to a CQE ring, its doorbell record and UAR page.
+           Called by initialize_cq_resources(); host-only tests pass plain memory. */
+        STATUS attach_cq_buffers(void* cqe_buf, void* dbrec, void* uar_reg,
+                                 cq_hw_params& params);
+        uint32_t get_consumer_index() const { return _consumer_index; }
+
         void cq_event() { _arm_sn++; }
         struct mlx5dv_devx_obj* get() const { return _cq; }
         uint32_t get_cqn() const { return _cqn; }
@@ -290,7 +412,30 @@ class completion_queue_devx : public base_object {
 
         void set_cq_hw_params(cq_hw_params& params);
         cq_hw_params get_cq_hw_params() const;
+
+        /* Shared CQ: QPs attached under their QPN have completions routed to
+           them in O(1). queue_pair::initialize() attaches QPs created with a
+           send_cq and destroy() detaches them. */
+        STATUS attach_qp(uint32_t qpn, queue_pair* qp);
+        void   detach_qp(uint32_t qpn, queue_pair* qp);
+        queue_pair* lookup_qp(uint32_t qpn) const {
+            uint32_t page = qpn >> CQ_QP_TABLE_SHIFT;
+            if (page >= _qp_table.size() || !_qp_table[page]) return nullptr;
+            return _qp_table[page][qpn & CQ_QP_TABLE_MASK];
+        }
+        uint32_t get_num_qps() const { return _num_qps; }
+
+        /* Poll like poll_cq() and hand every CQE to its attached QP:
+           queue_pair::complete() plus the QP's completion callback. All CQEs
+           are still returned; those of unknown QPNs are left to the caller. */
+        int poll_dispatch(cqe_out* cqes, int max);
+
+        /* Route one CQE to its attached QP; false when the QPN is unknown */
+        bool dispatch(const cqe_out& cqe);
     private:
+        int      expand_mini_cqes(cqe_out* cqes, int max);
+        uint32_t close_session();
+
         auto_ref<user_memory> _umem;
         auto_ref<user_memory> _umem_db;
         auto_ref<uar> _uar;
@@ -299,9 +444,178 @@ class completion_queue_devx : public base_object {
         uint32_t _cqn;
         cq_hw_params _cq_hw_params;
 
-        __uint128_t _consumer_index;
-        __uint128_t _producer_index;
+        /* Raw ring view used by the data path */
+        uint8_t*           _cqe_buf;
+        volatile uint32_t* _dbrec;
+        void*              _uar_reg;
+        uint32_t           _cqe_cnt;
+        uint32_t           _cqe_size;
+
+        uint32_t    _consumer_index;
         __uint128_t _arm_sn;
+
+        std::vector<std::unique_ptr<queue_pair*[]>> _qp_table;
+        uint32_t                                     _num_qps = 0;
+
+        /* Open compressed session; the CI stays on the title until it is drained */
+        cqe_out     _title;
+        uint32_t    _title_ci;
+        uint32_t    _mini_cnt;
+        uint32_t    _mini_idx;
+};
+
+//==============================================================================
+// Completion Channel
+//==============================================================================
+
+/* Delivers CQ completion events through one pollable fd. initialize() backs
+   it with a DEVX event channel; host-only tests attach an eventfd instead,
+   which then stands for a single subscribed CQ. */
+class completion_channel : public base_object {
+    public:
+        completion_channel();
+        ~completion_channel();
+        void destroy() override;
+        STATUS initialize(rdma_device* rdevice);
+        STATUS attach_fd(int fd);
+
+        STATUS subscribe(completion_queue_devx* cq);
+
+        /* Wait up to @timeout_ms (-1: forever) for an event and return the CQ
+           that raised it; STATUS_NO_DATA on timeout. Acknowledges the event,
+           so the CQ must be re-armed for the next one. */
+        STATUS get_event(completion_queue_devx** cq, int timeout_ms);
+
+        int get_fd() const { return _fd; }
+    private:
+        mlx5dv_devx_event_channel* _channel;
+        int                        _fd;
+        completion_queue_devx*     _fd_cq;
+};
+
+/* Busy-poll for a spin budget, then arm and sleep on the channel. The budget
+   adapts between min_spin_ns and max_spin_ns: it doubles when a sleep ends
+   within the current budget (spinning longer would have caught it) and halves
+   when the CQ stays idle for several budgets. */
+struct cq_wait_params {
+    uint32_t spin_ns     = 20000;
+    uint32_t min_spin_ns = 1000;
+    uint32_t max_spin_ns = 200000;
+    int      timeout_ms  = -1;
+};
+
+class cq_waiter {
+    public:
+        cq_waiter(completion_queue_devx* cq, completion_channel* channel,
+                  const cq_wait_params& params = cq_wait_params());
+
+        /* Reap up to @max CQEs, sleeping if none arrive within the spin budget.
+           The channel must carry events for this CQ only.
+           Returns 0 on timeout, -1 on a channel error. */
+        int wait(cqe_out* cqes, int max);
+
+        uint32_t get_spin_ns() const { return _spin_ns; }
+        uint64_t get_spin_hits() const { return _spin_hits; }
+        uint64_t get_sleeps() const { return _sleeps; }
+    private:
+        completion_queue_devx* _cq;
+        completion_channel*    _channel;
+        cq_wait_params         _params;
+        uint32_t               _spin_ns;
+        uint64_t               _spin_hits;
+        uint64_t               _sleeps;
+};
+
+//==============================================================================
+// Shared Receive Queue
+//==============================================================================
+
+struct srq_init_params {
+    uint32_t pdn              = 0;
+    uint8_t  log_srq_size     = 10;
+    uint32_t max_sge          = 1;   /* data segments per receive WQE */
+    uint16_t lwm              = 0;   /* limit event watermark, 0 disables it */
+    uint8_t  log_num_strides  = 0;   /* striding mode when non-zero: strides per WQE, 9..16 */
+    uint8_t  log_stride_size  = 0;   /* striding mode: bytes per stride */
+};
+
+/* A message landed in a striding SRQ buffer */
+struct stride_msg {
+    char*    data;
+    uint32_t len;
+    uint16_t wqe_index;
+    uint16_t stride_index;
+    uint16_t num_strides;
+};
+
+/* One pool of receive WQEs for many QPs, created as a DEVX RMP. The WQEs
+   form the linked list the HCA walks: a 16-byte next segment followed by
+   max_sge data segments. One WQE stays on the list as its tail, so
+   (1 << log_srq_size) - 1 receives can be outstanding. */
+class shared_receive_queue : public base_object {
+public:
+    shared_receive_queue();
+    ~shared_receive_queue();
+    void destroy() override;
+    STATUS initialize(rdma_device* rdevice, srq_init_params& params);
+
+    /* Bind to a WQE buffer of get_wqe_stride() << log_srq_size bytes and a
+       doorbell record. Called by initialize(); host-only tests pass plain
+       memory. */
+    STATUS attach_srq_buffers(void* wqe_buf, void* dbrec, srq_init_params& params);
+
+    /* post_recv() posts one WQE, post_recv_batch() one single-SGE WQE per
+       entry; either way with a single doorbell record update. Both fail with
+       STATUS_WOULD_BLOCK when the free list cannot take them all. */
+    STATUS post_recv(const ibv_sge* sgl, uint32_t num_sge);
+    STATUS post_recv_batch(const ibv_sge* sges, uint32_t count);
+
+    /* Return the WQE reported by a receive CQE (wqe_counter) to the free list */
+    void srq_complete(uint16_t wqe_counter);
+
+    /* Striding mode: each WQE is one buffer of strides holding many
+       messages. post_stride_buffers() carves [base, base + num_buffers *
+       get_buffer_size()) into buffers and posts them; consume() turns a
+       receive CQE into the message it reports (STATUS_NO_DATA for filler
+       CQEs); release() hands a message's strides back. A buffer is
+       reposted once every one of its strides has been released. */
+    STATUS post_stride_buffers(void* base, uint32_t lkey, uint32_t num_buffers);
+    STATUS consume(const cqe_out& cqe, stride_msg& msg);
+    void   release(const stride_msg& msg);
+    bool     is_striding() const { return _log_num_strides != 0; }
+    uint32_t get_buffer_size() const { return _stride_size << _log_num_strides; }
+
+    uint32_t get_srqn() const { return _srqn; }
+    uint32_t get_wqe_stride() const { return _stride; }
+    uint32_t available() const { return _free; }
+
+    static uint32_t wqe_stride(uint32_t max_sge);
+
+private:
+    char* get_wqe(uint32_t idx) const { return _buf + (size_t)idx * _stride; }
+    void  put_strides(uint16_t wqe_index, uint32_t count);
+
+    auto_ref<user_memory> _umem;
+    auto_ref<user_memory> _umem_db;
+    mlx5dv_devx_obj*      _srq;
+    uint32_t              _srqn;
+
+    char*              _buf;
+    volatile uint32_t* _dbrec;
+    uint32_t           _wqe_cnt;
+    uint32_t           _stride;
+    uint32_t           _max_sge;
+    uint16_t           _head;      // next free WQE to post
+    uint16_t           _tail;      // last WQE of the list, never posted
+    uint16_t           _counter;   // WQEs posted, mirrored to the dbrec
+    uint32_t           _free;
+
+    // Striding mode
+    uint8_t               _log_num_strides = 0;
+    uint32_t              _stride_size     = 0;
+    uint32_t              _stride_lkey     = 0;
+    std::vector<char*>    _wqe_data;       // buffer posted in each WQE
+    std::vector<uint32_t> _strides_held;   // strides not yet released, per WQE
 };
 
 //==============================================================================
@@ -312,11 +626,28 @@ struct mlx5_wqe_inline_seg {
 	__be32		byte_count;
 };
 
+/* Which send WQEs request a CQE. Whatever the mode, a WQE is signaled when
+   the unsignaled run behind it reaches half the SQ, so there is always a
+   completion on the way to reclaim the ring. */
+enum qp_signal_mode {
+    QP_SIGNAL_ALL = 0,        /* every WQE (default) */
+    QP_SIGNAL_EVERY_N,        /* every sq_signal_period-th WQE, and IBV_SEND_SIGNALED ones */
+    QP_SIGNAL_ON_REQUEST,     /* IBV_SEND_SIGNALED WQEs only */
+};
+
+enum qp_scatter_to_cqe {
+    QP_SCATTER_TO_CQE_NONE = 0,
+    QP_SCATTER_TO_CQE_32   = 1,   // up to 32 bytes, any CQE size
+    QP_SCATTER_TO_CQE_64   = 2    // up to 64 bytes, 128-byte CQEs only
+};
+
 struct qp_init_creation_params {
     rdma_device* rdevice;
     ibv_context* context;
     uint32_t pdn;
     uint32_t cqn;
+    completion_queue_devx* send_cq;   // optional, see queue_pair::bind_send_cq()
+    shared_receive_queue*  srq;       // optional: receive from an SRQ, no RQ of its own
     uar* uar_obj;
     user_memory* umem_sq;
     user_memory* umem_db;
@@ -330,6 +661,28 @@ struct qp_init_creation_params {
     uint32_t max_inline_data;
     uint32_t max_rd_atomic;
     uint32_t max_dest_rd_atomic;
+
+    // BlueFlame: copy single-WQE posts into the write-combining register
+    // instead of ringing the 8-byte doorbell. Needs a UAR allocated with
+    // MLX5DV_UAR_ALLOC_TYPE_BF. bf_buf_size is one half of the device BF
+    // register; 0 takes it from the HCA caps.
+    bool     use_bf;
+    uint32_t bf_buf_size;
+
+    // Send completion signaling (qp_signal_mode); sq_signal_period is the N
+    // of QP_SIGNAL_EVERY_N
+    uint8_t  sq_signal_mode;
+    uint32_t sq_signal_period;
+
+    // Responder scatter-to-CQE (qp_scatter_to_cqe): small receives are
+    // written into the CQE instead of the receive buffer
+    uint8_t  scatter_to_cqe;
+
+    // mem_page_policy of the WQ buffer allocated by connection_resources
+    uint8_t  page_policy;
+
+    // mem_alloc_flags of that WQ buffer
+    uint8_t  alloc_flags;
 };
 
 struct qp_init_connection_params {
@@ -368,6 +721,26 @@ static inline void objects_get_av(struct ibv_ah *ah, struct mlx5_wqe_av *av)
     *av = *(dah.av);
 }
 
+/* queue_pair post flags, passed alongside the IBV_SEND_* bits */
+enum qp_post_flags {
+    QP_POST_NO_DOORBELL = 1u << 16,   /* build the WQE only; publish with ring_doorbell() */
+    QP_POST_WAIT        = 1u << 17,   /* spin on the bound send CQ while the SQ is full */
+};
+
+/* Pre-encoded single-SGE WQE for a repeated (opcode, rkey, lkey, flags).
+   The big-endian control, remote-address and data segments are built once
+   by queue_pair::make_wqe_template(); post_template() copies them and only
+   patches the WQE index, addresses and length. Valid for the QP that built
+   it only. */
+struct wqe_template {
+    mlx5_wqe_ctrl_seg  ctrl;        /* index 0, unsignaled; qpn/ds/imm final */
+    mlx5_wqe_raddr_seg raddr;       /* rkey final */
+    mlx5_wqe_data_seg  data;        /* lkey final */
+    __be32             qpn_ds_nodata; /* qpn_ds for a zero-length post */
+    uint32_t           flags;       /* OR'ed into every post's flags */
+    bool               has_raddr;
+};
+
 class queue_pair : public base_object {
 public:
     queue_pair();
@@ -375,6 +748,12 @@ public:
     void destroy() override;
     STATUS initialize(qp_init_creation_params& params);
 
+    /* Bind the posting path to the WQ buffer (RQ followed by SQ), doorbell
+       record and UAR register. Called by initialize(); host-only tests and
+       benchmarks pass plain memory. */
+    STATUS attach_wq_buffers(void* wq_buf, void* dbrec, void* uar_reg,
+                             qp_init_creation_params& params);
+
     struct ibv_qp* get() const;
     uint32_t get_qpn() const;
     STATUS create_ah(ibv_pd* pd, ibv_ah_attr* rattr);
@@ -386,6 +765,46 @@ public:
     STATUS rtr_to_rts(qp_init_connection_params& params);
 
     STATUS post_send(struct mlx5_wqe_ctrl_seg* ctrl, unsigned wqe_size);
+
+    /* Publish every WQE queued with QP_POST_NO_DOORBELL: one dbrec update
+       and one UAR write for the whole chain. No-op when nothing is pending. */
+    STATUS ring_doorbell();
+    uint16_t get_sq_pi() const { return _sq_pi; }
+    uint32_t get_pending_wqes() const { return _db_pending; }
+
+    /* Retire every send WQE up to and including the one at wqe_counter, as
+       reported by a requester CQE; with selective signaling one CQE covers
+       the unsignaled WQEs posted before it. Posts fail with
+       STATUS_WOULD_BLOCK while the SQ has no room for the WQE. */
+    void sq_complete(uint16_t wqe_counter);
+    uint16_t get_sq_ci() const { return _sq_ci; }
+
+    /* Free WQEBBs in the SQ */
+    uint32_t sq_available() const { return _sq_size - (uint16_t)(_sq_pi - _sq_ci); }
+
+    /* CQ polled by poll_send_cq() and by QP_POST_WAIT posts. On a shared
+       CQ, completions of other attached QPs reaped on the way are dispatched
+       to them; those of unattached QPs are lost to a waiting post. This
+       QP's own CQEs reaped by a waiting post go to the completion callback,
+       or without one are held for the next poll_send_cq(). The post fails
+       with STATUS_ERR only on this QP's own requester error. */
+    void bind_send_cq(completion_queue_devx* cq) { _send_cq = cq; }
+
+    /* Reap up to @max CQEs from the bound send CQ like poll_cq(), retiring
+       SQ slots for this QP's requester completions and RQ (or SRQ) WQEs for
+       its receive completions on the way. CQEs held back by a QP_POST_WAIT
+       post come first. */
+    int poll_send_cq(cqe_out* cqes, int max);
+
+    /* Retire the SQ or RQ/SRQ state one of this QP's CQEs covers. Receives
+       on a striding SRQ are left to shared_receive_queue::consume() and
+       release(). */
+    void complete(const cqe_out& cqe);
+
+    /* Called by completion_queue_devx::poll_dispatch() after complete() */
+    typedef void (*completion_cb)(queue_pair* qp, const cqe_out& cqe, void* arg);
+    void set_completion_cb(completion_cb cb, void* arg) { _comp_cb = cb; _comp_arg = arg; }
+    void notify(const cqe_out& cqe) { if (_comp_cb) _comp_cb(this, cqe, _comp_arg); }
     
     STATUS post_rdma_write(void* laddr, uint32_t lkey, 
                            void* raddr, uint32_t rkey, 
@@ -407,12 +826,62 @@ public:
                              uint32_t length, uint32_t imm_data, 
                              uint32_t flags = 0);
 
+    /* Gather variants: one data segment per SGE, up to max_send_sge */
+    STATUS post_rdma_write_sgl(const ibv_sge* sgl, uint32_t num_sge,
+                               void* raddr, uint32_t rkey, uint32_t flags = 0);
+
+    STATUS post_rdma_read_sgl(const ibv_sge* sgl, uint32_t num_sge,
+                              void* raddr, uint32_t rkey, uint32_t flags = 0);
+
+    STATUS post_send_sgl(const ibv_sge* sgl, uint32_t num_sge, uint32_t flags = 0);
+
+    /* Copy the payload into the WQE; no lkey, no DMA read by the HCA.
+       Fails with STATUS_INVALID_LENGTH above get_max_inline(). The lkey-based
+       post_* calls take IBV_SEND_INLINE and fall back to a data segment
+       when the payload does not fit. */
+    STATUS post_rdma_write_inline(const void* data, uint32_t length,
+                                  void* raddr, uint32_t rkey, uint32_t flags = 0);
+
+    STATUS post_send_inline(const void* data, uint32_t length, uint32_t flags = 0);
+
+    uint32_t get_max_inline() const { return _max_inline; }
+
+    /* UMR: replace the translation list, length and access rights (IBV_ACCESS_*)
+       of an mkey created with umr_en and the same access mode as the layout,
+       through the SQ instead of a firmware command. The list is inlined, so
+       the WQE holds at most UMR_MAX_INLINE_ENTRIES. The UMR waits for earlier
+       RDMA reads and atomics of this QP; later WQEs of this QP see the new
+       translation, other QPs only once its completion has been reaped. On
+       HCAs with umr_modify_atomic_disabled the atomic right is left as the
+       mkey was created and IBV_ACCESS_REMOTE_ATOMIC is ignored. */
+    STATUS post_umr(uint32_t mkey, const mkey_layout& layout,
+                    uint32_t access, uint32_t flags = 0);
+
+    /* Build a template for SEND, SEND_IMM, RDMA_WRITE, RDMA_WRITE_IMM or
+       RDMA_READ (MLX5_OPCODE_*); imm_data only applies to the _IMM opcodes. */
+    STATUS make_wqe_template(wqe_template& tmpl, uint8_t opcode,
+                             uint32_t rkey, uint32_t lkey,
+                             uint32_t flags = 0, uint32_t imm_data = 0) const;
+
+    STATUS post_template(const wqe_template& tmpl, void* laddr,
+                         void* raddr, uint32_t length, uint32_t flags = 0);
+
     // RDMA Write wrapper for test.cpp compatibility
     STATUS post_write(void* laddr, uint32_t lkey, void* raddr, uint32_t rkey, uint32_t length, uint32_t flags = 0) {
         return post_rdma_write(laddr, lkey, raddr, rkey, length, flags);
     }
 
-    STATUS post_recv();
+    /* Receive posting into the QP's own RQ: post_recv() posts one WQE of up
+       to 4 SGEs (one 64-byte RQ stride), post_recv_batch() one single-SGE
+       WQE per entry; either way with a single RQ doorbell record update.
+       STATUS_WOULD_BLOCK when the RQ is full, STATUS_INVALID_OPERATION on a
+       QP attached to an SRQ. */
+    STATUS post_recv(const ibv_sge* sgl, uint32_t num_sge);
+    STATUS post_recv_batch(const ibv_sge* sges, uint32_t count);
+
+    /* Retire RQ WQEs up to and including wqe_counter (receive CQE) */
+    void rq_complete(uint16_t wqe_counter) { _rq_ci = wqe_counter + 1; }
+    uint32_t rq_available() const { return _rq_size - (uint16_t)(_rq_pi - _rq_ci); }
 
     // Query the QP state using DEVX and return as int
     int get_qp_state() const;
@@ -435,6 +904,28 @@ private:
                     void* raddr, uint32_t rkey, uint32_t length,
                     uint32_t imm_data = 0, uint32_t flags = 0);
 
+    STATUS post_wqe_sgl(uint8_t opcode, const ibv_sge* sgl, uint32_t num_sge,
+                        void* raddr, uint32_t rkey,
+                        uint32_t imm_data = 0, uint32_t flags = 0);
+
+    STATUS post_wqe_inline(uint8_t opcode, const void* data, uint32_t length,
+                           void* raddr, uint32_t rkey,
+                           uint32_t imm_data = 0, uint32_t flags = 0);
+
+    void commit_wqe(struct mlx5_wqe_ctrl_seg* ctrl, unsigned wqe_size, uint32_t flags);
+
+    bool sq_has_room(unsigned num_bb) const {
+        return (uint16_t)(_sq_pi - _sq_ci) + num_bb <= _sq_size;
+    }
+
+    /* Slow path of a post that found the SQ full: STATUS_WOULD_BLOCK, or
+       with QP_POST_WAIT spin on the send CQ until num_bb WQEBBs are free */
+    STATUS wait_sq_room(unsigned num_bb, uint32_t flags);
+
+    bool owns_cqe(const cqe_out& cqe) const {
+        return cqe.qpn == _qpn || _send_cq->lookup_qp(cqe.qpn) == this;
+    }
+
     mlx5dv_devx_obj* _qp;
     uint32_t _qpn;
 
@@ -449,14 +940,48 @@ private:
     
     uint16_t _sq_pi = 0;       // SQ producer index
     uint16_t _sq_ci = 0;       // SQ consumer index
-    uint16_t _sq_size = 0;     // SQ size in WQEs
+    uint32_t _sq_size = 0;     // SQ size in WQEs
     uint32_t _sq_dbr_offset;   // Offset to SQ doorbell record
     uint32_t _sq_buf_offset;   // Offset in send queue buffer
+    uint32_t _max_send_sge = 1;
+    uint32_t _max_inline   = 0;
+
+    // Raw views used by the posting path
+    char*              _sq_buf = nullptr;   // First SQ WQEBB
+    char*              _sq_end = nullptr;   // One past the last SQ WQEBB
+    volatile uint32_t* _dbrec  = nullptr;   // RCV/SND doorbell records
+    void*              _db_reg = nullptr;   // UAR doorbell / BlueFlame register
+
+    // WQEs built since the last doorbell
+    mlx5_wqe_ctrl_seg* _last_ctrl     = nullptr;
+    unsigned           _last_wqe_size = 0;
+    uint32_t           _db_pending    = 0;
+
+    // Selective signaling and SQ reclaim
+    uint8_t              _sig_mode      = QP_SIGNAL_ALL;
+    uint32_t             _sig_period    = 1;
+    uint32_t             _unsignaled    = 0;   // WQEs since the last signaled one
+    uint32_t             _unsignaled_bb = 0;   // ...and their WQEBBs
+    std::vector<uint8_t> _sq_wqe_bb;           // WQEBBs of the WQE starting at each slot
+    completion_queue_devx* _send_cq = nullptr;
+    completion_cb          _comp_cb  = nullptr;
+    void*                  _comp_arg = nullptr;
+    std::deque<cqe_out>    _reaped;              // own CQEs a waiting post polled
+
+    // Receive queue, first in the WQ buffer
+    char*                 _rq_buf       = nullptr;
+    uint32_t              _rq_size      = 0;
+    uint16_t              _rq_pi        = 0;
+    uint16_t              _rq_ci        = 0;
+    uint32_t              _max_recv_sge = 1;
+    shared_receive_queue* _srq          = nullptr;
 
     // BlueFlame buffer tracking for doorbell
     uint32_t _bf_offset   = 0;       // Current BlueFlame doorbell offset
     uint32_t _bf_buf_size = 0;       // BlueFlame buffer size in bytes (initialized after qp setup)
     bool     _use_bf      = false;
+
+    bool     _umr_atomic_disabled = false;   // hca_capabilities::umr_modify_atomic_disabled
 };
 
 
@@ -536,6 +1061,8 @@ struct mr_creation_params {
     uint32_t pdn;
     uint32_t length;
     uint32_t mr_id;
+    uint8_t  page_policy;   /* mem_page_policy */
+    uint8_t  alloc_flags;   /* mem_alloc_flags */
 };
 
 class memory_region : public base_object {
@@ -549,9 +1076,44 @@ class memory_region : public base_object {
             rdma_device* rdevice,
             queue_pair* qp,
             protection_domain* pd,
+            size_t length,
+            mem_page_policy page_policy = MEM_PAGE_DEFAULT,
+            uint32_t alloc_flags = 0
+        );
+
+        /* Zero-copy: register [addr, addr + length) of the caller's memory.
+           Any alignment; the MKEY starts at addr through mkey_umem_offset. */
+        STATUS
+        initialize(
+            rdma_device* rdevice,
+            queue_pair* qp,
+            protection_domain* pd,
+            void* addr,
             size_t length
         );
     
+        /* Wrap a registration made elsewhere so it can be handed to APIs
+           taking a memory_region; nothing is released on destroy() */
+        STATUS attach_mkey(void* addr, size_t length, uint32_t lkey, uint32_t rkey);
+
+        /* On-demand paging: nothing is pinned, the HCA faults pages in on
+           first access. addr nullptr with length 0 registers the implicit
+           ODP MR covering the whole address space; any buffer can then be
+           used with its lkey. */
+        STATUS initialize_odp(rdma_device* rdevice, protection_domain* pd,
+                              void* addr, size_t length);
+
+        /* ODP only: map [addr, addr + length) ahead of traffic. write asks
+           for writable mappings; sync waits for the pages instead of
+           leaving the work queued in the kernel. */
+        STATUS prefetch(void* addr, size_t length, bool write = false, bool sync = false);
+
+        bool     is_odp() const { return _odp_mr != nullptr; }
+        bool     is_implicit_odp() const { return _odp_mr && !_addr; }
+        uint64_t get_prefetch_calls() const { return _prefetch_calls; }
+        uint64_t get_prefetch_bytes() const { return _prefetch_bytes; }
+        uint64_t get_prefetch_errors() const { return _prefetch_errors; }
+
         uint32_t get_lkey() const;
         uint32_t get_rkey() const;
         void*    get_addr() const;
@@ -563,13 +1125,18 @@ class memory_region : public base_object {
         uint32_t get_mr_flags() const;
     
     private:
+        STATUS create_mkey(protection_domain* pd, size_t umem_offset);
+
         STATUS
         create_user_memory(
             rdma_device* rdevice,
-            size_t length
+            size_t length,
+            mem_page_policy page_policy,
+            uint32_t alloc_flags
         ) {
             _umem = new user_memory();
-            STATUS res = _umem->initialize(rdevice->get_context(), length);
+            STATUS res = _umem->initialize(rdevice->get_context(), length, page_policy,
+                                           alloc_flags);
             if (FAILED(res)) {
                 log_error("Failed to create user memory");
                 return res;
@@ -591,6 +1158,7 @@ class memory_region : public base_object {
         }
 
         mlx5dv_devx_obj* _cross_mr;
+        ibv_mr*          _odp_mr;
         user_memory*     _umem;
         queue_pair*      _qp;
         rdma_device*     _rdevice;
@@ -604,4 +1172,333 @@ class memory_region : public base_object {
         uint32_t  _mr_pd;
         uint32_t  _mr_access;
         uint32_t  _mr_flags;
+
+        uint64_t  _prefetch_calls;
+        uint64_t  _prefetch_bytes;
+        uint64_t  _prefetch_errors;
+};
+
+//==============================================================================
+// Indirect Mkey
+//==============================================================================
+
+#define MLX5_KLM_MAX_BYTE_COUNT  (1U << 31)
+
+/* A UMR WQE is control + UMR control (one WQEBB), the mkey context (one
+   WQEBB) and the inline list padded to 4 entries per WQEBB, within the 63
+   DS of a control segment */
+#define UMR_MAX_INLINE_ENTRIES   52
+
+/* access_mode for build_layout()/initialize(): KSM when the list allows it */
+#define MKEY_ACCESS_MODE_AUTO    0xff
+
+/* length bytes at offset into mr, one piece of an indirect mkey */
+struct mkey_segment {
+    memory_region* mr;
+    size_t         offset;
+    size_t         length;
+};
+
+/* Translation list of an indirect mkey as the HCA consumes it. KSM entries
+   use the KLM layout with byte_count reserved. */
+struct mkey_layout {
+    uint8_t  access_mode     = MLX5_MKC_ACCESS_MODE_KLMS;
+    uint8_t  log_entity_size = 0;           /* KSM: bytes behind each entry */
+    uint64_t length          = 0;
+    std::vector<mlx5_wqe_umr_klm_seg> entries;
+};
+
+/* DEVX KLM/KSM mkey presenting scattered registrations as one contiguous
+   range [0, get_length()), so a peer reaches all of them with one rkey and
+   one WQE. Segments are laid out back to back in list order. Created with
+   umr_en so update() can replace the translation with a UMR WQE. */
+class indirect_mkey : public base_object {
+    public:
+        indirect_mkey();
+        ~indirect_mkey();
+        void destroy() override;
+
+        /* max_entries reserves translation room for later update()s;
+           0 sizes it for num_segs. The mkey keeps access_mode for life:
+           pass MLX5_MKC_ACCESS_MODE_KLMS when later lists may be ragged even
+           though the first one is uniform. */
+        STATUS initialize(rdma_device* rdevice, protection_domain* pd,
+                          const mkey_segment* segs, size_t num_segs,
+                          uint32_t max_entries = 0,
+                          uint8_t access_mode = MKEY_ACCESS_MODE_AUTO);
+        STATUS initialize(rdma_device* rdevice, protection_domain* pd,
+                          const std::vector<mkey_segment>& segs,
+                          uint32_t max_entries = 0,
+                          uint8_t access_mode = MKEY_ACCESS_MODE_AUTO) {
+            return initialize(rdevice, pd, segs.data(), segs.size(), max_entries, access_mode);
+        }
+
+        /* Re-point the mkey at new segments with a UMR posted on qp, which
+           must share the mkey's PD. The list is laid out in the mkey's own
+           mode: any list fits a KLM mkey, while a KSM mkey fails with
+           STATUS_INVALID_OPERATION on a list KSM can't express or of another
+           entity size. STATUS_INVALID_SIZE past the reserved entries. */
+        STATUS update(queue_pair* qp, const mkey_segment* segs, size_t num_segs,
+                      uint32_t access = IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ |
+                                        IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_ATOMIC,
+                      uint32_t flags = 0);
+
+        /* Lay the list out in access_mode. MKEY_ACCESS_MODE_AUTO takes KSM
+           when every segment has the same power-of-two length and is aligned
+           to it, KLM otherwise; asking for KSM on any other list fails with
+           STATUS_INVALID_OPERATION. STATUS_INVALID_SIZE past max_entries. */
+        static STATUS build_layout(const mkey_segment* segs, size_t num_segs,
+                                   uint32_t max_entries, mkey_layout* layout,
+                                   uint8_t access_mode = MKEY_ACCESS_MODE_AUTO);
+
+        /* Whether a UMR can switch an mkey from one layout to the other. The
+           UMR leaves the access mode and the page (entity) size alone, so
+           both must match; STATUS_INVALID_OPERATION otherwise. */
+        static STATUS check_update(const mkey_layout& from, const mkey_layout& to);
+
+        uint32_t get_lkey() const { return _lkey; }
+        uint32_t get_rkey() const { return _lkey; }
+        uint64_t get_length() const { return _layout.length; }
+        uint32_t get_max_entries() const { return _max_entries; }
+        const mkey_layout& get_layout() const { return _layout; }
+
+    private:
+        mlx5dv_devx_obj* _mkey;
+        uint32_t         _lkey;
+        uint32_t         _max_entries;
+        mkey_layout      _layout;
+};
+
+//==============================================================================
+// Registration Cache
+//==============================================================================
+
+/* Registers and deregisters one range on behalf of the cache. reg() fills
+   the keys and an opaque handle that is later passed back to dereg(). */
+struct mr_cache_ops {
+    STATUS (*reg)(void* ctx, void* addr, size_t length,
+                  uint32_t* lkey, uint32_t* rkey, void** handle);
+    void   (*dereg)(void* ctx, void* handle);
+    void*  ctx;
+};
+
+struct mr_cache_params {
+    size_t max_bytes = 1UL << 30;   /* budget for registered bytes */
+    size_t alignment = 0;           /* registration granularity, 0: page size */
+};
+
+struct mr_cache_entry {
+    uintptr_t start;
+    size_t    length;
+    uint32_t  lkey;
+    uint32_t  rkey;
+    void*     handle;
+
+    uint32_t  refcount;
+    bool      indexed;              /* false once merged away or invalidated */
+    std::list<mr_cache_entry*>::iterator lru;   /* in the LRU, or retired list once unindexed */
+};
+
+/* Address-range registration cache. Indexed entries never overlap: a miss
+   that overlaps cached ranges registers their union and retires them, so
+   the covering entry of any range is the one starting at or before it.
+   Unreferenced entries are kept on an LRU list and deregistered when the
+   budget needs room; referenced ones are never evicted. The cache is not
+   thread safe: threads sharing one must serialize every call. */
+class mr_cache : public base_object {
+    public:
+        mr_cache();
+        ~mr_cache();
+        void destroy() override;
+        STATUS initialize(const mr_cache_ops& ops, const mr_cache_params& params = mr_cache_params());
+
+        /* Take a reference on a registration covering [addr, addr + length),
+           registering one on a miss. STATUS_NO_MEM when the budget cannot
+           be met without evicting referenced entries. */
+        STATUS get(void* addr, size_t length, mr_cache_entry** entry);
+        void   put(mr_cache_entry* entry);
+
+        /* Drop cached registrations overlapping a range that is being freed
+           or remapped; referenced ones go when their last put() comes. */
+        void   invalidate(void* addr, size_t length);
+
+        size_t   get_registered_bytes() const { return _bytes; }
+        size_t   get_num_entries() const { return _index.size(); }
+        uint64_t get_hits() const { return _hits; }
+        uint64_t get_misses() const { return _misses; }
+        uint64_t get_evictions() const { return _evictions; }
+
+    private:
+        mr_cache_entry* lookup(uintptr_t start, uintptr_t end) const;
+        void   unindex(mr_cache_entry* entry);
+        void   release(mr_cache_entry* entry);
+        bool   evict_for(size_t length);
+
+        mr_cache_ops                         _ops;
+        mr_cache_params                      _params;
+        std::map<uintptr_t, mr_cache_entry*> _index;   // start -> entry
+        std::list<mr_cache_entry*>           _lru;     // unreferenced, most recent first
+        std::list<mr_cache_entry*>           _retired; // unindexed, awaiting their last put()
+        size_t                               _bytes;
+        uint64_t                             _hits;
+        uint64_t                             _misses;
+        uint64_t                             _evictions;
+};
+
+/* mr_cache_ops registering caller memory as memory_region objects */
+struct mr_region_registrar {
+    rdma_device*       rdevice = nullptr;
+    protection_domain* pd      = nullptr;
+
+    static STATUS reg(void* ctx, void* addr, size_t length,
+                      uint32_t* lkey, uint32_t* rkey, void** handle);
+    static void   dereg(void* ctx, void* handle);
+    mr_cache_ops  ops() { return { reg, dereg, this }; }
+};
+
+//==============================================================================
+// Registered Memory Pool
+//==============================================================================
+
+#define MR_POOL_MIN_CLASS_LOG   6       /* 64B */
+#define MR_POOL_MAX_CLASS_LOG   20      /* 1MB, also the slab size */
+#define MR_POOL_NUM_CLASSES     (MR_POOL_MAX_CLASS_LOG - MR_POOL_MIN_CLASS_LOG + 1)
+#define MR_POOL_SLAB_UNUSED     0xff    /* class of a slab not yet claimed */
+
+struct mr_pool_params {
+    size_t   size        = 64UL << 20;        /* arena bytes, whole slabs are used */
+    uint8_t  page_policy = MEM_PAGE_DEFAULT;  /* mem_page_policy of the arena */
+    uint32_t cache_size  = 64;                /* blocks per class in a mr_pool_cache */
+};
+
+/* One block handed out by the pool. offset is from the start of the arena,
+   for peers that address the pool by rkey + offset. */
+struct mr_pool_buf {
+    void*    addr;
+    uint64_t offset;
+    uint32_t lkey;
+    uint32_t rkey;
+    uint32_t length;                           /* size class, >= the request */
+};
+
+/* Power-of-two size classes carved from one registered arena, so every
+   buffer shares a single MKEY. The arena is cut into 1MB slabs handed to a
+   class on demand; a class allocates from its free list, then by bumping
+   through its current slab. A block's class is found from its slab, so
+   alloc() and free() are O(1) and blocks carry no header. The pool is
+   thread safe behind one lock; mr_pool_cache takes that off the hot path. */
+class mr_pool : public base_object {
+    public:
+        mr_pool();
+        ~mr_pool();
+        void destroy() override;
+
+        /* Allocate and register an arena of params.size bytes on rdevice */
+        STATUS initialize(rdma_device* rdevice, protection_domain* pd,
+                          const mr_pool_params& params = mr_pool_params());
+
+        /* Carve an arena the caller has already registered */
+        STATUS attach(void* base, size_t length, uint32_t lkey, uint32_t rkey,
+                      const mr_pool_params& params = mr_pool_params());
+
+        STATUS alloc(size_t size, mr_pool_buf* buf);
+
+        /* STATUS_INVALID_PARAM for an address outside the arena or not on
+           a block boundary of its slab's class */
+        STATUS free(void* addr);
+
+        /* Class index for a request, -1 above the largest class */
+        static int size_class(size_t size) {
+            if (size > (1UL << MR_POOL_MAX_CLASS_LOG)) {
+                return -1;
+            }
+            if (size <= (1UL << MR_POOL_MIN_CLASS_LOG)) {
+                return 0;
+            }
+            return 64 - __builtin_clzll(size - 1) - MR_POOL_MIN_CLASS_LOG;
+        }
+
+        void*    get_base() const { return _base; }
+        uint32_t get_lkey() const { return _lkey; }
+        uint32_t get_rkey() const { return _rkey; }
+        uint32_t get_num_slabs() const { return _num_slabs; }
+        uint32_t get_slabs_used() const { return _next_slab; }
+        uint32_t get_cache_size() const { return _params.cache_size; }
+
+    private:
+        friend class mr_pool_cache;
+
+        struct free_block {
+            free_block* next;
+        };
+
+        struct size_class_state {
+            free_block* free_list;
+            char*       bump;
+            char*       bump_end;
+        };
+
+        /* Callers hold _lock */
+        free_block* pop(int cls);
+        void        push(int cls, free_block* block);
+
+        void fill(void* addr, int cls, mr_pool_buf* buf) const {
+            buf->addr   = addr;
+            buf->offset = (char*)addr - _base;
+            buf->lkey   = _lkey;
+            buf->rkey   = _rkey;
+            buf->length = 1U << (cls + MR_POOL_MIN_CLASS_LOG);
+        }
+
+        /* Class of the block at addr, -1 when it is not one */
+        int class_of(void* addr) const {
+            uintptr_t offset = (uintptr_t)addr - (uintptr_t)_base;
+            if (unlikely((uintptr_t)addr < (uintptr_t)_base ||
+                         offset >= ((size_t)_num_slabs << MR_POOL_MAX_CLASS_LOG))) {
+                return -1;
+            }
+            uint8_t cls = _slab_class[offset >> MR_POOL_MAX_CLASS_LOG];
+            if (unlikely(cls == MR_POOL_SLAB_UNUSED ||
+                         (offset & ((1UL << (cls + MR_POOL_MIN_CLASS_LOG)) - 1)))) {
+                return -1;
+            }
+            return cls;
+        }
+
+        memory_region*       _mr;          /* owned when initialize()d */
+        char*                _base;
+        size_t               _length;
+        uint32_t             _lkey;
+        uint32_t             _rkey;
+        mr_pool_params       _params;
+        std::mutex           _lock;
+        std::vector<uint8_t> _slab_class;
+        uint32_t             _num_slabs;
+        uint32_t             _next_slab;
+        size_class_state     _classes[MR_POOL_NUM_CLASSES];
+};
+
+/* Per-thread front end of a mr_pool. Keeps up to cache_size free blocks
+   per class and only takes the pool lock to move half of that at once.
+   Owned by one thread; blocks go back to the pool on flush() or when the
+   cache is destroyed, and may be freed through any cache of the same pool. */
+class mr_pool_cache {
+    public:
+        explicit mr_pool_cache(mr_pool* pool);
+        ~mr_pool_cache();
+
+        STATUS alloc(size_t size, mr_pool_buf* buf);
+        STATUS free(void* addr);    /* checked as mr_pool::free() */
+        void   flush();
+
+    private:
+        struct bin {
+            mr_pool::free_block* head;
+            uint32_t             count;
+        };
+
+        void drain(int cls, uint32_t count);
+
+        mr_pool* _pool;
+        bin      _bins[MR_POOL_NUM_CLASSES];
 };
@@ -260,9 +260,11 @@ int main ()
     qp_init_conn_params1.remote_ah_attr = nullptr;
 
 
-    // Register memory for the first QP (sender)
+    // Register memory for the first QP (sender) straight from an application
+    // buffer, deliberately not page aligned, so the write goes out zero-copy
+    static char app_buf[8192];
     auto_ref<memory_region> mr_sender;
-    res = mr_sender->initialize(rdevice, p_qp, pd, 2048);
+    res = mr_sender->initialize(rdevice, p_qp, pd, app_buf + 100, 2048);
     RETURN_IF_FAILED(res);
     
     // Register memory for the second QP (receiver)